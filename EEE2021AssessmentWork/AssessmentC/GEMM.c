@@ -1,205 +1,124 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>  
-#include <sys/time.h>  // Added these packages for timing calculations.
+#include "gemm.h"           // The loop orderings, plus init_matrices and friends (libgemm).
+#include "perf_counters.h"   // Optional hardware counters (GEMM_PERF=1), to see why the orderings differ.
+#define MEMPROF_ALLOCATOR   // This program's malloc and free keep the heap count for memprof.h
+#include "memprof.h"        // Optional memory profile (GEMM_MEMPROF=1): stack depth, heap peak, page faults.
+#include "bench_harness.h"  // Timing (CLOCK_MONOTONIC, warmup, adaptive repetitions) lives here now.
+#include "sweep_spec.h"     // Which shapes and orderings to run, from argv or a config file.
+#include "bench_json.h"     // Optional JSON lines output with the environment, for the results history.
 
-// Number of 'runs' to average for each test case (best of 3, average will be )
-#define NUM_RUNS 3
+typedef void (*gemm_func_t)(int, int, int, double*, double*, double*);
 
-// Function to get current time in microseconds (more accurate for measurement)
-/**
- * Can use 
- */
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec * 1e-6;
-}
-
-/*
-Initialising the matrices for AB + C.
-*/
-void init_matrices(int m, int n, int k, double **A, double **B, double **C) {
-    *A = (double *)malloc(m * k * sizeof(double));
-    *B = (double *)malloc(k * n * sizeof(double));
-    *C = (double *)malloc(m * n * sizeof(double));
-    
-    if (*A == NULL || *B == NULL || *C == NULL) {
-        printf("Memory allocation failed!\n");
-        exit(1);
-    }
-    
-    /**
-     * Initialising the values of the matrices to be between 0 and 1. 
-     * Best method I have seen so far for randomisation. 
-     */
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < k; j++) {
-            (*A)[i*k + j] = (double)rand() / RAND_MAX;
-        }
-    }
-    
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < n; j++) {
-            (*B)[i*n + j] = (double)rand() / RAND_MAX;
-        }
-    }
-    
-    // Initialising C as a zero matrix, needed for GeMM to be done correctly.
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            (*C)[i*n + j] = 0.0;
-        }
-    }
-}
-
-// Resets the matrix to 0 every time.
-void reset_matrix_c(double *C, int m, int n) {
-    for (int i = 0; i < m * n; i++) {
-        C[i] = 0.0;
-    }
-}
-
-// Clears the matrices for the next calculation. 
-void free_matrices(double *A, double *B, double *C) {
-    free(A);
-    free(B);
-    free(C);
-}
-
-/**
- * MNK implementation (row-by-row) Time Complexity of O(n^3).
- * The reason why it is n^3 is becuase of the 3 nested 'for' loops,
- * The outermost loop runs 'm' times.
- * The middle loop runs 'n' times for each iteration of the outer loop.
- * The innermost loop runs 'k' times for each iteration of the middle loop, 
- * So the Big O notation will amount to  O(m * n * k), -> O(n^3).
- * Even if the loop ordering changes, it will always be O(n^3). 
- * 
- * Space complexity is much more simpler for this algorithm/loop ordering.
- * Since no additional data structures are allocated within the function 
- * (only the given matrices are used), the space complexity is O(1), regardless of loop ordering.
- */
-void mnk_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            for (int p = 0; p < k; p++) {
-                C[i*n + j] += A[i*k + p] * B[p*n + j];
-            }
-        }
-    }
-}
-
-/**
- * MKN implementation (row-inner-column) Time Complexity of O(n^3).
- * In practice, there should be very minimal difference between the different orderings,
- * but locality should be considered for each different ordering. 
- */
-void mkn_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int i = 0; i < m; i++) {
-        for (int p = 0; p < k; p++) {
-            double a_ip = A[i*k + p];
-            for (int j = 0; j < n; j++) {
-                C[i*n + j] += a_ip * B[p*n + j];
-            }
-        }
-    }
-}
-
-/**
- * NMK implementation (column-by-column) Time Complexity of O(n^3)
- */
-void nmk_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int j = 0; j < n; j++) {
-        for (int i = 0; i < m; i++) {
-            for (int p = 0; p < k; p++) {
-                C[i*n + j] += A[i*k + p] * B[p*n + j];
-            }
-        }
-    }
-}
+// What the harness needs to run (and reset for) one loop ordering
+typedef struct {
+    gemm_func_t fn;
+    int m, n, k;
+    double *A, *B, *C;
+} gemm_bench_t;
 
-/**
- * NKM implementation (column-inner-row) Time Complexity of O(n^3)
- */
-void nkm_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int j = 0; j < n; j++) {
-        for (int p = 0; p < k; p++) {
-            double b_pj = B[p*n + j];
-            for (int i = 0; i < m; i++) {
-                C[i*n + j] += A[i*k + p] * b_pj;
-            }
-        }
-    }
+static void run_bench_gemm(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    b->fn(b->m, b->n, b->k, b->A, b->B, b->C);
 }
 
-/**
- * KMN implementation (inner-row-column) Time Complexity of O(n^3)
- */
-void kmn_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int p = 0; p < k; p++) {
-        for (int i = 0; i < m; i++) {
-            double a_ip = A[i*k + p];
-            for (int j = 0; j < n; j++) {
-                C[i*n + j] += a_ip * B[p*n + j];
-            }
-        }
-    }
+static void reset_bench_c(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    reset_matrix_c(b->C, b->m, b->n);
 }
 
-/**
- * KNM implementation (inner-column-row) Time Complexity of O(n^3)
- */
-void knm_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int p = 0; p < k; p++) {
-        for (int j = 0; j < n; j++) {
-            double b_pj = B[p*n + j];
-            for (int i = 0; i < m; i++) {
-                C[i*n + j] += A[i*k + p] * b_pj;
-            }
-        }
-    }
-}
-
-int main() {
-    // Random number generation.
-    srand(time(NULL));
+int main(int argc, char *argv[]) {
+    // Random number generation (a different seed each run, as with srand(time(NULL)) before).
+    set_matrix_seed((uint64_t)time(NULL));
     
     /*
-    Matrix sizes to test (The jump between matrix sizes is on purpose, 
+    Default matrix sizes to test (The jump between matrix sizes is on purpose, 
     can clearly see the time increasing as it is a cubic relationship). 
+    Other shapes, rectangular ones included, can be given with --sizes/--m/--n/--k/--shape or --config.
     */
     int sizes[] = {10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 200, 300, 400};
     int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
     
+    static sweep_spec_t sweep;
+    if (sweep_parse_args(&sweep, argc, argv) != 0 || sweep_finalize(&sweep, sizes, num_sizes) != 0) {
+        fprintf(stderr, "Usage: %s [--sizes LIST] [--m LIST] [--n LIST] [--k LIST] [--shape MxNxK,...] "
+                        "[--variants NAME,...] [--output FILE] [--json FILE] [--config FILE]\n", argv[0]);
+        return 1;
+    }
+    
     // All loop orderings that I have used.
-    typedef void (*gemm_func)(int, int, int, double*, double*, double*);
-    gemm_func funcs[] = {mnk_gemm, mkn_gemm, nmk_gemm, nkm_gemm, kmn_gemm, knm_gemm};
+    gemm_func_t funcs[] = {mnk_gemm, mkn_gemm, nmk_gemm, nkm_gemm, kmn_gemm, knm_gemm};
     const char *func_names[] = {"MNK", "MKN", "NMK", "NKM", "KMN", "KNM"};
     int num_funcs = sizeof(funcs) / sizeof(funcs[0]);
+    if (sweep_check_variants(&sweep, func_names, num_funcs) != 0) {
+        return 1;
+    }
     
-    // Create results CSV file
-    FILE *results_file = fopen("gemm_times.csv", "w");
-    if (results_file == NULL) {
+    // Create results CSV file, plus the per-run statistics (min/median/stddev and GFLOP/s)
+    const char *results_path = (sweep.output[0] != '\0') ? sweep.output : "gemm_times.csv";
+    char stats_path[SWEEP_MAX_PATH + 16];
+    sweep_stats_path(results_path, stats_path, sizeof(stats_path));
+    FILE *results_file = fopen(results_path, "w");
+    FILE *stats_file = fopen(stats_path, "w");
+    if (results_file == NULL || stats_file == NULL) {
         fprintf(stderr, "Error opening results file\n");
         return 1;
     }
+    bench_write_stats_header(stats_file);
+    perf_write_header_columns(stats_file);
+    memprof_write_header_columns(stats_file);
+    fprintf(stats_file, "\n");
+    bench_config_t bench_cfg = bench_config_from_env();
+    
+    // JSON lines (--json), appended to so the file keeps the history of every run
+    bench_json_t json = {0};
+    if (sweep.json[0] != '\0' && bench_json_open(&json, sweep.json, "GEMM") != 0) {
+        return 1;
+    }
+    bench_json_config_int(&json, "threads", 1);
+    bench_json_config_int(&json, "warmup", bench_cfg.warmup);
+    bench_json_config_int(&json, "min_reps", bench_cfg.min_reps);
+    bench_json_config_str(&json, "arena", matrix_arena_backing());
+    double *samples = (double *)malloc((size_t)bench_cfg.max_reps * sizeof(double));
+    if (samples == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    
+    // Counters only on this thread, every ordering is single threaded
+    perf_counters_t perf = {0};
+    int use_perf = 0;
+    if (perf_counters_requested()) {
+        pid_t self = 0;
+        int opened = perf_counters_open(&perf, &self, 1);
+        use_perf = (opened > 0);
+        printf("Performance counters: %d of %d events available\n", opened, PERF_NUM_EVENTS);
+    }
+    int use_memprof = memprof_requested();
     
     // CSV file headers, easier for me to use for graph plotting purposes. Check the python scripts for plotting. 
-    fprintf(results_file, "Matrix Size");
+    // M, N, K columns only appear when the sweep has rectangular shapes.
+    int rectangular = sweep_has_rectangular(&sweep);
+    fprintf(results_file, rectangular ? "Matrix Size,M,N,K" : "Matrix Size");
     for (int i = 0; i < num_funcs; i++) {
-        fprintf(results_file, ",%s", func_names[i]);
+        if (sweep_variant_selected(&sweep, func_names[i])) {
+            fprintf(results_file, ",%s", func_names[i]);
+        }
     }
     fprintf(results_file, "\n");
     
-    // Run benchmarks for each matrix size
-    for (int s = 0; s < num_sizes; s++) {
-        int size = sizes[s];
-        int m = size, n = size, k = size;
+    // Run benchmarks for each shape
+    for (int s = 0; s < sweep.num_shapes; s++) {
+        int m = sweep.shapes[s].m, n = sweep.shapes[s].n, k = sweep.shapes[s].k;
+        int size = sweep_shape_size(sweep.shapes[s]);
         
-        printf("Testing matrices of size %d x %d...\n", size, size);
+        printf("Testing matrices of size %d x %d (k = %d)...\n", m, n, k);
         
         fprintf(results_file, "%d", size);
+        if (rectangular) {
+            fprintf(results_file, ",%d,%d,%d", m, n, k);
+        }
         
         // Initialise matrices correctly
         double *A, *B, *C;
@@ -207,41 +126,58 @@ int main() {
         
         // Benchmark each loop ordering correctly
         for (int i = 0; i < num_funcs; i++) {
-            double total_time = 0.0;
-            
-            // Run the implementation NUM_RUNS (3, but you can alter it) times and average the results
-            for (int run = 0; run < NUM_RUNS; run++) {
-                // Reset matrix C to zeros for each run
-                reset_matrix_c(C, m, n);
-                
-                // Measure execution time
-                double start_time = get_time();
-                funcs[i](m, n, k, A, B, C);
-                double end_time = get_time();
-                
-                total_time += (end_time - start_time);
+            if (!sweep_variant_selected(&sweep, func_names[i])) {
+                continue;
             }
             
-            // Calculate the average execution time
-            double avg_time = total_time / NUM_RUNS;
+            // Warmup, then timed runs (C reset to zeros before each) until the timings settle
+            gemm_bench_t bench = {funcs[i], m, n, k, A, B, C};
+            bench_stats_t st = bench_run_samples(&bench_cfg, reset_bench_c, run_bench_gemm, &bench, samples);
+            
+            // Counters come from one extra untimed pass, so the ioctls never land in a timing
+            double counters[PERF_NUM_EVENTS];
+            if (use_perf) {
+                perf_counters_measure(&perf, reset_bench_c, run_bench_gemm, &bench, st.inner, counters);
+            }
+            // And the memory profile from one more
+            memprof_result_t mem;
+            if (use_memprof) {
+                memprof_measure(reset_bench_c, run_bench_gemm, &bench, &mem);
+            }
             
-            // Write results to CSV file
-            fprintf(results_file, ",%.6f", avg_time);
+            // The median goes in the CSV used for plotting, everything else in the stats file
+            fprintf(results_file, ",%.9f", st.median);
+            bench_write_stats_row(stats_file, size, func_names[i], &st, m, n, k);
+            perf_write_columns(stats_file, use_perf ? counters : NULL);
+            memprof_write_columns(stats_file, use_memprof ? &mem : NULL);
+            fprintf(stats_file, "\n");
+            bench_json_write_result(&json, func_names[i], m, n, k, &st, samples, use_perf ? counters : NULL);
             
             // Print results to console
-            printf("  %s: %.6f s\n", func_names[i], avg_time);
+            printf("  %s: %.6f s (min %.6f, +/- %.1f%%, %d runs), %.2f GFLOP/s\n", func_names[i], st.median, st.min,
+                   100.0 * st.ci95 / st.mean, st.reps * st.inner, bench_gflops(m, n, k, st.median));
+            if (use_memprof) {
+                memprof_print(&mem);
+            }
         }
         
         fprintf(results_file, "\n");
         fflush(results_file);
+        fflush(stats_file);
         
         // Free allocated memory
         free_matrices(A, B, C);
     }
     
     fclose(results_file);
+    fclose(stats_file);
+    bench_json_close(&json);
+    free(samples);
+    if (use_perf) {
+        perf_counters_close(&perf);
+    }
     
-    printf("\nBenchmarking complete. Results saved to gemm_times.csv\n");
+    printf("\nBenchmarking complete. Results saved to %s (statistics in %s)\n", results_path, stats_path);
     
     return 0;
 }
\ No newline at end of file
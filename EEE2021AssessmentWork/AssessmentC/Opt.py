@@ -17,14 +17,18 @@ def plot_execution_times(csv_file, output_dir='plots'):
         os.makedirs(output_dir)
     
     # Read the CSV file
-    df = pd.read_csv(csv_file)
+    # M, N, K are only there for rectangular sweeps; the size axis is the square-equivalent size
+    df = pd.read_csv(csv_file).drop(columns=['M', 'N', 'K'], errors='ignore')
     
     # Get column names (implementation names)
     implementations = df.columns[1:]
     
     # Set up colors and markers for different implementations
-    colors = ['blue', 'green', 'red', 'purple']
-    markers = ['o', 's', '^', 'D']
+    # (cycled, since OptGEMM can now write more than four columns)
+    base_colors = ['blue', 'green', 'red', 'purple', 'orange', 'brown', 'pink', 'gray', 'olive', 'cyan']
+    base_markers = ['o', 's', '^', 'D', 'v', 'P', 'X', '*', '<', '>']
+    colors = [base_colors[i % len(base_colors)] for i in range(len(implementations))]
+    markers = [base_markers[i % len(base_markers)] for i in range(len(implementations))]
     
     # Create line plot with all implementations
     plt.figure(figsize=(12, 7))
@@ -106,7 +110,7 @@ def plot_execution_times(csv_file, output_dir='plots'):
     fig, ax = plt.subplots(figsize=(14, 8))
     
     # Set the positions of the bars on the x-axis
-    bar_width = 0.2
+    bar_width = 0.8 / len(implementations)
     index = np.arange(len(selected_sizes))
     
     for i, impl in enumerate(implementations):
@@ -158,11 +162,176 @@ def plot_execution_times(csv_file, output_dir='plots'):
         time = largest_df[impl].values[0]
         print(f"  {impl}: {time:.4f}")
 
+def plot_gflops(stats_file, output_dir='plots'):
+    """
+    Plot GFLOP/s (from the median time) against matrix size using the stats CSV,
+    with the min-time GFLOP/s as a shaded band above each line.
+    
+    Args:
+        stats_file (str): Path to the long-format stats CSV written next to the times CSV
+        output_dir (str): Directory to save the plots
+    """
+    if not os.path.exists(output_dir):
+        os.makedirs(output_dir)
+    
+    df = pd.read_csv(stats_file)
+    implementations = list(dict.fromkeys(df['Implementation']))
+    
+    plt.figure(figsize=(12, 7))
+    for impl in implementations:
+        rows = df[df['Implementation'] == impl].sort_values('Matrix Size')
+        sizes = rows['Matrix Size']
+        peak = 2.0 * rows['M'] * rows['N'] * rows['K'] / rows['Min'] * 1e-9
+        line, = plt.plot(sizes, rows['GFLOPS'], marker='o', linewidth=2, markersize=6, label=impl)
+        plt.fill_between(sizes, rows['GFLOPS'], peak, color=line.get_color(), alpha=0.15)
+    
+    plt.xlabel('Matrix Size', fontsize=14)
+    plt.ylabel('GFLOP/s (median, band up to best run)', fontsize=14)
+    plt.title('GEMM Throughput', fontsize=16)
+    plt.grid(True, linestyle='--', alpha=0.7)
+    plt.legend(fontsize=10)
+    plt.tight_layout()
+    
+    gflops_plot_path = os.path.join(output_dir, 'gemm_gflops_comparison.png')
+    plt.savefig(gflops_plot_path, dpi=300)
+    print(f"Saved GFLOP/s plot to {gflops_plot_path}")
+
+def plot_counters(stats_file, output_dir='plots'):
+    """
+    Plot the hardware counter columns of the stats CSV (written when OptGEMM runs with
+    GEMM_PERF=1): IPC, and L1D / LLC / dTLB misses and vector FP instructions per FLOP.
+    Does nothing if the counters weren't recorded.
+    
+    Args:
+        stats_file (str): Path to the long-format stats CSV
+        output_dir (str): Directory to save the plots
+    """
+    df = pd.read_csv(stats_file)
+    panels = [('Instructions', 'Cycles', 'Instructions per Cycle'),
+              ('L1D Misses', None, 'L1D Misses per FLOP'),
+              ('LLC Misses', None, 'LLC Misses per FLOP'),
+              ('DTLB Misses', None, 'DTLB Misses per FLOP'),
+              ('FP Vector Ops', None, 'Vector FP Instructions per FLOP')]
+    panels = [p for p in panels if p[0] in df.columns and df[p[0]].notna().any()
+              and (p[1] is None or df[p[1]].notna().any())]
+    if not panels:
+        print("No performance counter data in the stats file, skipping counter plots")
+        return
+    
+    if not os.path.exists(output_dir):
+        os.makedirs(output_dir)
+    
+    implementations = list(dict.fromkeys(df['Implementation']))
+    fig, axes = plt.subplots(len(panels), 1, figsize=(12, 5 * len(panels)), squeeze=False)
+    for ax, (numerator, denominator, title) in zip(axes[:, 0], panels):
+        for impl in implementations:
+            rows = df[df['Implementation'] == impl].sort_values('Matrix Size')
+            divisor = rows[denominator] if denominator else 2.0 * rows['M'] * rows['N'] * rows['K']
+            ax.plot(rows['Matrix Size'], rows[numerator] / divisor, marker='o', linewidth=2, markersize=6, label=impl)
+        ax.set_xlabel('Matrix Size', fontsize=12)
+        ax.set_title(title, fontsize=14)
+        ax.grid(True, linestyle='--', alpha=0.7)
+        ax.legend(fontsize=9)
+    plt.tight_layout()
+    
+    counters_plot_path = os.path.join(output_dir, 'gemm_counters.png')
+    plt.savefig(counters_plot_path, dpi=300)
+    print(f"Saved counter plots to {counters_plot_path}")
+
+def plot_roofline(scaling_file, output_dir='plots'):
+    """
+    Roofline from the scaling CSV written by OptGEMM --scaling: the roof for the largest
+    thread count (triad bandwidth slope up to the double and float peaks), with every
+    variant's best run at that thread count placed at its arithmetic intensity.
+    
+    Args:
+        scaling_file (str): Path to the scaling CSV
+        output_dir (str): Directory to save the plots
+    """
+    if not os.path.exists(output_dir):
+        os.makedirs(output_dir)
+    
+    df = pd.read_csv(scaling_file)
+    df = df[df['Mode'] == 'strong']
+    threads = df['Threads'].max()
+    df = df[df['Threads'] == threads]
+    bandwidth = df['Bandwidth GBs'].max()
+    
+    plt.figure(figsize=(12, 8))
+    ai = np.logspace(-2, np.log10(max(df['AI'].max(), 1.0) * 4), 200)
+    typed = df['Implementation'].str.contains('f32|bf16|f16')
+    for peak, label in [(df[~typed]['Peak GFLOPS'].max(), 'double'), (df[typed]['Peak GFLOPS'].max(), 'float')]:
+        if pd.notna(peak):
+            plt.loglog(ai, np.minimum(peak, ai * bandwidth), linestyle='--', linewidth=2,
+                       label=f'Roof, {label} ({peak:.0f} GFLOP/s, {bandwidth:.1f} GB/s)')
+    
+    for impl in dict.fromkeys(df['Implementation']):
+        rows = df[df['Implementation'] == impl]
+        # Best block size per shape
+        best = rows.loc[rows.groupby('Matrix Size')['GFLOPS'].idxmax()]
+        plt.loglog(best['AI'], best['GFLOPS'], marker='o', linestyle='none', markersize=8, label=impl)
+        if 'LLC AI' in best.columns and best['LLC AI'].notna().any():
+            plt.loglog(best['LLC AI'], best['GFLOPS'], marker='x', linestyle='none', markersize=8,
+                       label=f'{impl} (LLC-measured AI)')
+    
+    plt.xlabel('Arithmetic Intensity (FLOP/byte)', fontsize=14)
+    plt.ylabel('GFLOP/s', fontsize=14)
+    plt.title(f'Roofline, {threads} threads', fontsize=16)
+    plt.grid(True, which='both', linestyle='--', alpha=0.5)
+    plt.legend(fontsize=9)
+    plt.tight_layout()
+    
+    roofline_plot_path = os.path.join(output_dir, 'gemm_roofline.png')
+    plt.savefig(roofline_plot_path, dpi=300)
+    print(f"Saved roofline plot to {roofline_plot_path}")
+
+def plot_scaling(scaling_file, output_dir='plots'):
+    """
+    Strong and weak scaling from the scaling CSV: speedup against the ideal line, and
+    parallel efficiency, for the best block size of each variant at the largest shape.
+    
+    Args:
+        scaling_file (str): Path to the scaling CSV
+        output_dir (str): Directory to save the plots
+    """
+    if not os.path.exists(output_dir):
+        os.makedirs(output_dir)
+    
+    df = pd.read_csv(scaling_file)
+    modes = [m for m in ['strong', 'weak'] if (df['Mode'] == m).any()]
+    fig, axes = plt.subplots(len(modes), 2, figsize=(16, 6 * len(modes)), squeeze=False)
+    for row, mode in zip(axes, modes):
+        rows = df[df['Mode'] == mode]
+        if mode == 'strong':
+            rows = rows[rows['Matrix Size'] == rows['Matrix Size'].max()]
+        threads = sorted(rows['Threads'].unique())
+        row[0].plot(threads, [t / threads[0] for t in threads], color='black', linestyle='--', label='Ideal')
+        for impl in dict.fromkeys(rows['Implementation']):
+            best = rows[rows['Implementation'] == impl].groupby('Threads').agg({'Speedup': 'max', 'Efficiency': 'max'})
+            row[0].plot(best.index, best['Speedup'], marker='o', linewidth=2, label=impl)
+            row[1].plot(best.index, best['Efficiency'], marker='o', linewidth=2, label=impl)
+        title = 'Strong Scaling (largest size)' if mode == 'strong' else 'Weak Scaling (M grows with threads)'
+        row[0].set_title(f'{title}: Speedup', fontsize=14)
+        row[1].set_title(f'{title}: Efficiency', fontsize=14)
+        for ax in row:
+            ax.set_xlabel('Threads', fontsize=12)
+            ax.grid(True, linestyle='--', alpha=0.7)
+            ax.legend(fontsize=9)
+    plt.tight_layout()
+    
+    scaling_plot_path = os.path.join(output_dir, 'gemm_scaling.png')
+    plt.savefig(scaling_plot_path, dpi=300)
+    print(f"Saved scaling plots to {scaling_plot_path}")
+
 def main():
     parser = argparse.ArgumentParser(description='Plot GEMM benchmark results')
     parser.add_argument('--csv_file', '-f', default='mnk_optimized_times.csv', 
                        help='Path to the CSV file with benchmark results (default: mnk_optimized_times.csv)')
     parser.add_argument('--output', '-o', default='plots', help='Directory to save the plots')
+    parser.add_argument('--stats_file', '-s', default='mnk_optimized_times_stats.csv',
+                       help='Stats CSV for the GFLOP/s plot (default: mnk_optimized_times_stats.csv, skipped if missing)')
+    parser.add_argument('--scaling_file', default='scaling_results.csv',
+                       help='OptGEMM --scaling CSV for the roofline and scaling plots (default: scaling_results.csv, skipped if missing)')
     
     args = parser.parse_args()
     
@@ -175,6 +344,12 @@ def main():
     
     try:
         plot_execution_times(args.csv_file, args.output)
+        if os.path.exists(args.stats_file):
+            plot_gflops(args.stats_file, args.output)
+            plot_counters(args.stats_file, args.output)
+        if os.path.exists(args.scaling_file):
+            plot_roofline(args.scaling_file, args.output)
+            plot_scaling(args.scaling_file, args.output)
         print(f"\nPlots have been saved to the '{args.output}' directory.")
     except Exception as e:
         print(f"Error: {e}")
@@ -1,379 +1,1967 @@
+/**
+ * OptGEMM: benchmarks, scaling, verification and autotuning on top of libgemm (gemm.h).
+ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <sys/time.h>
-#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "gemm.h"
+#include "bench_harness.h"
+#include "perf_counters.h"
+#define MEMPROF_ALLOCATOR   // malloc and free here keep the heap count for the memory profile
+#include "memprof.h"
+#include "sweep_spec.h"
+#include "bench_json.h"
 
-// Number of runs to average for each test case
-#define NUM_RUNS 3
+// Matrices per batch in the batched benchmark column (reported as time per matrix)
+#define BATCH_COUNT 32
 
-// Default number of threads and block size (can alter the block size and thead count by adding threads)
-#define DEFAULT_NUM_THREADS 4
-#define DEFAULT_BLOCK_SIZE 32
+// max |C - ref| / max |ref|, the normwise error used for the Strassen comparison
+static double max_relative_error(int m, int n, const double *C, const double *ref) {
+    double max_diff = 0.0, max_ref = 0.0;
+    for (size_t i = 0; i < (size_t)m * n; i++) {
+        double diff = fabs(C[i] - ref[i]);
+        double mag = fabs(ref[i]);
+        if (diff > max_diff) max_diff = diff;
+        if (mag > max_ref) max_ref = mag;
+    }
+    return (max_ref > 0.0) ? max_diff / max_ref : max_diff;
+}
 
-// Thread argument structure
 typedef struct {
-    int thread_id;
-    int num_threads;
-    int m, n, k;
-    int block_size;
-    double *A;
-    double *B;
-    double *C;
-} thread_args_t;
+    int n, cutoff;
+    double *A, *B, *C;
+} strassen_bench_t;
 
-double get_time() { // Used the same method for time measurement.
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec * 1e-6;
+static void run_strassen_bench(void *ctx) {
+    strassen_bench_t *b = (strassen_bench_t *)ctx;
+    strassen_gemm(b->n, b->A, b->B, b->C, b->cutoff);
+}
+
+static void run_strassen_baseline(void *ctx) {
+    strassen_bench_t *b = (strassen_bench_t *)ctx;
+    dgemm_general(GEMM_ROW_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, b->n, b->n, b->n, 1.0, b->A, b->n, b->B, b->n, 1.0, b->C, b->n);
+}
+
+static void reset_strassen_bench(void *ctx) {
+    strassen_bench_t *b = (strassen_bench_t *)ctx;
+    reset_matrix_c(b->C, b->n, b->n);
 }
 
 /**
- * Function to allocate and initialise matrices
+ * --strassen mode: times Strassen against the blocked kernel it bottoms out in, for square
+ * sizes doubling from 512 to max_size. FLOP-equivalent GFLOP/s counts 2n^3 for both, so the
+ * speedup column is directly comparable. Errors are measured against one run of mnk_gemm.
  */
-void init_matrices(int m, int n, int k, double **A, double **B, double **C) {
-    *A = (double *)malloc(m * k * sizeof(double)); // memory allocation for the matrices (A, B and C)
-    *B = (double *)malloc(k * n * sizeof(double));
-    *C = (double *)malloc(m * n * sizeof(double));
-    
-    if (*A == NULL || *B == NULL || *C == NULL) {
+static int run_strassen_benchmark(int num_threads, int max_size, int cutoff) {
+    bench_config_t bench_cfg = bench_config_from_env();
+    get_gemm_pool(num_threads);
+    set_gemm_threads(num_threads);
+    set_setup_threads(num_threads);
+
+    FILE *results_file = fopen("strassen_times.csv", "w");
+    if (results_file == NULL) {
+        fprintf(stderr, "Error opening results file\n");
+        return 1;
+    }
+    fprintf(results_file, "Matrix Size,Blocked MNK,Strassen,Speedup,Blocked GFLOPS,Strassen GFLOPS,"
+                          "Blocked Rel Error,Strassen Rel Error\n");
+    printf("Strassen-Winograd vs blocked MNK, %d threads, cutoff %d\n", num_threads, cutoff);
+
+    for (int size = 512; size <= max_size; size *= 2) {
+        int n = size;
+        double flops = 2.0 * n * n * n;
+        printf("Testing matrices of size %d x %d...\n", n, n);
+
+        double *A, *B, *C;
+        init_matrices(n, n, n, &A, &B, &C);
+        double *ref = (double *)calloc((size_t)n * n, sizeof(double));
+        if (ref == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        mnk_gemm(n, n, n, A, B, ref);
+
+        // Median times; the errors come from one fresh run each, since timed samples may repeat a call
+        strassen_bench_t bench = {n, cutoff, A, B, C};
+        bench_stats_t st = bench_run(&bench_cfg, reset_strassen_bench, run_strassen_baseline, &bench);
+        double blocked_time = st.median;
+        reset_strassen_bench(&bench);
+        run_strassen_baseline(&bench);
+        double blocked_err = max_relative_error(n, n, C, ref);
+
+        st = bench_run(&bench_cfg, reset_strassen_bench, run_strassen_bench, &bench);
+        double strassen_time = st.median;
+        reset_strassen_bench(&bench);
+        run_strassen_bench(&bench);
+        double strassen_err = max_relative_error(n, n, C, ref);
+
+        fprintf(results_file, "%d,%.6f,%.6f,%.3f,%.2f,%.2f,%.3e,%.3e\n", n, blocked_time, strassen_time,
+                blocked_time / strassen_time, flops / blocked_time * 1e-9, flops / strassen_time * 1e-9,
+                blocked_err, strassen_err);
+        printf("  Blocked MNK: %.6f s (%.2f GFLOP/s), rel error %.3e\n", blocked_time, flops / blocked_time * 1e-9, blocked_err);
+        printf("  Strassen:    %.6f s (%.2f GFLOP/s equivalent), rel error %.3e\n", strassen_time,
+               flops / strassen_time * 1e-9, strassen_err);
+        printf("  Speedup: %.3fx\n", blocked_time / strassen_time);
+
+        free(ref);
+        free_matrices(A, B, C);
+    }
+
+    fclose(results_file);
+    printf("\nStrassen results saved to strassen_times.csv\n");
+    return 0;
+}
+
+// Fixed keys so --ooc can reuse input files from an earlier run and check C against them
+#define OOC_KEY_A 0x6F6F635F415F3031ULL
+#define OOC_KEY_B 0x6F6F635F425F3031ULL
+#define OOC_FILL_ROWS 64
+#define OOC_CHECK_SAMPLES 64
+
+// Opens path if it already holds a rows x cols matrix, otherwise writes one from key a panel at a time
+static int open_ooc_input(matrix_file_t *f, const char *path, int rows, int cols, uint64_t key) {
+    if (matrix_file_open(f, path) == 0) {
+        if (f->rows == rows && f->cols == cols) {
+            printf("Reusing %s\n", path);
+            return 0;
+        }
+        matrix_file_close(f);
+    }
+    if (matrix_file_create(f, path, rows, cols) != 0) {
+        return -1;
+    }
+    printf("Writing %s (%.1f MB)...\n", path, (double)rows * cols * sizeof(double) / 1e6);
+    double *panel = (double *)malloc((size_t)OOC_FILL_ROWS * cols * sizeof(double));
+    if (panel == NULL) {
         printf("Memory allocation failed!\n");
         exit(1);
     }
-    
-    // Initialise A and B with random values between 0 and 1
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < k; j++) {
-            (*A)[i*k + j] = (double)rand() / RAND_MAX;
+    int status = 0;
+    for (int r0 = 0; r0 < rows && status == 0; r0 += OOC_FILL_ROWS) {
+        int nr = (r0 + OOC_FILL_ROWS < rows) ? OOC_FILL_ROWS : rows - r0;
+        fill_uniform(panel, (size_t)nr * cols, key, (size_t)r0 * cols);
+        status = matrix_file_write_tile(f, r0, 0, nr, cols, panel, cols);
+    }
+    free(panel);
+    if (status != 0) {
+        fprintf(stderr, "Error writing %s\n", path);
+        matrix_file_close(f);
+    }
+    return status;
+}
+
+/**
+ * --ooc mode: C = A * B with all three matrices in files under dir and only mem_mb of
+ * tile buffers in memory. A and B are generated on the first run (and reused while the
+ * shape stays the same), and C is checked at sampled entries against dot products
+ * recomputed from the generator, so the check doesn't need the inputs in memory either.
+ */
+static int run_ooc_benchmark(int m, int n, int k, int mem_mb, int num_threads, const char *dir) {
+    char path_a[1024], path_b[1024], path_c[1024];
+    snprintf(path_a, sizeof(path_a), "%s/ooc_A.bin", dir);
+    snprintf(path_b, sizeof(path_b), "%s/ooc_B.bin", dir);
+    snprintf(path_c, sizeof(path_c), "%s/ooc_C.bin", dir);
+
+    matrix_file_t A, B, C;
+    if (open_ooc_input(&A, path_a, m, k, OOC_KEY_A) != 0) {
+        return 1;
+    }
+    if (open_ooc_input(&B, path_b, k, n, OOC_KEY_B) != 0) {
+        matrix_file_close(&A);
+        return 1;
+    }
+    if (matrix_file_create(&C, path_c, m, n) != 0) {
+        matrix_file_close(&A);
+        matrix_file_close(&B);
+        return 1;
+    }
+    if (num_threads > 1) {
+        get_gemm_pool(num_threads);
+    }
+
+    printf("Out-of-core GEMM %d x %d x %d, %d MB of buffers, %d threads (inputs %.1f MB, C %.1f MB)\n",
+           m, n, k, mem_mb, num_threads, ((double)m * k + (double)k * n) * sizeof(double) / 1e6,
+           (double)m * n * sizeof(double) / 1e6);
+    ooc_stats_t st;
+    int status = ooc_gemm(&A, &B, &C, (size_t)mem_mb * 1024 * 1024, num_threads, &st);
+    matrix_file_close(&A);
+    matrix_file_close(&B);
+    if (status != 0) {
+        matrix_file_close(&C);
+        return 1;
+    }
+
+    // Sampled entries of C against a fresh dot product of the generated row and column
+    double *row = (double *)malloc((size_t)k * sizeof(double));
+    if (row == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    double max_err = 0.0;
+    for (int s = 0; s < OOC_CHECK_SAMPLES && status == 0; s++) {
+        int i = (s == 0) ? 0 : (s == 1) ? m - 1 : (int)(((uint64_t)s * 2654435761u) % (uint64_t)m);
+        int j = (s == 0) ? 0 : (s == 1) ? n - 1 : (int)(((uint64_t)s * 40503u + 17) % (uint64_t)n);
+        double ref = 0.0, got, b;
+        fill_uniform(row, (size_t)k, OOC_KEY_A, (size_t)i * k);
+        for (int p = 0; p < k; p++) {
+            fill_uniform(&b, 1, OOC_KEY_B, (size_t)p * n + j);
+            ref += row[p] * b;
         }
+        status = matrix_file_read_tile(&C, i, j, 1, 1, &got, 1);
+        double err = fabs(got - ref) / (fabs(ref) > 0.0 ? fabs(ref) : 1.0);
+        if (err > max_err) max_err = err;
     }
-    
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < n; j++) {
-            (*B)[i*n + j] = (double)rand() / RAND_MAX;
+    free(row);
+    matrix_file_close(&C);
+    int failed = (status != 0 || max_err > 1e-12 * (k > 1 ? k : 1));
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double peak_mb = usage.ru_maxrss / 1024.0;
+    double gflops = 2.0 * m * n * k / st.seconds * 1e-9;
+    double wait_pct = (st.seconds > 0.0) ? 100.0 * st.io_wait / st.seconds : 0.0;
+    printf("  Tiles %d x %d x %d\n", st.tile_m, st.tile_n, st.tile_k);
+    printf("  %.6f s, %.2f GFLOP/s, waiting on I/O %.1f%% of the time\n", st.seconds, gflops, wait_pct);
+    printf("  Read %.1f MB, wrote %.1f MB, peak RSS %.1f MB\n", st.bytes_read / 1e6, st.bytes_written / 1e6, peak_mb);
+    printf("  Max relative error over %d sampled entries: %.3e%s\n", OOC_CHECK_SAMPLES, max_err,
+           failed ? "  FAILED" : "");
+
+    FILE *results_file = fopen("ooc_results.csv", "a");
+    if (results_file == NULL) {
+        fprintf(stderr, "Error opening results file\n");
+        return 1;
+    }
+    if (ftell(results_file) == 0) {
+        fprintf(results_file, "M,N,K,Memory MB,Threads,Tile M,Tile N,Tile K,Time,GFLOPS,IO Wait %%,"
+                              "MB Read,MB Written,Peak RSS MB,Max Rel Error\n");
+    }
+    fprintf(results_file, "%d,%d,%d,%d,%d,%d,%d,%d,%.6f,%.2f,%.1f,%.1f,%.1f,%.1f,%.3e\n", m, n, k, mem_mb,
+            num_threads, st.tile_m, st.tile_n, st.tile_k, st.seconds, gflops, wait_pct, st.bytes_read / 1e6,
+            st.bytes_written / 1e6, peak_mb, max_err);
+    fclose(results_file);
+    printf("\nOut-of-core results appended to ooc_results.csv\n");
+    return failed ? 1 : 0;
+}
+
+// Densities swept by --sparse, in percent of nonzeros in A
+#define SPARSE_MAX_DENSITIES 32
+#define SPARSE_MASK_KEY 0x7370617273653031ULL
+
+typedef struct {
+    int n, num_threads, block_size;
+    const csr_matrix_t *csr;
+    double *A, *B, *C;
+} sparse_bench_t;
+
+static void reset_sparse_bench(void *ctx) {
+    sparse_bench_t *b = (sparse_bench_t *)ctx;
+    reset_matrix_c(b->C, b->n, b->n);
+}
+
+static void run_sparse_dense(void *ctx) {
+    sparse_bench_t *b = (sparse_bench_t *)ctx;
+    blocked_mnk_gemm(b->n, b->n, b->n, b->A, b->B, b->C, b->block_size);
+}
+
+static void run_sparse_mt_dense(void *ctx) {
+    sparse_bench_t *b = (sparse_bench_t *)ctx;
+    mt_blocked_mnk_gemm(b->n, b->n, b->n, b->A, b->B, b->C, b->num_threads, b->block_size);
+}
+
+static void run_sparse_csr(void *ctx) {
+    sparse_bench_t *b = (sparse_bench_t *)ctx;
+    csr_gemm(b->csr, b->n, b->B, b->C);
+}
+
+static void run_sparse_mt_csr(void *ctx) {
+    sparse_bench_t *b = (sparse_bench_t *)ctx;
+    mt_csr_gemm(b->csr, b->n, b->B, b->C, b->num_threads);
+}
+
+// Comma-separated percentages, e.g. "1,5,10"; returns how many were read, 0 on a bad entry
+static int parse_densities(const char *list, double *out, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p != '\0' && count < max) {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p || v <= 0.0 || v > 100.0 || (*end != ',' && *end != '\0')) {
+            return 0;
         }
+        out[count++] = v;
+        p = (*end == ',') ? end + 1 : end;
     }
-    
-    // Initialise C with zeros
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            (*C)[i*n + j] = 0.0;
+    return count;
+}
+
+/**
+ * --sparse mode: CSR x dense against the dense blocked kernels, square n x n x n, with A
+ * thinned to each density. The dense kernels do the same work whatever the values are, so
+ * they're timed once per size; the CSR kernels and the conversion are timed per density.
+ * The last column says where CSR stops winning.
+ */
+static int run_sparse_benchmark(int num_threads, const int *sizes, int num_sizes, const double *densities,
+                                int num_densities) {
+    bench_config_t bench_cfg = bench_config_from_env();
+    get_gemm_pool(num_threads);
+    set_setup_threads(num_threads);
+
+    FILE *results_file = fopen("sparse_times.csv", "w");
+    if (results_file == NULL) {
+        fprintf(stderr, "Error opening results file\n");
+        return 1;
+    }
+    fprintf(results_file, "Matrix Size,Density %%,NNZ,Convert Time,Dense Blocked,CSR,MT Dense Blocked,MT CSR,"
+                          "CSR Speedup,MT CSR Speedup\n");
+    printf("CSR x dense vs dense blocked MNK, %d threads\n", num_threads);
+
+    for (int s = 0; s < num_sizes; s++) {
+        int n = sizes[s];
+        printf("Testing matrices of size %d x %d...\n", n, n);
+        double *A, *B, *C;
+        init_matrices(n, n, n, &A, &B, &C);
+        double *mask = (double *)malloc((size_t)n * n * sizeof(double));
+        double *sparse_A = (double *)malloc((size_t)n * n * sizeof(double));
+        if (mask == NULL || sparse_A == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        fill_uniform(mask, (size_t)n * n, SPARSE_MASK_KEY, 0);
+
+        sparse_bench_t bench = {n, num_threads, DEFAULT_BLOCK_SIZE, NULL, A, B, C};
+        double dense = bench_run(&bench_cfg, reset_sparse_bench, run_sparse_dense, &bench).median;
+        double mt_dense = bench_run(&bench_cfg, reset_sparse_bench, run_sparse_mt_dense, &bench).median;
+        printf("  Dense blocked %.6f s, MT dense blocked %.6f s\n", dense, mt_dense);
+
+        double crossover = 0.0;
+        for (int d = 0; d < num_densities; d++) {
+            double density = densities[d] / 100.0;
+            for (size_t i = 0; i < (size_t)n * n; i++) {
+                sparse_A[i] = (mask[i] < density) ? A[i] : 0.0;
+            }
+            csr_matrix_t csr;
+            double t0 = get_time();
+            if (dense_to_csr(n, n, sparse_A, &csr) != 0) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            double convert = get_time() - t0;
+
+            bench.csr = &csr;
+            double sp = bench_run(&bench_cfg, reset_sparse_bench, run_sparse_csr, &bench).median;
+            double mt_sp = bench_run(&bench_cfg, reset_sparse_bench, run_sparse_mt_csr, &bench).median;
+            if (sp < dense && densities[d] > crossover) crossover = densities[d];
+
+            fprintf(results_file, "%d,%.2f,%ld,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%.3f\n", n, densities[d], csr.nnz, convert,
+                    dense, sp, mt_dense, mt_sp, dense / sp, mt_dense / mt_sp);
+            printf("  %6.2f%% (%ld nonzeros): CSR %.6f s (%.2fx dense), MT CSR %.6f s (%.2fx MT dense), "
+                   "convert %.6f s\n", densities[d], csr.nnz, sp, dense / sp, mt_sp, mt_dense / mt_sp, convert);
+            free_csr(&csr);
+        }
+        if (crossover > 0.0) {
+            printf("  CSR beats dense blocked up to %.2f%% nonzeros\n", crossover);
+        } else {
+            printf("  CSR never beats dense blocked at these densities\n");
         }
+
+        free(mask);
+        free(sparse_A);
+        free_matrices(A, B, C);
+    }
+
+    fclose(results_file);
+    printf("\nSparse results saved to sparse_times.csv\n");
+    return 0;
+}
+
+#define ASYNC_A_KEY 0x6173796e63303141ULL
+#define ASYNC_B_KEY 0x6173796e63303142ULL
+
+typedef struct {
+    int n, count, num_threads;
+    double **A, **C;   // count of each; the chain reads C[i - 1] as its A
+    double *B;
+} async_bench_t;
+
+static void reset_async_bench(void *ctx) {
+    async_bench_t *b = (async_bench_t *)ctx;
+    for (int i = 0; i < b->count; i++) {
+        reset_matrix_c(b->C[i], b->n, b->n);
     }
 }
 
-void reset_matrix_c(double *C, int m, int n) {
-    for (int i = 0; i < m * n; i++) {
-        C[i] = 0.0;
+static void run_async_sequential(void *ctx) {
+    async_bench_t *b = (async_bench_t *)ctx;
+    for (int i = 0; i < b->count; i++) {
+        mt_blocked_mnk_gemm(b->n, b->n, b->n, b->A[i], b->B, b->C[i], b->num_threads, DEFAULT_BLOCK_SIZE);
     }
 }
 
-void free_matrices(double *A, double *B, double *C) {
-    free(A);
-    free(B);
-    free(C);
+static void run_async_submit(void *ctx) {
+    async_bench_t *b = (async_bench_t *)ctx;
+    gemm_future_t *futures[b->count];
+    for (int i = 0; i < b->count; i++) {
+        futures[i] = gemm_submit(b->n, b->n, b->n, b->A[i], b->B, b->C[i], NULL, 0);
+    }
+    for (int i = 0; i < b->count; i++) {
+        gemm_future_free(futures[i]);
+    }
+}
+
+static void run_async_chain_sequential(void *ctx) {
+    async_bench_t *b = (async_bench_t *)ctx;
+    for (int i = 0; i < b->count; i++) {
+        double *a = (i == 0) ? b->A[0] : b->C[i - 1];
+        mt_blocked_mnk_gemm(b->n, b->n, b->n, a, b->B, b->C[i], b->num_threads, DEFAULT_BLOCK_SIZE);
+    }
+}
+
+static void run_async_chain(void *ctx) {
+    async_bench_t *b = (async_bench_t *)ctx;
+    gemm_future_t *futures[b->count];
+    for (int i = 0; i < b->count; i++) {
+        const double *a = (i == 0) ? b->A[0] : b->C[i - 1];
+        futures[i] = gemm_submit(b->n, b->n, b->n, a, b->B, b->C[i], (i == 0) ? NULL : &futures[i - 1], i > 0);
+    }
+    for (int i = 0; i < b->count; i++) {
+        gemm_future_free(futures[i]);
+    }
+}
+
+// Largest relative difference between each C and the copy saved from the sequential run
+static double async_max_diff(const async_bench_t *b, double *const *expect) {
+    double worst = 0.0;
+    for (int i = 0; i < b->count; i++) {
+        for (size_t r = 0; r < (size_t)b->n * b->n; r++) {
+            double scale = fabs(expect[i][r]) > 1.0 ? fabs(expect[i][r]) : 1.0;
+            double diff = fabs(b->C[i][r] - expect[i][r]) / scale;
+            if (!(diff <= worst)) worst = diff;   // NaN counts as the worst
+        }
+    }
+    return worst;
 }
 
 /**
- * 1. Original MNK implementation (row-by-row)
- * Only using MNK for this, don't want the graph to look weird and jumbled together.
+ * --async mode: count n x n GEMMs, one MT blocked call after another against submitting
+ * them all and waiting, then a chain where each product's C is the next one's A, run
+ * sequentially and as dependent submits. B is scaled by 1/n so the chain stays near 1.
  */
-void mnk_gemm(int m, int n, int k, double *A, double *B, double *C) {
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            for (int p = 0; p < k; p++) {
-                C[i*n + j] += A[i*k + p] * B[p*n + j];
-            }
+static int run_async_benchmark(int num_threads, int count, int n) {
+    bench_config_t bench_cfg = bench_config_from_env();
+    get_gemm_pool(num_threads);
+    set_setup_threads(num_threads);
+    set_async_threads(num_threads);
+
+    size_t elems = (size_t)n * n;
+    async_bench_t bench = {n, count, num_threads, (double **)malloc(count * sizeof(double *)),
+                           (double **)malloc(count * sizeof(double *)), (double *)malloc(elems * sizeof(double))};
+    double **expect = (double **)malloc(count * sizeof(double *));
+    if (bench.A == NULL || bench.C == NULL || bench.B == NULL || expect == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    fill_uniform(bench.B, elems, ASYNC_B_KEY, 0);
+    for (size_t r = 0; r < elems; r++) bench.B[r] /= n;
+    for (int i = 0; i < count; i++) {
+        bench.A[i] = (double *)malloc(elems * sizeof(double));
+        bench.C[i] = (double *)malloc(elems * sizeof(double));
+        expect[i] = (double *)malloc(elems * sizeof(double));
+        if (bench.A[i] == NULL || bench.C[i] == NULL || expect[i] == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
         }
+        fill_uniform(bench.A[i], elems, ASYNC_A_KEY, (size_t)i * elems);
+    }
+
+    printf("%d GEMMs of %d x %d x %d, %d threads\n", count, n, n, n, num_threads);
+    double gflop = 2.0 * n * n * (double)n * count / 1e9;
+
+    double seq = bench_run(&bench_cfg, reset_async_bench, run_async_sequential, &bench).median;
+    for (int i = 0; i < count; i++) memcpy(expect[i], bench.C[i], elems * sizeof(double));
+    double async_t = bench_run(&bench_cfg, reset_async_bench, run_async_submit, &bench).median;
+    double diff = async_max_diff(&bench, expect);
+
+    double chain_seq = bench_run(&bench_cfg, reset_async_bench, run_async_chain_sequential, &bench).median;
+    for (int i = 0; i < count; i++) memcpy(expect[i], bench.C[i], elems * sizeof(double));
+    double chain = bench_run(&bench_cfg, reset_async_bench, run_async_chain, &bench).median;
+    double chain_diff = async_max_diff(&bench, expect);
+
+    printf("  Independent: sequential MT %.6f s (%.2f GFLOPS), async %.6f s (%.2f GFLOPS), %.2fx\n", seq,
+           gflop / seq, async_t, gflop / async_t, seq / async_t);
+    printf("  Chain:       sequential MT %.6f s (%.2f GFLOPS), async %.6f s (%.2f GFLOPS), %.2fx\n", chain_seq,
+           gflop / chain_seq, chain, gflop / chain, chain_seq / chain);
+    int failed = !(diff < 1e-10) || !(chain_diff < 1e-10);
+    printf("  Max relative difference from sequential: %.3e independent, %.3e chain%s\n", diff, chain_diff,
+           failed ? " (FAIL)" : "");
+
+    FILE *results_file = fopen("async_results.csv", "a");
+    if (results_file == NULL) {
+        fprintf(stderr, "Error opening results file\n");
+        return 1;
+    }
+    if (ftell(results_file) == 0) {
+        fprintf(results_file, "Matrix Size,Count,Threads,Sequential,Async,Speedup,Chain Sequential,Chain Async,"
+                              "Chain Speedup,Max Rel Diff\n");
+    }
+    fprintf(results_file, "%d,%d,%d,%.6f,%.6f,%.3f,%.6f,%.6f,%.3f,%.3e\n", n, count, num_threads, seq, async_t,
+            seq / async_t, chain_seq, chain, chain_seq / chain, (diff > chain_diff) ? diff : chain_diff);
+    fclose(results_file);
+    printf("\nAsync results appended to async_results.csv\n");
+
+    for (int i = 0; i < count; i++) {
+        free(bench.A[i]);
+        free(bench.C[i]);
+        free(expect[i]);
+    }
+    free(bench.A);
+    free(bench.C);
+    free(bench.B);
+    free(expect);
+    return failed ? 1 : 0;
+}
+/**
+ * Benchmark wrappers so the reduced-precision variants can share one timing loop.
+ * The inputs are converted from the double matrices once per size, outside the timed region.
+ */
+typedef struct {
+    int m, n, k;
+    float *A_f32, *B_f32;
+    bf16_t *A_bf16, *B_bf16;
+#ifdef HAVE_FLOAT16
+    f16_t *A_f16, *B_f16;
+#endif
+    float *C;
+} typed_inputs_t;
+
+typedef void (*typed_bench_fn)(const typed_inputs_t *in, int num_threads, int block_size);
+
+static void bench_blocked_f32(const typed_inputs_t *in, int num_threads, int block_size) {
+    (void)num_threads;
+    blocked_mnk_gemm_f32(in->m, in->n, in->k, in->A_f32, in->B_f32, in->C, block_size);
+}
+
+static void bench_mt_blocked_f32(const typed_inputs_t *in, int num_threads, int block_size) {
+    mt_blocked_mnk_gemm_f32(in->m, in->n, in->k, in->A_f32, in->B_f32, in->C, num_threads, block_size);
+}
+
+static void bench_blocked_bf16(const typed_inputs_t *in, int num_threads, int block_size) {
+    (void)num_threads;
+    blocked_mnk_gemm_bf16(in->m, in->n, in->k, in->A_bf16, in->B_bf16, in->C, block_size);
+}
+
+static void bench_mt_blocked_bf16(const typed_inputs_t *in, int num_threads, int block_size) {
+    mt_blocked_mnk_gemm_bf16(in->m, in->n, in->k, in->A_bf16, in->B_bf16, in->C, num_threads, block_size);
+}
+
+#ifdef HAVE_FLOAT16
+static void bench_blocked_f16(const typed_inputs_t *in, int num_threads, int block_size) {
+    (void)num_threads;
+    blocked_mnk_gemm_f16(in->m, in->n, in->k, in->A_f16, in->B_f16, in->C, block_size);
+}
+
+static void bench_mt_blocked_f16(const typed_inputs_t *in, int num_threads, int block_size) {
+    mt_blocked_mnk_gemm_f16(in->m, in->n, in->k, in->A_f16, in->B_f16, in->C, num_threads, block_size);
+}
+#endif
+
+static void init_typed_inputs(typed_inputs_t *in, int m, int n, int k, const double *A, const double *B) {
+    in->m = m;
+    in->n = n;
+    in->k = k;
+    in->A_f32 = (float *)malloc((size_t)m * k * sizeof(float));
+    in->B_f32 = (float *)malloc((size_t)k * n * sizeof(float));
+    in->A_bf16 = (bf16_t *)malloc((size_t)m * k * sizeof(bf16_t));
+    in->B_bf16 = (bf16_t *)malloc((size_t)k * n * sizeof(bf16_t));
+    in->C = (float *)malloc((size_t)m * n * sizeof(float));
+    if (in->A_f32 == NULL || in->B_f32 == NULL || in->A_bf16 == NULL || in->B_bf16 == NULL || in->C == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
+#ifdef HAVE_FLOAT16
+    in->A_f16 = (f16_t *)malloc((size_t)m * k * sizeof(f16_t));
+    in->B_f16 = (f16_t *)malloc((size_t)k * n * sizeof(f16_t));
+    if (in->A_f16 == NULL || in->B_f16 == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+#endif
+
+    for (size_t i = 0; i < (size_t)m * k; i++) {
+        in->A_f32[i] = (float)A[i];
+        in->A_bf16[i] = float_to_bf16(in->A_f32[i]);
+#ifdef HAVE_FLOAT16
+        in->A_f16[i] = (f16_t)in->A_f32[i];
+#endif
+    }
+    for (size_t i = 0; i < (size_t)k * n; i++) {
+        in->B_f32[i] = (float)B[i];
+        in->B_bf16[i] = float_to_bf16(in->B_f32[i]);
+#ifdef HAVE_FLOAT16
+        in->B_f16[i] = (f16_t)in->B_f32[i];
+#endif
+    }
+}
+
+static void free_typed_inputs(typed_inputs_t *in) {
+    free(in->A_f32);
+    free(in->B_f32);
+    free(in->A_bf16);
+    free(in->B_bf16);
+#ifdef HAVE_FLOAT16
+    free(in->A_f16);
+    free(in->B_f16);
+#endif
+    free(in->C);
 }
 
 /**
- * 2. Blocked/Tiled MNK implementation
- * Need to integrate this into my report later.
+ * Benchmark variants for the main run: each one is a body the harness times plus the
+ * reset it runs before every sample. batch > 1 means one call does batch matrices and the
+ * reported times are per matrix.
  */
-void blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int block_size) {
-    // Iterate over 'blocks'
-    for (int i0 = 0; i0 < m; i0 += block_size) {
-        int i_bound = (i0 + block_size < m) ? i0 + block_size : m;
-        
-        for (int j0 = 0; j0 < n; j0 += block_size) {
-            int j_bound = (j0 + block_size < n) ? j0 + block_size : n;
-            
-            for (int p0 = 0; p0 < k; p0 += block_size) {
-                int p_bound = (p0 + block_size < k) ? p0 + block_size : k;
-                
-                // Compute within the block
-                for (int i = i0; i < i_bound; i++) {
-                    for (int j = j0; j < j_bound; j++) {
-                        for (int p = p0; p < p_bound; p++) {
-                            C[i*n + j] += A[i*k + p] * B[p*n + j];
-                        }
-                    }
-                }
+typedef struct {
+    int m, n, k;
+    double *A, *B, *C;
+    int num_threads;
+    int block_size;
+    double **batch_A, **batch_B, **batch_C;   // Batched MNK only
+    typed_inputs_t *typed;                    // reduced-precision variants only
+    typed_bench_fn typed_fn;
+} gemm_bench_t;
+
+typedef struct {
+    const char *name;
+    bench_fn run;
+    bench_fn reset;
+    int batch;
+    typed_bench_fn typed_fn;
+    int in_bytes;             // bytes per A/B element (C is float for the typed variants, double otherwise)
+} bench_variant_t;
+
+static void reset_bench_c(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    reset_matrix_c(b->C, b->m, b->n);
+}
+
+static void reset_bench_batch(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    for (int i = 0; i < BATCH_COUNT; i++) {
+        reset_matrix_c(b->batch_C[i], b->m, b->n);
+    }
+}
+
+static void reset_bench_typed(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    memset(b->typed->C, 0, (size_t)b->m * b->n * sizeof(float));
+}
+
+static void bench_mnk(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C);
+}
+
+static void bench_fixed(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    fixed_mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C);
+}
+
+static void bench_blocked(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    blocked_mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C, b->block_size);
+}
+
+static void bench_mt(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    mt_mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C, b->num_threads);
+}
+
+static void bench_mt_blocked(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    mt_blocked_mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C, b->num_threads, b->block_size);
+}
+
+static void bench_scalar_blocked(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    scalar_blocked_mnk_gemm(b->m, b->n, b->k, b->A, b->B, b->C, b->block_size);
+}
+
+static void bench_batched(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    batched_gemm(BATCH_COUNT, b->m, b->n, b->k, b->batch_A, b->batch_B, b->batch_C, b->num_threads);
+}
+
+static void bench_typed(void *ctx) {
+    gemm_bench_t *b = (gemm_bench_t *)ctx;
+    b->typed_fn(b->typed, b->num_threads, b->block_size);
+}
+
+// Implementation variants, in CSV column order; the reduced-precision ones (fp32
+// accumulation) come after the double ones
+static const bench_variant_t bench_variants[] = {
+    {"Original MNK", bench_mnk, reset_bench_c, 1, NULL, 8},
+    // Unrolled kernels for the FIXED_GEMM_SIZES shapes, Original MNK for the rest
+    {"Fixed MNK", bench_fixed, reset_bench_c, 1, NULL, 8},
+    {"Blocked MNK", bench_blocked, reset_bench_c, 1, NULL, 8},
+    {"Multithreaded MNK", bench_mt, reset_bench_c, 1, NULL, 8},
+    {"MT+Blocked MNK", bench_mt_blocked, reset_bench_c, 1, NULL, 8},
+    // Shows what the micro-kernel gains over the plain tile loop
+    {"Scalar Blocked MNK", bench_scalar_blocked, reset_bench_c, 1, NULL, 8},
+    // BATCH_COUNT products sharing A and B but with their own C
+    {"Batched MNK", bench_batched, reset_bench_batch, BATCH_COUNT, NULL, 8},
+    {"Blocked MNK f32", bench_typed, reset_bench_typed, 1, bench_blocked_f32, 4},
+    {"MT+Blocked MNK f32", bench_typed, reset_bench_typed, 1, bench_mt_blocked_f32, 4},
+    {"Blocked MNK bf16", bench_typed, reset_bench_typed, 1, bench_blocked_bf16, 2},
+    {"MT+Blocked MNK bf16", bench_typed, reset_bench_typed, 1, bench_mt_blocked_bf16, 2},
+#ifdef HAVE_FLOAT16
+    {"Blocked MNK f16", bench_typed, reset_bench_typed, 1, bench_blocked_f16, 2},
+    {"MT+Blocked MNK f16", bench_typed, reset_bench_typed, 1, bench_mt_blocked_f16, 2},
+#endif
+};
+#define NUM_BENCH_VARIANTS ((int)(sizeof(bench_variants) / sizeof(bench_variants[0])))
+
+/**
+ * Everything the variants read for one shape. The batch buffers and the reduced-precision
+ * copies are only made when a selected variant needs them.
+ */
+typedef struct {
+    int m, n, k;
+    double *A, *B, *C;
+    double *batch_A[BATCH_COUNT], *batch_B[BATCH_COUNT], *batch_C[BATCH_COUNT];
+    typed_inputs_t typed;
+    int has_batch, has_typed;
+} bench_inputs_t;
+
+static void init_bench_inputs(bench_inputs_t *in, int m, int n, int k, int need_batch, int need_typed) {
+    in->m = m;
+    in->n = n;
+    in->k = k;
+    in->has_batch = need_batch;
+    in->has_typed = need_typed;
+    init_matrices(m, n, k, &in->A, &in->B, &in->C);
+
+    for (int b = 0; b < BATCH_COUNT; b++) {
+        in->batch_A[b] = in->A;
+        in->batch_B[b] = in->B;
+        in->batch_C[b] = NULL;
+        if (need_batch) {
+            in->batch_C[b] = (double *)malloc((size_t)m * n * sizeof(double));
+            if (in->batch_C[b] == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
             }
         }
     }
+    if (need_typed) {
+        init_typed_inputs(&in->typed, m, n, k, in->A, in->B);
+    }
+}
+
+static void free_bench_inputs(bench_inputs_t *in) {
+    if (in->has_typed) {
+        free_typed_inputs(&in->typed);
+    }
+    for (int b = 0; b < BATCH_COUNT; b++) {
+        free(in->batch_C[b]);
+    }
+    free_matrices(in->A, in->B, in->C);
+}
+
+static gemm_bench_t bench_for_inputs(bench_inputs_t *in, int num_threads, int block_size) {
+    gemm_bench_t bench = {in->m, in->n, in->k, in->A, in->B, in->C, num_threads, block_size,
+                          in->batch_A, in->batch_B, in->batch_C, &in->typed, NULL};
+    return bench;
 }
 
 /**
- * Thread function for multithreaded MNK implementation
- * (check later, maybe not the best opion)
+ * Machine limits for the roofline: peak FMA throughput and STREAM triad bandwidth, both
+ * measured on the pool so they use the same threads (and pinning) as the GEMMs.
+ * The peak loop runs PEAK_FMA_CHAINS independent FMA chains per thread, enough to cover
+ * the FMA latency on two ports, in the widest vectors the micro-kernel uses.
  */
-void* mt_mnk_thread(void *arg) {
-    thread_args_t *args = (thread_args_t *)arg;
-    int thread_id = args->thread_id;
-    int num_threads = args->num_threads;
-    int m = args->m;
-    int n = args->n;
-    int k = args->k;
-    double *A = args->A;
-    double *B = args->B;
-    double *C = args->C;
-    
-    // Each thread processes a subset of rows
-    int rows_per_thread = (m + num_threads - 1) / num_threads;
-    int start_row = thread_id * rows_per_thread;
-    int end_row = (start_row + rows_per_thread < m) ? start_row + rows_per_thread : m;
-    
-    // Perform MNK matrix multiplication on assigned rows
-    for (int i = start_row; i < end_row; i++) {
-        for (int j = 0; j < n; j++) {
-            for (int p = 0; p < k; p++) {
-                C[i*n + j] += A[i*k + p] * B[p*n + j];
-            }
+#define PEAK_FMA_CHAINS 12
+#define PEAK_FMA_ITERS (1L << 22)
+#define PEAK_RUNS 3
+#define STREAM_MIN_BYTES (32L * 1024 * 1024)
+#define STREAM_MAX_BYTES (512L * 1024 * 1024)
+#define STREAM_RUNS 5
+#define TRIAD_ALIGNMENT (2UL * 1024 * 1024)   // huge-page aligned, so THP can back the arrays
+
+typedef struct {
+    long iters;
+    int single;        // float lanes instead of double
+    double flops;      // out: FLOPs this thread did
+    double sink;       // out: keeps the chains from being optimised away
+} peak_args_t;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static double peak_fma_avx512(long iters, int single, double *flops) {
+    double sum = 0.0;
+    if (single) {
+        __m512 acc[PEAK_FMA_CHAINS], mul = _mm512_set1_ps(0.999999f), add = _mm512_set1_ps(1e-7f);
+        #pragma GCC unroll 12
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm512_set1_ps((float)j);
+        for (long i = 0; i < iters; i++) {
+            #pragma GCC unroll 12
+            for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm512_fmadd_ps(acc[j], mul, add);
+        }
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) sum += _mm512_reduce_add_ps(acc[j]);
+        *flops = 2.0 * 16 * PEAK_FMA_CHAINS * iters;
+    } else {
+        __m512d acc[PEAK_FMA_CHAINS], mul = _mm512_set1_pd(0.999999), add = _mm512_set1_pd(1e-7);
+        #pragma GCC unroll 12
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm512_set1_pd((double)j);
+        for (long i = 0; i < iters; i++) {
+            #pragma GCC unroll 12
+            for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm512_fmadd_pd(acc[j], mul, add);
         }
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) sum += _mm512_reduce_add_pd(acc[j]);
+        *flops = 2.0 * 8 * PEAK_FMA_CHAINS * iters;
     }
-    
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double peak_fma_avx2(long iters, int single, double *flops) {
+    double sum = 0.0;
+    if (single) {
+        __m256 acc[PEAK_FMA_CHAINS], mul = _mm256_set1_ps(0.999999f), add = _mm256_set1_ps(1e-7f);
+        #pragma GCC unroll 12
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm256_set1_ps((float)j);
+        for (long i = 0; i < iters; i++) {
+            #pragma GCC unroll 12
+            for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm256_fmadd_ps(acc[j], mul, add);
+        }
+        float lanes[8];
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) {
+            _mm256_storeu_ps(lanes, acc[j]);
+            for (int l = 0; l < 8; l++) sum += lanes[l];
+        }
+        *flops = 2.0 * 8 * PEAK_FMA_CHAINS * iters;
+    } else {
+        __m256d acc[PEAK_FMA_CHAINS], mul = _mm256_set1_pd(0.999999), add = _mm256_set1_pd(1e-7);
+        #pragma GCC unroll 12
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm256_set1_pd((double)j);
+        for (long i = 0; i < iters; i++) {
+            #pragma GCC unroll 12
+            for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = _mm256_fmadd_pd(acc[j], mul, add);
+        }
+        double lanes[4];
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) {
+            _mm256_storeu_pd(lanes, acc[j]);
+            for (int l = 0; l < 4; l++) sum += lanes[l];
+        }
+        *flops = 2.0 * 4 * PEAK_FMA_CHAINS * iters;
+    }
+    return sum;
+}
+#endif
+
+// Scalar chains, for CPUs the micro-kernel has no SIMD path on
+static double peak_fma_scalar(long iters, int single, double *flops) {
+    double acc[PEAK_FMA_CHAINS], sum = 0.0;
+    for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = (double)j;
+    for (long i = 0; i < iters; i++) {
+        for (int j = 0; j < PEAK_FMA_CHAINS; j++) acc[j] = acc[j] * 0.999999 + 1e-7;
+    }
+    for (int j = 0; j < PEAK_FMA_CHAINS; j++) sum += acc[j];
+    (void)single;
+    *flops = 2.0 * PEAK_FMA_CHAINS * iters;
+    return sum;
+}
+
+static void* peak_fma_thread(void *arg) {
+    peak_args_t *args = (peak_args_t *)arg;
+    const ukernel_t *uk = get_ukernel();
+#if defined(__x86_64__) || defined(__i386__)
+    if (uk != NULL && uk->nr == 16) {
+        args->sink = peak_fma_avx512(args->iters, args->single, &args->flops);
+        return NULL;
+    }
+    if (uk != NULL) {
+        args->sink = peak_fma_avx2(args->iters, args->single, &args->flops);
+        return NULL;
+    }
+#endif
+    (void)uk;
+    args->sink = peak_fma_scalar(args->iters, args->single, &args->flops);
     return NULL;
 }
 
 /**
- * 3. Multithreaded MNK implementation
+ * Peak GFLOP/s on num_threads pool workers (best of PEAK_RUNS), double or single precision.
  */
-void mt_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads) {
-    pthread_t threads[num_threads];
-    thread_args_t args[num_threads];
-    
-    // Create threads
-    for (int t = 0; t < num_threads; t++) {
-        args[t].thread_id = t;
-        args[t].num_threads = num_threads;
-        args[t].m = m;
-        args[t].n = n;
-        args[t].k = k;
-        args[t].A = A;
-        args[t].B = B;
-        args[t].C = C;
-        
-        pthread_create(&threads[t], NULL, mt_mnk_thread, &args[t]);
+static double measure_peak_gflops(int num_threads, int single) {
+    peak_args_t *args = (peak_args_t *)calloc(num_threads, sizeof(peak_args_t));
+    if (args == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
     }
-    
-    // Join threads
+    thread_pool_t *pool = get_gemm_pool(num_threads);
+    double best = 0.0;
+    for (int r = 0; r < PEAK_RUNS; r++) {
+        for (int t = 0; t < num_threads; t++) {
+            args[t].iters = PEAK_FMA_ITERS;
+            args[t].single = single;
+        }
+        double start = get_time();
+        pool_run(pool, num_threads, peak_fma_thread, args, sizeof(peak_args_t));
+        double elapsed = get_time() - start;
+        double flops = 0.0;
+        for (int t = 0; t < num_threads; t++) {
+            flops += args[t].flops;
+        }
+        if (elapsed > 0.0 && flops / elapsed * 1e-9 > best) {
+            best = flops / elapsed * 1e-9;
+        }
+    }
+    free(args);
+    return best;
+}
+
+typedef struct {
+    double *a, *b, *c;
+    size_t start, end;
+    int init;          // first-touch pass instead of the triad
+} triad_args_t;
+
+static void* triad_thread(void *arg) {
+    triad_args_t *args = (triad_args_t *)arg;
+    double *restrict a = args->a;
+    const double *restrict b = args->b, *restrict c = args->c;
+    if (args->init) {
+        for (size_t i = args->start; i < args->end; i++) {
+            args->a[i] = 0.0;
+            args->b[i] = 1.0;
+            args->c[i] = 2.0;
+        }
+        return NULL;
+    }
+    for (size_t i = args->start; i < args->end; i++) {
+        a[i] = b[i] + 3.0 * c[i];
+    }
+    return NULL;
+}
+
+/**
+ * STREAM triad bandwidth in GB/s on num_threads workers (best of STREAM_RUNS). Each array is
+ * 4x the L3 (between STREAM_MIN_BYTES and STREAM_MAX_BYTES) so it comes from memory; bytes
+ * are counted the STREAM way, 24 per element, without the write-allocate read of a.
+ */
+static double measure_triad_bandwidth(int num_threads) {
+    cache_sizes_t cs = detect_cache_sizes();
+    long bytes = 4 * cs.l3;
+    if (bytes < STREAM_MIN_BYTES) bytes = STREAM_MIN_BYTES;
+    if (bytes > STREAM_MAX_BYTES) bytes = STREAM_MAX_BYTES;
+    size_t count = (size_t)bytes / sizeof(double);
+
+    double *a = NULL, *b = NULL, *c = NULL;
+    triad_args_t *args = (triad_args_t *)calloc(num_threads, sizeof(triad_args_t));
+    if (posix_memalign((void **)&a, TRIAD_ALIGNMENT, count * sizeof(double)) != 0 ||
+        posix_memalign((void **)&b, TRIAD_ALIGNMENT, count * sizeof(double)) != 0 ||
+        posix_memalign((void **)&c, TRIAD_ALIGNMENT, count * sizeof(double)) != 0 || args == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+
+    // Each worker first-touches the part it streams, so the pages sit on its own node
+    thread_pool_t *pool = get_gemm_pool(num_threads);
     for (int t = 0; t < num_threads; t++) {
-        pthread_join(threads[t], NULL);
+        triad_args_t arg = {a, b, c, count * t / num_threads, count * (t + 1) / num_threads, 1};
+        args[t] = arg;
+    }
+    pool_run(pool, num_threads, triad_thread, args, sizeof(triad_args_t));
+
+    double best = 0.0;
+    for (int r = 0; r < STREAM_RUNS; r++) {
+        for (int t = 0; t < num_threads; t++) {
+            args[t].init = 0;
+        }
+        double start = get_time();
+        pool_run(pool, num_threads, triad_thread, args, sizeof(triad_args_t));
+        double elapsed = get_time() - start;
+        double gbs = 3.0 * sizeof(double) * count / elapsed * 1e-9;
+        if (elapsed > 0.0 && gbs > best) {
+            best = gbs;
+        }
     }
+
+    free(args);
+    free(a);
+    free(b);
+    free(c);
+    return best;
 }
 
 /**
- * Thread function for combined multithreaded and blocked MNK implementation
- * Probably no t the best idea, might not be the most efficient.
+ * Arithmetic intensity (FLOPs per byte) from compulsory traffic: A and B read once, C read
+ * and written once. That's the best case every variant is held to; how far a kernel misses
+ * it shows up as the gap to the roofline, or directly in the LLC column when counters are on.
  */
-void* mt_blocked_mnk_thread(void *arg) {
-    thread_args_t *args = (thread_args_t *)arg;
-    int thread_id = args->thread_id;
-    int num_threads = args->num_threads;
-    int m = args->m;
-    int n = args->n;
-    int k = args->k;
-    int block_size = args->block_size;
-    double *A = args->A;
-    double *B = args->B;
-    double *C = args->C;
-    
-    // Each thread processes a subset of blocks in the i direction
-    int i_blocks = (m + block_size - 1) / block_size;
-    int blocks_per_thread = (i_blocks + num_threads - 1) / num_threads;
-    int start_block = thread_id * blocks_per_thread;
-    int end_block = (start_block + blocks_per_thread < i_blocks) ? start_block + blocks_per_thread : i_blocks;
-    
-    int start_i = start_block * block_size;
-    int end_i = (end_block * block_size < m) ? end_block * block_size : m;
-    
-    // Iterate over blocks assigned to this thread.
-    // Complexity is higher than just multithreading.
-    for (int i0 = start_i; i0 < end_i; i0 += block_size) {
-        int i_bound = (i0 + block_size < m) ? i0 + block_size : m;
-        
-        for (int j0 = 0; j0 < n; j0 += block_size) {
-            int j_bound = (j0 + block_size < n) ? j0 + block_size : n;
-            
-            for (int p0 = 0; p0 < k; p0 += block_size) {
-                int p_bound = (p0 + block_size < k) ? p0 + block_size : k;
-                
-                // Compute within the block
-                for (int i = i0; i < i_bound; i++) {
-                    for (int j = j0; j < j_bound; j++) {
-                        for (int p = p0; p < p_bound; p++) {
-                            C[i*n + j] += A[i*k + p] * B[p*n + j];
+static double compulsory_intensity(const bench_variant_t *v, int m, int n, int k) {
+    double out_bytes = (v->typed_fn != NULL) ? sizeof(float) : sizeof(double);
+    double bytes = (double)v->in_bytes * ((double)m * k + (double)k * n) + out_bytes * 2.0 * m * n;
+    return 2.0 * m * n * k / bytes;
+}
+
+// Only the blocked variants read block_size, the rest are run once per thread count
+static int variant_uses_block(const bench_variant_t *v) {
+    return v->run != bench_mnk && v->run != bench_mt && v->run != bench_batched;
+}
+
+// Variants the scaling mode runs unless --variants says otherwise: the threaded ones
+static int scaling_default_variant(const bench_variant_t *v) {
+    return strncmp(v->name, "Multithreaded", 13) == 0 || strncmp(v->name, "MT+", 3) == 0;
+}
+
+/**
+ * --scaling mode: strong and weak scaling over a list of thread counts and block sizes in one
+ * process, with every result placed on the roofline of the thread count it ran on.
+ *   strong  the sweep's shapes at every thread count
+ *   weak    the first shape with M multiplied by the thread count, so each thread keeps the
+ *           same rows (and work) as the smallest run
+ * Speedup and efficiency are against the first thread count (weak speedup counts the extra
+ * work, so ideal is t / first in both modes). Roofline GFLOPS is
+ * min(peak, AI x triad bandwidth), using the single-precision peak for the typed variants.
+ * One line per (mode, threads, block, shape, variant) goes to scaling_results.csv (or --output).
+ */
+static int run_scaling_benchmark(const int *threads, int num_counts, const int *blocks, int num_blocks,
+                                 const sweep_spec_t *sweep) {
+    bench_config_t bench_cfg = bench_config_from_env();
+    int max_threads = 1;
+    for (int i = 0; i < num_counts; i++) {
+        if (threads[i] > max_threads) max_threads = threads[i];
+    }
+    thread_pool_t *pool = get_gemm_pool(max_threads);
+    set_setup_threads(max_threads);
+
+    int selected[NUM_BENCH_VARIANTS];
+    int need_batch = 0, need_typed = 0;
+    for (int v = 0; v < NUM_BENCH_VARIANTS; v++) {
+        const bench_variant_t *var = &bench_variants[v];
+        selected[v] = (sweep->num_variants > 0) ? sweep_variant_selected(sweep, var->name) : scaling_default_variant(var);
+        if (selected[v]) {
+            need_batch |= (var->batch > 1);
+            need_typed |= (var->typed_fn != NULL);
+        }
+    }
+
+    // Machine limits per thread count
+    double *peak_dp = (double *)malloc(num_counts * sizeof(double));
+    double *peak_sp = (double *)malloc(num_counts * sizeof(double));
+    double *bandwidth = (double *)malloc(num_counts * sizeof(double));
+    if (peak_dp == NULL || peak_sp == NULL || bandwidth == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    printf("Machine limits:\n");
+    for (int i = 0; i < num_counts; i++) {
+        peak_dp[i] = measure_peak_gflops(threads[i], 0);
+        peak_sp[i] = measure_peak_gflops(threads[i], 1);
+        bandwidth[i] = measure_triad_bandwidth(threads[i]);
+        printf("  %d threads: peak %.1f GFLOP/s double, %.1f GFLOP/s float, triad %.1f GB/s (ridge at %.1f FLOP/byte)\n",
+               threads[i], peak_dp[i], peak_sp[i], bandwidth[i], peak_dp[i] / bandwidth[i]);
+    }
+
+    // LLC read misses give a measured intensity next to the compulsory one, when counters work
+    perf_counters_t perf = {0};
+    int use_perf = 0;
+    if (perf_counters_requested()) {
+        pid_t tids[PERF_MAX_THREADS];
+        int num_tids = pool_thread_ids(pool, tids);
+        use_perf = (perf_counters_open(&perf, tids, num_tids) > 0) && perf.available[3];
+    }
+
+    const char *path = (sweep->output[0] != '\0') ? sweep->output : "scaling_results.csv";
+    FILE *results_file = fopen(path, "w");
+    if (results_file == NULL) {
+        fprintf(stderr, "Error opening results file\n");
+        return 1;
+    }
+    fprintf(results_file, "Mode,Threads,Block Size,Matrix Size,M,N,K,Implementation,Median,GFLOPS,Speedup,Efficiency,"
+                          "Peak GFLOPS,Bandwidth GBs,AI,LLC AI,Roofline GFLOPS,Roofline Fraction\n");
+
+    const char *modes[] = {"strong", "weak"};
+    for (int mode = 0; mode < 2; mode++) {
+        int num_shapes = (mode == 0) ? sweep->num_shapes : 1;
+        for (int s = 0; s < num_shapes; s++) {
+            // Baseline median per (block, variant) from the first thread count
+            double *base = (double *)calloc((size_t)num_blocks * NUM_BENCH_VARIANTS, sizeof(double));
+            if (base == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            bench_inputs_t in;
+            int have_inputs = 0;
+
+            for (int ti = 0; ti < num_counts; ti++) {
+                int t = threads[ti];
+                sweep_shape_t shape = sweep->shapes[s];
+                if (mode == 1) {
+                    shape.m *= t;
+                }
+                if (have_inputs && (mode == 1)) {
+                    free_bench_inputs(&in);
+                    have_inputs = 0;
+                }
+                if (!have_inputs) {
+                    init_bench_inputs(&in, shape.m, shape.n, shape.k, need_batch, need_typed);
+                    have_inputs = 1;
+                }
+                int m = shape.m, n = shape.n, k = shape.k;
+                set_gemm_threads(t);
+                printf("%s scaling, %d threads, %d x %d (k = %d)...\n", modes[mode], t, m, n, k);
+
+                for (int bi = 0; bi < num_blocks; bi++) {
+                    gemm_bench_t bench = bench_for_inputs(&in, t, blocks[bi]);
+                    for (int v = 0; v < NUM_BENCH_VARIANTS; v++) {
+                        const bench_variant_t *var = &bench_variants[v];
+                        if (!selected[v] || (bi > 0 && !variant_uses_block(var))) {
+                            continue;
+                        }
+                        bench.typed_fn = var->typed_fn;
+                        bench_stats_t st = bench_run(&bench_cfg, var->reset, var->run, &bench);
+                        bench_scale_stats(&st, 1.0 / var->batch);
+                        double gflops = bench_gflops(m, n, k, st.median);
+
+                        double *first = &base[(size_t)bi * NUM_BENCH_VARIANTS + v];
+                        if (ti == 0) {
+                            *first = st.median;
                         }
+                        // Weak scaling does t / threads[0] times the work, so its speedup is scaled by that
+                        double ratio = *first / st.median;
+                        double speedup = (mode == 0) ? ratio : ratio * t / threads[0];
+                        double efficiency = speedup * threads[0] / t;
+
+                        double peak = (var->typed_fn != NULL) ? peak_sp[ti] : peak_dp[ti];
+                        double ai = compulsory_intensity(var, m, n, k);
+                        double roof = (ai * bandwidth[ti] < peak) ? ai * bandwidth[ti] : peak;
+
+                        fprintf(results_file, "%s,%d,", modes[mode], t);
+                        if (variant_uses_block(var)) {
+                            fprintf(results_file, "%d", blocks[bi]);
+                        }
+                        fprintf(results_file, ",%d,%d,%d,%d,%s,%.9f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,",
+                                sweep_shape_size(shape), m, n, k, var->name, st.median, gflops, speedup, efficiency,
+                                peak, bandwidth[ti], ai);
+                        if (use_perf) {
+                            double counters[PERF_NUM_EVENTS];
+                            perf_counters_measure(&perf, var->reset, var->run, &bench, st.inner, counters);
+                            if (counters[3] > 0.0) {
+                                fprintf(results_file, "%.3f", 2.0 * m * n * k * var->batch / (counters[3] * 64.0));
+                            }
+                        }
+                        fprintf(results_file, ",%.3f,%.4f\n", roof, gflops / roof);
+                        printf("  %s", var->name);
+                        if (variant_uses_block(var)) {
+                            printf(" (block %d)", blocks[bi]);
+                        }
+                        printf(": %.2f GFLOP/s, speedup %.2fx, %.0f%% of the roofline\n", gflops, speedup, 100.0 * gflops / roof);
                     }
                 }
+                fflush(results_file);
+            }
+
+            if (have_inputs) {
+                free_bench_inputs(&in);
             }
+            free(base);
         }
     }
-    
-    return NULL;
+
+    fclose(results_file);
+    if (use_perf) {
+        perf_counters_close(&perf);
+    }
+    free(peak_dp);
+    free(peak_sp);
+    free(bandwidth);
+    printf("\nScaling results saved to %s\n", path);
+    return 0;
 }
 
 /**
- * 4. Combined multithreaded and blocked MNK implementation
+ * --verify mode: runs every variant (plus dgemm_general in every layout/transpose and
+ * Strassen) on odd, prime and rectangular shapes, and on shapes just past the micro-kernel
+ * and block edges, and compares C with a compensated reference.
+ *
+ * The reference sums each dot product with Neumaier's compensated summation, with the
+ * rounding error of every product recovered by an fma, so it's accurate to about one ulp
+ * whatever k is. The inputs are centred on zero so cancellation is exercised too. A result
+ * passes if every element is within the standard bound
+ *   |C - ref| <= VERIFY_SAFETY * k * u * (|A||B|)_ij
+ * with u the unit roundoff of the accumulation type (the reduced-precision variants are
+ * checked against a reference built from their rounded inputs, so only accumulation error
+ * counts). Strassen isn't elementwise stable, so it gets the normwise version of the bound.
+ * Checking at several thread counts and block sizes is what catches races and edge tiles.
  */
-void mt_blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads, int block_size) {
-    pthread_t threads[num_threads];
-    thread_args_t args[num_threads];
-    
-    // Create threads
-    for (int t = 0; t < num_threads; t++) {
-        args[t].thread_id = t;
-        args[t].num_threads = num_threads;
-        args[t].m = m;
-        args[t].n = n;
-        args[t].k = k;
-        args[t].block_size = block_size;
-        args[t].A = A;
-        args[t].B = B;
-        args[t].C = C;
-        
-        pthread_create(&threads[t], NULL, mt_blocked_mnk_thread, &args[t]);
+#define VERIFY_SAFETY 4.0
+#define VERIFY_STRASSEN_SAFETY 64.0
+#define VERIFY_STRASSEN_CUTOFF 16
+#define VERIFY_ASYNC_KEY 0x7665726966794147ULL
+
+typedef struct {
+    double max_abs;     // max |C - ref|
+    double max_rel;     // max |C - ref| / |ref| over elements with ref != 0
+    double bound;       // worst |C - ref| / allowed, > 1 fails
+} verify_error_t;
+
+// Neumaier compensated dot products: ref = A*B, absref = |A||B|
+static void reference_gemm(int m, int n, int k, const double *A, const double *B, double *ref, double *absref) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double sum = 0.0, comp = 0.0, abs_sum = 0.0;
+            for (int p = 0; p < k; p++) {
+                double a = A[(size_t)i*k + p], b = B[(size_t)p*n + j];
+                double x = a * b;
+                comp += fma(a, b, -x);
+                double t = sum + x;
+                comp += (fabs(sum) >= fabs(x)) ? (sum - t) + x : (x - t) + sum;
+                sum = t;
+                abs_sum += fabs(x);
+            }
+            ref[(size_t)i*n + j] = sum + comp;
+            absref[(size_t)i*n + j] = abs_sum;
+        }
     }
-    
-    // Join threads
-    for (int t = 0; t < num_threads; t++) {
-        pthread_join(threads[t], NULL);
+}
+
+// Compares a row-major m x n result (double or float) against ref, scale multiplies ref
+static verify_error_t compare_result(int m, int n, int k, const double *C, const float *Cf, int ldc, double scale,
+                                      const double *ref, const double *absref, double unit, int normwise) {
+    verify_error_t err = {0.0, 0.0, 0.0};
+    double max_absref = 0.0;
+    for (size_t i = 0; i < (size_t)m * n; i++) {
+        if (absref[i] > max_absref) max_absref = absref[i];
+    }
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            size_t r = (size_t)i * n + j;
+            double c = (C != NULL) ? C[(size_t)i*ldc + j] : (double)Cf[(size_t)i*ldc + j];
+            double expect = scale * ref[r];
+            double diff = fabs(c - expect);
+            if (isnan(c)) {
+                diff = INFINITY;
+            }
+            double allowed = VERIFY_SAFETY * (k + 1) * unit * fabs(scale) * (normwise ? max_absref : absref[r]);
+            if (diff > err.max_abs) err.max_abs = diff;
+            if (expect != 0.0 && diff / fabs(expect) > err.max_rel) err.max_rel = diff / fabs(expect);
+            double ratio = (allowed > 0.0) ? diff / allowed : (diff > 0.0 ? INFINITY : 0.0);
+            if (ratio > err.bound) err.bound = ratio;
+        }
+    }
+    return err;
+}
+
+typedef struct {
+    FILE *f;
+    int checks, failures;
+} verify_log_t;
+
+static void verify_record(verify_log_t *log, const char *name, int m, int n, int k, int threads, int block,
+                          verify_error_t err) {
+    int pass = err.bound <= 1.0;
+    log->checks++;
+    if (!pass) {
+        log->failures++;
+        printf("  FAIL %s %dx%dx%d, %d threads, block %d: max abs %.3e, max rel %.3e (%.1fx the bound)\n",
+               name, m, n, k, threads, block, err.max_abs, err.max_rel, err.bound);
+    }
+    if (log->f != NULL) {
+        fprintf(log->f, "%s,%d,%d,%d,%d,%d,%.3e,%.3e,%.3f,%s\n", name, m, n, k, threads, block, err.max_abs,
+                err.max_rel, err.bound, pass ? "pass" : "FAIL");
+    }
+}
+
+// Worst error per name, for the summary
+typedef struct {
+    const char *name;
+    verify_error_t worst;
+} verify_summary_t;
+
+static void verify_summarize(verify_summary_t *sums, int *num_sums, const char *name, verify_error_t err) {
+    int i = 0;
+    while (i < *num_sums && strcmp(sums[i].name, name) != 0) i++;
+    if (i == *num_sums) {
+        sums[i].name = name;
+        sums[i].worst = err;
+        (*num_sums)++;
+        return;
+    }
+    if (err.max_abs > sums[i].worst.max_abs) sums[i].worst.max_abs = err.max_abs;
+    if (err.max_rel > sums[i].worst.max_rel) sums[i].worst.max_rel = err.max_rel;
+    if (err.bound > sums[i].worst.bound) sums[i].worst.bound = err.bound;
+}
+
+static int variant_uses_threads(const bench_variant_t *v) {
+    return v->run == bench_mt || v->run == bench_mt_blocked || v->run == bench_batched || strncmp(v->name, "MT+", 3) == 0;
+}
+
+// The typed variant's inputs widened back to double, so the reference sees exactly what the kernel saw
+static void typed_inputs_as_double(const bench_variant_t *v, const typed_inputs_t *in, double *A, double *B) {
+    size_t a_count = (size_t)in->m * in->k, b_count = (size_t)in->k * in->n;
+    if (v->in_bytes == 4) {
+        for (size_t i = 0; i < a_count; i++) A[i] = in->A_f32[i];
+        for (size_t i = 0; i < b_count; i++) B[i] = in->B_f32[i];
+    } else if (strstr(v->name, "bf16") != NULL) {
+        for (size_t i = 0; i < a_count; i++) A[i] = bf16_to_float(in->A_bf16[i]);
+        for (size_t i = 0; i < b_count; i++) B[i] = bf16_to_float(in->B_bf16[i]);
+    }
+#ifdef HAVE_FLOAT16
+    else {
+        for (size_t i = 0; i < a_count; i++) A[i] = (double)in->A_f16[i];
+        for (size_t i = 0; i < b_count; i++) B[i] = (double)in->B_f16[i];
+    }
+#endif
+}
+
+// Stores the logical m x k matrix X (row-major) as op(X) in the given layout; ld is the leading dimension
+static void store_operand(int rows, int cols, const double *X, int row_major, int trans, double *out, int *ld) {
+    int s_rows = trans ? cols : rows, s_cols = trans ? rows : cols;
+    *ld = row_major ? s_cols : s_rows;
+    for (int i = 0; i < s_rows; i++) {
+        for (int j = 0; j < s_cols; j++) {
+            double v = trans ? X[(size_t)j*cols + i] : X[(size_t)i*cols + j];
+            out[row_major ? (size_t)i * *ld + j : (size_t)j * *ld + i] = v;
+        }
     }
 }
 
+/**
+ * Runs the verification. thread_counts are tried for every threaded variant; tuning_file, if
+ * not NULL, is loaded first so dgemm_general is checked with the tuned choices.
+ * Returns the number of failed checks (0 = everything passed). Writes verify_results.csv.
+ */
+static int run_verification(const int *thread_counts, int num_counts, const char *tuning_file) {
+    if (tuning_file != NULL && load_tuning_file(tuning_file) < 0) {
+        fprintf(stderr, "Cannot read tuning file %s\n", tuning_file);
+        return 1;
+    }
+    int max_threads = 1;
+    for (int i = 0; i < num_counts; i++) {
+        if (thread_counts[i] > max_threads) max_threads = thread_counts[i];
+    }
+    get_gemm_pool(max_threads);
+    set_setup_threads(max_threads);
+
+    // Odd, prime and rectangular shapes, degenerate ones, and ones just past the kernel tile and blocking edges
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    blocking_t bp = get_blocking(uk);
+    int shapes[][3] = {
+        {1, 1, 1}, {1, 17, 1}, {17, 1, 23}, {2, 3, 5}, {7, 13, 11}, {31, 37, 41}, {97, 101, 103},
+        {127, 3, 131}, {3, 257, 61}, {200, 10, 300}, {64, 64, 64}, {100, 100, 100}, {255, 257, 129},
+        {uk->mr * 3 + 1, uk->nr * 2 + 3, bp.kc + 7}, {bp.mc + 1, uk->nr + 1, 33}, {5, 2 * uk->nr + 1, 2 * bp.kc + 1},
+        // GEMV both ways round and rank-k updates, big enough for their threaded paths
+        {1000, 1, 200}, {1, 1000, 200}, {400, 333, 3}, {333, 400, 8}, {300, 300, 1},
+        // Every fixed-size kernel
+        {4, 4, 4}, {8, 8, 8}, {10, 10, 10}, {16, 16, 16}, {20, 20, 20}, {30, 30, 30}, {32, 32, 32},
+        // Odd sizes that make Strassen peel a row and column at more than one level
+        {67, 67, 67}, {99, 99, 99},
+    };
+    int num_shapes = sizeof(shapes) / sizeof(shapes[0]);
+    const int blocks[] = {7, DEFAULT_BLOCK_SIZE, 33};
+    const int num_blocks = sizeof(blocks) / sizeof(blocks[0]);
+
+    verify_log_t log = {fopen("verify_results.csv", "w"), 0, 0};
+    if (log.f != NULL) {
+        fprintf(log.f, "Implementation,M,N,K,Threads,Block Size,Max Abs Error,Max Rel Error,Bound Ratio,Result\n");
+    }
+    verify_summary_t sums[NUM_BENCH_VARIANTS + 14];   // the variants, 8 dgemm_general cases, Strassen, 2 epilogues, 2 CSR, async
+    int num_sums = 0;
+    const double u64 = ldexp(1.0, -53), u32 = ldexp(1.0, -24);
+    set_async_threads(thread_counts[num_counts - 1]);
+
+    printf("Verifying against a compensated reference (%d shapes, micro-kernel %s)\n", num_shapes, uk->name);
+    for (int s = 0; s < num_shapes; s++) {
+        int m = shapes[s][0], n = shapes[s][1], k = shapes[s][2];
+        bench_inputs_t in;
+        init_bench_inputs(&in, m, n, k, 1, 1);
+        // Centre A and B on zero, then redo the reduced-precision copies from the new values
+        for (size_t i = 0; i < (size_t)m * k; i++) in.A[i] = 2.0 * in.A[i] - 1.0;
+        for (size_t i = 0; i < (size_t)k * n; i++) in.B[i] = 2.0 * in.B[i] - 1.0;
+        free_typed_inputs(&in.typed);
+        init_typed_inputs(&in.typed, m, n, k, in.A, in.B);
+
+        double *ref = (double *)malloc((size_t)m * n * sizeof(double));
+        double *absref = (double *)malloc((size_t)m * n * sizeof(double));
+        double *ref_t = (double *)malloc((size_t)m * n * sizeof(double));
+        double *absref_t = (double *)malloc((size_t)m * n * sizeof(double));
+        double *wide_A = (double *)malloc((size_t)m * k * sizeof(double));
+        double *wide_B = (double *)malloc((size_t)k * n * sizeof(double));
+        if (ref == NULL || absref == NULL || ref_t == NULL || absref_t == NULL || wide_A == NULL || wide_B == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        reference_gemm(m, n, k, in.A, in.B, ref, absref);
+
+        for (int v = 0; v < NUM_BENCH_VARIANTS; v++) {
+            const bench_variant_t *var = &bench_variants[v];
+            int typed = (var->typed_fn != NULL);
+            if (typed) {
+                typed_inputs_as_double(var, &in.typed, wide_A, wide_B);
+                reference_gemm(m, n, k, wide_A, wide_B, ref_t, absref_t);
+            }
+            for (int ti = 0; ti < (variant_uses_threads(var) ? num_counts : 1); ti++) {
+                int t = variant_uses_threads(var) ? thread_counts[ti] : 1;
+                for (int bi = 0; bi < (variant_uses_block(var) ? num_blocks : 1); bi++) {
+                    gemm_bench_t bench = bench_for_inputs(&in, t, blocks[bi]);
+                    bench.typed_fn = var->typed_fn;
+                    var->reset(&bench);
+                    var->run(&bench);
+
+                    verify_error_t err;
+                    if (typed) {
+                        err = compare_result(m, n, k, NULL, in.typed.C, n, 1.0, ref_t, absref_t, u32, 0);
+                    } else if (var->batch > 1) {
+                        // Every matrix in the batch has to be right, not just the first
+                        err = (verify_error_t){0.0, 0.0, 0.0};
+                        for (int b = 0; b < BATCH_COUNT; b++) {
+                            verify_error_t e = compare_result(m, n, k, in.batch_C[b], NULL, n, 1.0, ref, absref, u64, 0);
+                            if (e.max_abs > err.max_abs) err.max_abs = e.max_abs;
+                            if (e.max_rel > err.max_rel) err.max_rel = e.max_rel;
+                            if (e.bound > err.bound) err.bound = e.bound;
+                        }
+                    } else {
+                        err = compare_result(m, n, k, in.C, NULL, n, 1.0, ref, absref, u64, 0);
+                    }
+                    verify_record(&log, var->name, m, n, k, t, variant_uses_block(var) ? blocks[bi] : 0, err);
+                    verify_summarize(sums, &num_sums, var->name, err);
+                }
+            }
+        }
+
+        // dgemm_general in both layouts and every transpose combination, alpha = 0.5 and beta = 0
+        // into a NaN-filled C (so a beta = 0 that still reads C shows up). Uses the tuned choices if loaded.
+        double *sa = (double *)malloc((size_t)m * k * sizeof(double) + 8);
+        double *sb = (double *)malloc((size_t)k * n * sizeof(double) + 8);
+        double *sc = (double *)malloc((size_t)m * n * sizeof(double) + 8);
+        if (sa == NULL || sb == NULL || sc == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        static const char *general_names[2][2][2] = {
+            {{"dgemm_general col NN", "dgemm_general col NT"}, {"dgemm_general col TN", "dgemm_general col TT"}},
+            {{"dgemm_general row NN", "dgemm_general row NT"}, {"dgemm_general row TN", "dgemm_general row TT"}},
+        };
+        for (int row_major = 0; row_major < 2; row_major++) {
+            for (int ta = 0; ta < 2; ta++) {
+                for (int tb = 0; tb < 2; tb++) {
+                    int lda, ldb;
+                    store_operand(m, k, in.A, row_major, ta, sa, &lda);
+                    store_operand(k, n, in.B, row_major, tb, sb, &ldb);
+                    for (int ti = 0; ti < num_counts; ti++) {
+                        for (size_t i = 0; i < (size_t)m * n; i++) sc[i] = NAN;
+                        set_gemm_threads(thread_counts[ti]);
+                        int ldc = row_major ? n : m;
+                        dgemm_general(row_major ? GEMM_ROW_MAJOR : GEMM_COL_MAJOR, ta ? GEMM_TRANS : GEMM_NO_TRANS,
+                                      tb ? GEMM_TRANS : GEMM_NO_TRANS, m, n, k, 0.5, sa, lda, sb, ldb, 0.0, sc, ldc);
+                        // Back to row-major for the comparison (ref_t is free again by now)
+                        double *rc = ref_t;
+                        for (int i = 0; i < m; i++) {
+                            for (int j = 0; j < n; j++) {
+                                rc[(size_t)i*n + j] = row_major ? sc[(size_t)i*ldc + j] : sc[(size_t)j*ldc + i];
+                            }
+                        }
+                        verify_error_t err = compare_result(m, n, k, rc, NULL, n, 0.5, ref, absref, u64, 0);
+                        const char *name = general_names[row_major][ta][tb];
+                        verify_record(&log, name, m, n, k, thread_counts[ti], 0, err);
+                        verify_summarize(sums, &num_sums, name, err);
+                    }
+                }
+            }
+        }
+        free(sa);
+        free(sb);
+        free(sc);
+
+        // Strassen only takes square matrices; a small cutoff makes even these recurse
+        if (m == n && n == k) {
+            for (int ti = 0; ti < num_counts; ti++) {
+                set_gemm_threads(thread_counts[ti]);
+                reset_matrix_c(in.C, m, n);
+                strassen_gemm(n, in.A, in.B, in.C, VERIFY_STRASSEN_CUTOFF);
+                verify_error_t err = compare_result(m, n, k, in.C, NULL, n, 1.0, ref, absref,
+                                                    VERIFY_STRASSEN_SAFETY / VERIFY_SAFETY * u64, 1);
+                verify_record(&log, "Strassen", m, n, k, thread_counts[ti], VERIFY_STRASSEN_CUTOFF, err);
+                verify_summarize(sums, &num_sums, "Strassen", err);
+            }
+        }
+
+        // Fused epilogue: scale, a bias of both signs and ReLU on C, plus the float copy of it
+        double *bias = (double *)malloc((size_t)n * sizeof(double));
+        float *out = (float *)malloc((size_t)m * n * sizeof(float));
+        if (bias == NULL || out == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        for (int j = 0; j < n; j++) bias[j] = 0.05 * ((j % 11) - 5);
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+                size_t r = (size_t)i * n + j;
+                double v = 0.5 * ref[r] + bias[j];
+                ref_t[r] = (v > 0.0) ? v : 0.0;
+                absref_t[r] = 0.5 * absref[r] + fabs(bias[j]);
+            }
+        }
+        gemm_epilogue_t ep = GEMM_EPILOGUE_INIT;
+        ep.scale = 0.5;
+        ep.bias = bias;
+        ep.act = GEMM_ACT_RELU;
+        ep.out = out;
+        ep.ldo = n;
+        for (int ti = -1; ti < num_counts; ti++) {   // -1 is the serial blocked path
+            int t = (ti < 0) ? 1 : thread_counts[ti];
+            const char *name = (ti < 0) ? "Blocked MNK epilogue" : "MT+Blocked MNK epilogue";
+            reset_matrix_c(in.C, m, n);
+            for (size_t i = 0; i < (size_t)m * n; i++) out[i] = NAN;
+            if (ti < 0) {
+                blocked_mnk_gemm_ep(m, n, k, in.A, in.B, in.C, DEFAULT_BLOCK_SIZE, &ep);
+            } else {
+                mt_blocked_mnk_gemm_ep(m, n, k, in.A, in.B, in.C, t, DEFAULT_BLOCK_SIZE, &ep);
+            }
+            verify_error_t err = compare_result(m, n, k, in.C, NULL, n, 1.0, ref_t, absref_t, u64, 0);
+            verify_error_t err_out = compare_result(m, n, k, NULL, out, n, 1.0, ref_t, absref_t, u32, 0);
+            if (err_out.max_abs > err.max_abs) err.max_abs = err_out.max_abs;
+            if (err_out.max_rel > err.max_rel) err.max_rel = err_out.max_rel;
+            if (err_out.bound > err.bound) err.bound = err_out.bound;
+            verify_record(&log, name, m, n, k, t, DEFAULT_BLOCK_SIZE, err);
+            verify_summarize(sums, &num_sums, name, err);
+        }
+        free(bias);
+        free(out);
+
+        // CSR x dense on A with about 70% of it zeroed, the diagonal band kept and row 0 left empty
+        for (int i = 0; i < m; i++) {
+            for (int p = 0; p < k; p++) {
+                size_t r = (size_t)i * k + p;
+                int keep = (i != 0 || m == 1) && ((r * 2654435761u) % 10 < 3 || i == p);
+                wide_A[r] = keep ? in.A[r] : 0.0;
+            }
+        }
+        reference_gemm(m, n, k, wide_A, in.B, ref_t, absref_t);
+        csr_matrix_t csr;
+        if (dense_to_csr(m, k, wide_A, &csr) != 0) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        for (int ti = -1; ti < num_counts; ti++) {   // -1 is the serial kernel
+            int t = (ti < 0) ? 1 : thread_counts[ti];
+            const char *name = (ti < 0) ? "CSR SpMM" : "MT CSR SpMM";
+            reset_matrix_c(in.C, m, n);
+            if (ti < 0) {
+                csr_gemm(&csr, n, in.B, in.C);
+            } else {
+                mt_csr_gemm(&csr, n, in.B, in.C, t);
+            }
+            verify_error_t err = compare_result(m, n, k, in.C, NULL, n, 1.0, ref_t, absref_t, u64, 0);
+            verify_record(&log, name, m, n, k, t, 0, err);
+            verify_summarize(sums, &num_sums, name, err);
+        }
+        free_csr(&csr);
+
+        // Asynchronous T = A * B, then C = G * T chained on it; G is m x m, centred like A and B.
+        // Every piece of the second reads all of T, so starting it early can't go unnoticed
+        double *async_T = (double *)calloc((size_t)m * n, sizeof(double));
+        double *async_G = (double *)malloc((size_t)m * m * sizeof(double));
+        if (async_T == NULL || async_G == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        fill_uniform(async_G, (size_t)m * m, VERIFY_ASYNC_KEY, 0);
+        for (size_t i = 0; i < (size_t)m * m; i++) async_G[i] = 2.0 * async_G[i] - 1.0;
+        reset_matrix_c(in.C, m, n);
+        gemm_future_t *first = gemm_submit(m, n, k, in.A, in.B, async_T, NULL, 0);
+        gemm_future_t *second = gemm_submit(m, n, m, async_G, async_T, in.C, &first, 1);
+        if (first == NULL || second == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        gemm_future_free(second);
+        gemm_future_free(first);
+        verify_error_t async_err = compare_result(m, n, k, async_T, NULL, n, 1.0, ref, absref, u64, 0);
+        reference_gemm(m, n, m, async_G, async_T, ref_t, absref_t);
+        verify_error_t chain_err = compare_result(m, n, m, in.C, NULL, n, 1.0, ref_t, absref_t, u64, 0);
+        if (chain_err.max_abs > async_err.max_abs) async_err.max_abs = chain_err.max_abs;
+        if (chain_err.max_rel > async_err.max_rel) async_err.max_rel = chain_err.max_rel;
+        if (chain_err.bound > async_err.bound) async_err.bound = chain_err.bound;
+        verify_record(&log, "Async GEMM", m, n, k, thread_counts[num_counts - 1], 0, async_err);
+        verify_summarize(sums, &num_sums, "Async GEMM", async_err);
+        free(async_T);
+        free(async_G);
+
+        free(ref);
+        free(absref);
+        free(ref_t);
+        free(absref_t);
+        free(wide_A);
+        free(wide_B);
+        free_bench_inputs(&in);
+    }
+
+    printf("\n%-24s %12s %12s %12s\n", "Implementation", "Max Abs", "Max Rel", "Worst/Bound");
+    for (int i = 0; i < num_sums; i++) {
+        printf("%-24s %12.3e %12.3e %12.3f %s\n", sums[i].name, sums[i].worst.max_abs, sums[i].worst.max_rel,
+               sums[i].worst.bound, sums[i].worst.bound <= 1.0 ? "pass" : "FAIL");
+    }
+    printf("\n%d checks, %d failed. Details in verify_results.csv\n", log.checks, log.failures);
+    if (log.f != NULL) {
+        fclose(log.f);
+    }
+    return log.failures;
+}
+
 int main(int argc, char *argv[]) {
     // Seed the random number generator
-    srand(time(NULL));
+    set_matrix_seed((uint64_t)time(NULL));
+    
+    // Matrix sizes to test
+    int sizes[] = {10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 200, 300, 400};
+    int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    
+    // Autotuning mode: ./OptGEMM --tune [max_threads] [tuning_file]
+    if (argc > 1 && strcmp(argv[1], "--tune") == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int max_threads = (argc > 2) ? atoi(argv[2]) : (cores > 0 ? (int)cores : DEFAULT_NUM_THREADS);
+        if (max_threads < 1) max_threads = 1;
+        const char *tuning_file = (argc > 3) ? argv[3] : DEFAULT_TUNING_FILE;
+        autotune(sizes, num_sizes, max_threads, tuning_file);
+        // Check the kernels it picked before anything relies on them
+        int counts[] = {1, max_threads};
+        return run_verification(counts, (max_threads > 1) ? 2 : 1, tuning_file) ? 1 : 0;
+    }
+    
+    // Strassen mode: ./OptGEMM --strassen [threads] [max_size] [cutoff]
+    if (argc > 1 && strcmp(argv[1], "--strassen") == 0) {
+        int threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_NUM_THREADS;
+        int max_size = (argc > 3) ? atoi(argv[3]) : 2048;
+        int cutoff = (argc > 4) ? atoi(argv[4]) : DEFAULT_STRASSEN_CUTOFF;
+        if (threads < 1) threads = 1;
+        if (cutoff < 1) cutoff = DEFAULT_STRASSEN_CUTOFF;
+        return run_strassen_benchmark(threads, max_size, cutoff);
+    }
+    
+    // Out-of-core mode: ./OptGEMM --ooc M N K [memory_MB] [threads] [dir]
+    if (argc > 4 && strcmp(argv[1], "--ooc") == 0) {
+        int m = atoi(argv[2]), n = atoi(argv[3]), k = atoi(argv[4]);
+        int mem_mb = (argc > 5) ? atoi(argv[5]) : 64;
+        int threads = (argc > 6) ? atoi(argv[6]) : DEFAULT_NUM_THREADS;
+        if (m < 1 || n < 1 || k < 1 || mem_mb < 1) {
+            fprintf(stderr, "Usage: %s --ooc M N K [memory_MB] [threads] [dir]\n", argv[0]);
+            return 1;
+        }
+        if (threads < 1) threads = 1;
+        return run_ooc_benchmark(m, n, k, mem_mb, threads, (argc > 7) ? argv[7] : ".");
+    }
+    
+    // Sparse mode: ./OptGEMM --sparse [threads] [size list] [density % list]
+    if (argc > 1 && strcmp(argv[1], "--sparse") == 0) {
+        int threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_NUM_THREADS;
+        int sparse_sizes[SWEEP_MAX_VALUES] = {256, 512, 1024};
+        double densities[SPARSE_MAX_DENSITIES] = {0.5, 1, 2, 5, 10, 20, 30, 50};
+        int num_sparse_sizes = 3, num_densities = 8;
+        if (argc > 3) num_sparse_sizes = sweep_parse_list(argv[3], sparse_sizes, SWEEP_MAX_VALUES);
+        if (argc > 4) num_densities = parse_densities(argv[4], densities, SPARSE_MAX_DENSITIES);
+        if (num_sparse_sizes < 1 || num_densities < 1) {
+            fprintf(stderr, "Usage: %s --sparse [threads] [SIZE LIST] [DENSITY %% LIST]\n", argv[0]);
+            return 1;
+        }
+        if (threads < 1) threads = 1;
+        return run_sparse_benchmark(threads, sparse_sizes, num_sparse_sizes, densities, num_densities);
+    }
+    
+    // Async mode: ./OptGEMM --async [threads] [count] [size]
+    if (argc > 1 && strcmp(argv[1], "--async") == 0) {
+        int threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_NUM_THREADS;
+        int count = (argc > 3) ? atoi(argv[3]) : 16;
+        int n = (argc > 4) ? atoi(argv[4]) : 256;
+        if (count < 1 || n < 1) {
+            fprintf(stderr, "Usage: %s --async [threads] [count] [size]\n", argv[0]);
+            return 1;
+        }
+        if (threads < 1) threads = 1;
+        return run_async_benchmark(threads, count, n);
+    }
+    
+    // Verification mode: ./OptGEMM --verify [threads] [tuning_file], exits non-zero if anything is off
+    if (argc > 1 && strcmp(argv[1], "--verify") == 0) {
+        int threads = (argc > 2) ? atoi(argv[2]) : DEFAULT_NUM_THREADS;
+        if (threads < 1) threads = 1;
+        int counts[] = {1, 3, threads};
+        int num_counts = (threads == 1 || threads == 3) ? 2 : 3;
+        return run_verification(counts, num_counts, (argc > 3) ? argv[3] : NULL) ? 1 : 0;
+    }
+    
+    // Scaling mode: ./OptGEMM --scaling [thread list] [block size list] [sweep options]
+    // e.g. --scaling 1:16:x2 16,32,64 --sizes 512,1024 (defaults: powers of two up to the core count)
+    if (argc > 1 && strcmp(argv[1], "--scaling") == 0) {
+        static sweep_spec_t scaling;
+        int scaling_sizes[] = {256, 512, 1024};
+        if (sweep_parse_args(&scaling, argc - 1, argv + 1) != 0 || sweep_finalize(&scaling, scaling_sizes, 3) != 0) {
+            return 1;
+        }
+        int thread_counts[SWEEP_MAX_VALUES], block_sizes[SWEEP_MAX_VALUES];
+        int num_counts = 0, num_blocks = 3;
+        block_sizes[0] = 16;
+        block_sizes[1] = 32;
+        block_sizes[2] = 64;
+        if (scaling.num_positional > 0) {
+            num_counts = sweep_parse_list(scaling.positional[0], thread_counts, SWEEP_MAX_VALUES);
+        } else {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            int max_threads = (scaling.threads > 0) ? scaling.threads : (cores > 0 ? (int)cores : DEFAULT_NUM_THREADS);
+            for (int t = 1; t < max_threads; t *= 2) {
+                thread_counts[num_counts++] = t;
+            }
+            thread_counts[num_counts++] = max_threads;
+        }
+        if (scaling.num_positional > 1) {
+            num_blocks = sweep_parse_list(scaling.positional[1], block_sizes, SWEEP_MAX_VALUES);
+        } else if (scaling.block_size > 0) {
+            block_sizes[0] = scaling.block_size;
+            num_blocks = 1;
+        }
+        if (num_counts < 1 || num_blocks < 1) {
+            fprintf(stderr, "Usage: %s --scaling [THREADS LIST] [BLOCK LIST] [sweep options]\n", argv[0]);
+            return 1;
+        }
+        if (scaling.mc > 0) set_blocking(scaling.mc, scaling.kc, scaling.nc);
+        if (set_affinity_policy(getenv("GEMM_AFFINITY")) != 0) {
+            fprintf(stderr, "Unknown GEMM_AFFINITY policy (use compact, scatter or none)\n");
+            return 1;
+        }
+        return run_scaling_benchmark(thread_counts, num_counts, block_sizes, num_blocks, &scaling);
+    }
+    
+    // Sweep spec (shapes, variants, threads, block size, output) from options or --config;
+    // the old positional [threads] [block_size] [MC,KC,NC] still work
+    static sweep_spec_t sweep;
+    if (sweep_parse_args(&sweep, argc, argv) != 0 || sweep_finalize(&sweep, sizes, num_sizes) != 0) {
+        fprintf(stderr, "Usage: %s [threads] [block_size] [MC,KC,NC] [--sizes LIST] [--m LIST] [--n LIST] [--k LIST] "
+                        "[--shape MxNxK,...] [--variants NAME,...] [--threads N] [--block N] [--blocking MC,KC,NC] "
+                        "[--output FILE] [--json FILE] [--config FILE]\n", argv[0]);
+        return 1;
+    }
     
-    // Parse command line arguments for threads and block size
     int num_threads = DEFAULT_NUM_THREADS;
     int block_size = DEFAULT_BLOCK_SIZE;
     
-    if (argc > 1) {
-        num_threads = atoi(argv[1]);
+    if (sweep.num_positional > 0) {
+        num_threads = atoi(sweep.positional[0]);
         if (num_threads < 1) num_threads = 1;
     }
     
-    if (argc > 2) {
-        block_size = atoi(argv[2]);
+    if (sweep.num_positional > 1) {
+        block_size = atoi(sweep.positional[1]);
         if (block_size < 1) block_size = 1;
     }
     
+    // Optional MC,KC,NC override for the packed path, e.g. "256,128,4096"
+    if (sweep.num_positional > 2) {
+        if (sscanf(sweep.positional[2], "%d,%d,%d", &sweep.mc, &sweep.kc, &sweep.nc) != 3 ||
+            sweep.mc < 1 || sweep.kc < 1 || sweep.nc < 1) {
+            fprintf(stderr, "Usage: %s [threads] [block_size] [MC,KC,NC]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sweep.threads > 0) num_threads = sweep.threads;
+    if (sweep.block_size > 0) block_size = sweep.block_size;
+    if (sweep.mc > 0) set_blocking(sweep.mc, sweep.kc, sweep.nc);
+    
     printf("Running with %d threads and block size %d\n", num_threads, block_size);
+    const ukernel_t *uk = get_ukernel();
+    if (uk != NULL) {
+        cache_sizes_t cs = detect_cache_sizes();
+        blocking_t bp = get_blocking(uk);
+        printf("Micro-kernel: %s (%dx%d), caches L1d %ld KB, L2 %ld KB, L3 %ld KB\n",
+               uk->name, uk->mr, uk->nr, cs.l1d / 1024, cs.l2 / 1024, cs.l3 / 1024);
+        printf("Packed blocking: MC=%d KC=%d NC=%d\n", bp.mc, bp.kc, bp.nc);
+    } else {
+        printf("Micro-kernel: none (scalar fallback)\n");
+    }
     
-    // Matrix sizes to test
-    int sizes[] = {10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 200, 300, 400};
-    int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    printf("Matrix arena: %s\n", matrix_arena_backing());
+    
+    // Optional worker pinning and NUMA placement: GEMM_AFFINITY=compact|scatter
+    if (set_affinity_policy(getenv("GEMM_AFFINITY")) != 0) {
+        fprintf(stderr, "Unknown GEMM_AFFINITY policy (use compact, scatter or none)\n");
+        return 1;
+    }
+    int affinity_cpus, numa_nodes;
+    affinity_policy_t affinity = get_affinity_policy(&affinity_cpus, &numa_nodes);
+    if (affinity != AFFINITY_NONE) {
+        printf("Affinity: %s over %d CPUs on %d NUMA node(s)\n", (affinity == AFFINITY_COMPACT) ? "compact" : "scatter",
+               affinity_cpus, numa_nodes);
+    }
     
-    // Implementation variant names
-    const char *func_names[] = {"Original MNK", "Blocked MNK", "Multithreaded MNK", "MT+Blocked MNK"};
-    int num_funcs = sizeof(func_names) / sizeof(func_names[0]);
+    // Start the worker pool up front so thread creation isn't counted in the first timed run
+    get_gemm_pool(num_threads);
+    set_gemm_threads(num_threads);
+    set_setup_threads(num_threads);
     
-    // Create results CSV file
-    FILE *results_file = fopen("mnk_optimized_times.csv", "w");
-    if (results_file == NULL) {
+    const bench_variant_t *variants = bench_variants;
+    int num_variants = NUM_BENCH_VARIANTS;
+    bench_config_t bench_cfg = bench_config_from_env();
+    
+    // --variants picks a subset by name; the batch buffers and typed copies are only made if something uses them
+    const char *variant_names[NUM_BENCH_VARIANTS];
+    int need_batch = 0, need_typed = 0;
+    for (int v = 0; v < num_variants; v++) {
+        variant_names[v] = variants[v].name;
+        if (sweep_variant_selected(&sweep, variants[v].name)) {
+            need_batch |= (variants[v].batch > 1);
+            need_typed |= (variants[v].typed_fn != NULL);
+        }
+    }
+    if (sweep_check_variants(&sweep, variant_names, num_variants) != 0) {
+        return 1;
+    }
+    
+    // Create results CSV file (median times, read by Opt.py) and the per-variant statistics
+    const char *results_path = (sweep.output[0] != '\0') ? sweep.output : "mnk_optimized_times.csv";
+    char stats_path[SWEEP_MAX_PATH + 16];
+    sweep_stats_path(results_path, stats_path, sizeof(stats_path));
+    FILE *results_file = fopen(results_path, "w");
+    FILE *stats_file = fopen(stats_path, "w");
+    if (results_file == NULL || stats_file == NULL) {
         fprintf(stderr, "Error opening results file\n");
         return 1;
     }
+    bench_write_stats_header(stats_file);
+    perf_write_header_columns(stats_file);
+    memprof_write_header_columns(stats_file);
+    fprintf(stats_file, "\n");
+    
+    // JSON lines (--json): environment, settings and every sample, appended to the history file
+    bench_json_t json = {0};
+    if (sweep.json[0] != '\0' && bench_json_open(&json, sweep.json, "OptGEMM") != 0) {
+        return 1;
+    }
+    bench_json_config_int(&json, "threads", num_threads);
+    bench_json_config_int(&json, "block_size", block_size);
+    if (uk != NULL) {
+        blocking_t bp = get_blocking(uk);
+        bench_json_config_str(&json, "ukernel", uk->name);
+        bench_json_config_int(&json, "mc", bp.mc);
+        bench_json_config_int(&json, "kc", bp.kc);
+        bench_json_config_int(&json, "nc", bp.nc);
+    } else {
+        bench_json_config_str(&json, "ukernel", "scalar");
+    }
+    bench_json_config_str(&json, "arena", matrix_arena_backing());
+    bench_json_config_str(&json, "affinity", getenv("GEMM_AFFINITY") ? getenv("GEMM_AFFINITY") : "none");
+    bench_json_config_int(&json, "warmup", bench_cfg.warmup);
+    bench_json_config_int(&json, "min_reps", bench_cfg.min_reps);
+    double *samples = (double *)malloc((size_t)bench_cfg.max_reps * sizeof(double));
+    if (samples == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    
+    // Optional hardware counters (GEMM_PERF=1), opened on the calling thread and every pool worker
+    perf_counters_t perf = {0};
+    int use_perf = 0;
+    if (perf_counters_requested()) {
+        pid_t tids[PERF_MAX_THREADS];
+        int num_tids = pool_thread_ids(get_gemm_pool(num_threads), tids);
+        int opened = perf_counters_open(&perf, tids, num_tids);
+        use_perf = (opened > 0);
+        printf("Performance counters: %d of %d events available on %d threads\n", opened, PERF_NUM_EVENTS, num_tids);
+    }
+    // Optional memory profile (GEMM_MEMPROF=1): the caller's stack, heap over all threads, page faults
+    int use_memprof = memprof_requested();
     
-    // Write CSV headers
-    fprintf(results_file, "Matrix Size");
-    for (int i = 0; i < num_funcs; i++) {
-        fprintf(results_file, ",%s", func_names[i]);
+    // Write CSV headers (M, N, K columns only when the sweep has rectangular shapes)
+    int rectangular = sweep_has_rectangular(&sweep);
+    fprintf(results_file, rectangular ? "Matrix Size,M,N,K" : "Matrix Size");
+    for (int i = 0; i < num_variants; i++) {
+        if (sweep_variant_selected(&sweep, variants[i].name)) {
+            fprintf(results_file, ",%s", variants[i].name);
+        }
     }
     fprintf(results_file, "\n");
     
-    // Run benchmarks for each matrix size
-    for (int s = 0; s < num_sizes; s++) {
-        int size = sizes[s];
-        int m = size, n = size, k = size;
+    // Run benchmarks for each shape
+    for (int s = 0; s < sweep.num_shapes; s++) {
+        int m = sweep.shapes[s].m, n = sweep.shapes[s].n, k = sweep.shapes[s].k;
+        int size = sweep_shape_size(sweep.shapes[s]);
         
-        printf("Testing matrices of size %d x %d...\n", size, size);
+        printf("Testing matrices of size %d x %d (k = %d)...\n", m, n, k);
         
         fprintf(results_file, "%d", size);
+        if (rectangular) {
+            fprintf(results_file, ",%d,%d,%d", m, n, k);
+        }
         
         // Allocate and initialize matrices
-        double *A, *B, *C;
-        init_matrices(m, n, k, &A, &B, &C);
+        bench_inputs_t in;
+        init_bench_inputs(&in, m, n, k, need_batch, need_typed);
+        gemm_bench_t bench = bench_for_inputs(&in, num_threads, block_size);
         
         // Benchmark implementations
-        
-        // 1. Original MNK
-        double total_time = 0.0;
-        for (int run = 0; run < NUM_RUNS; run++) {
-            reset_matrix_c(C, m, n);
-            double start_time = get_time();
-            mnk_gemm(m, n, k, A, B, C);
-            double end_time = get_time();
-            total_time += (end_time - start_time);
-        }
-        double mnk_time = total_time / NUM_RUNS;
-        fprintf(results_file, ",%.6f", mnk_time);
-        printf("  Original MNK: %.6f s\n", mnk_time);
-        
-        // 2. Blocked MNK
-        total_time = 0.0;
-        for (int run = 0; run < NUM_RUNS; run++) {
-            reset_matrix_c(C, m, n);
-            double start_time = get_time();
-            blocked_mnk_gemm(m, n, k, A, B, C, block_size);
-            double end_time = get_time();
-            total_time += (end_time - start_time);
-        }
-        double blocked_time = total_time / NUM_RUNS;
-        fprintf(results_file, ",%.6f", blocked_time);
-        printf("  Blocked MNK: %.6f s\n", blocked_time);
-        
-        // 3. Multithreaded MNK
-        total_time = 0.0;
-        for (int run = 0; run < NUM_RUNS; run++) {
-            reset_matrix_c(C, m, n);
-            double start_time = get_time();
-            mt_mnk_gemm(m, n, k, A, B, C, num_threads);
-            double end_time = get_time();
-            total_time += (end_time - start_time);
-        }
-        double mt_time = total_time / NUM_RUNS;
-        fprintf(results_file, ",%.6f", mt_time);
-        printf("  Multithreaded MNK: %.6f s\n", mt_time);
-        
-        // 4. Combined multithreaded and blocked MNK
-        total_time = 0.0;
-        for (int run = 0; run < NUM_RUNS; run++) {
-            reset_matrix_c(C, m, n);
-            double start_time = get_time();
-            mt_blocked_mnk_gemm(m, n, k, A, B, C, num_threads, block_size);
-            double end_time = get_time();
-            total_time += (end_time - start_time);
-        }
-        double mt_blocked_time = total_time / NUM_RUNS;
-        fprintf(results_file, ",%.6f", mt_blocked_time);
-        printf("  MT+Blocked MNK: %.6f s\n", mt_blocked_time);
+        for (int v = 0; v < num_variants; v++) {
+            if (!sweep_variant_selected(&sweep, variants[v].name)) {
+                continue;
+            }
+            bench.typed_fn = variants[v].typed_fn;
+            bench_stats_t st = bench_run_samples(&bench_cfg, variants[v].reset, variants[v].run, &bench, samples);
+            bench_scale_stats(&st, 1.0 / variants[v].batch);
+            for (int r = 0; r < st.reps; r++) {
+                samples[r] /= variants[v].batch;
+            }
+            
+            // Counters come from one extra, untimed pass over the same number of calls as a sample
+            double counters[PERF_NUM_EVENTS];
+            if (use_perf) {
+                perf_counters_measure(&perf, variants[v].reset, variants[v].run, &bench, st.inner, counters);
+                for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+                    if (counters[e] >= 0.0) counters[e] /= variants[v].batch;
+                }
+            }
+            // The memory profile from one more (for a batched variant, the whole batch)
+            memprof_result_t mem;
+            if (use_memprof) {
+                memprof_measure(variants[v].reset, variants[v].run, &bench, &mem);
+            }
+            
+            fprintf(results_file, ",%.9f", st.median);
+            bench_write_stats_row(stats_file, size, variants[v].name, &st, m, n, k);
+            perf_write_columns(stats_file, use_perf ? counters : NULL);
+            memprof_write_columns(stats_file, use_memprof ? &mem : NULL);
+            fprintf(stats_file, "\n");
+            bench_json_write_result(&json, variants[v].name, m, n, k, &st, samples, use_perf ? counters : NULL);
+            printf("  %s: %.6f s (min %.6f, +/- %.1f%%, %d runs), %.2f GFLOP/s\n", variants[v].name, st.median, st.min,
+                   100.0 * st.ci95 / st.mean, st.reps * st.inner, bench_gflops(m, n, k, st.median));
+            if (use_memprof) {
+                memprof_print(&mem);
+            }
+        }
         
         fprintf(results_file, "\n");
         fflush(results_file);
+        fflush(stats_file);
         
         // Free allocated memory
-        free_matrices(A, B, C);
+        free_bench_inputs(&in);
     }
     
     // Close file
     fclose(results_file);
+    fclose(stats_file);
+    bench_json_close(&json);
+    free(samples);
+    if (use_perf) {
+        perf_counters_close(&perf);
+    }
     
-    printf("\nBenchmarking complete. Results saved to mnk_optimized_times.csv\n");
+    printf("\nBenchmarking complete. Results saved to %s (statistics in %s)\n", results_path, stats_path);
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,199 @@
+/**
+ * Benchmark harness shared by GEMM.c and OptGEMM.c.
+ * The old loops averaged NUM_RUNS gettimeofday samples with no warmup. gettimeofday has
+ * microsecond resolution and can jump, which made the 10x10 to 30x30 rows pure noise. This
+ * times with CLOCK_MONOTONIC, does untimed warmup runs, and keeps sampling until the 95%
+ * confidence interval of the mean is narrow (or a time budget runs out). Then it reports
+ * min, median, mean and stddev.
+ *
+ * Calls shorter than min_sample are repeated inside one sample and divided out. Each sample
+ * still gets its own reset first, so a GEMM's C only accumulates within a sample.
+ *
+ * Every setting can be overridden from the environment:
+ *   BENCH_WARMUP, BENCH_MIN_REPS, BENCH_MAX_REPS, BENCH_TARGET_CI (relative, e.g. 0.02),
+ *   BENCH_MAX_SECONDS (timing budget per measurement)
+ */
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_WARMUP 1
+#define BENCH_DEFAULT_MIN_REPS 5
+#define BENCH_DEFAULT_MAX_REPS 1000
+#define BENCH_DEFAULT_TARGET_CI 0.02
+#define BENCH_DEFAULT_MAX_SECONDS 1.0
+#define BENCH_MIN_SAMPLE_SECONDS 20e-6
+#define BENCH_MAX_INNER (1 << 20)
+
+typedef void (*bench_fn)(void *ctx);
+
+typedef struct {
+    int warmup;           // untimed runs before sampling
+    int min_reps;         // always take at least this many samples
+    int max_reps;
+    double target_ci;     // stop once the 95% CI half-width is below this fraction of the mean
+    double max_seconds;   // ... or once this much time has gone into sampling
+    double min_sample;    // shorter calls are repeated inside one sample
+} bench_config_t;
+
+typedef struct {
+    int reps;             // samples taken
+    int inner;            // calls per sample
+    double min, median, mean, stddev;
+    double ci95;          // half-width of the 95% confidence interval of the mean
+} bench_stats_t;
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void bench_env_int(const char *name, int *value) {
+    const char *s = getenv(name);
+    if (s != NULL && atoi(s) >= 0) {
+        *value = atoi(s);
+    }
+}
+
+static inline void bench_env_double(const char *name, double *value) {
+    const char *s = getenv(name);
+    if (s != NULL && atof(s) > 0.0) {
+        *value = atof(s);
+    }
+}
+
+/**
+ * Default configuration with any BENCH_* environment overrides applied.
+ */
+static inline bench_config_t bench_config_from_env(void) {
+    bench_config_t cfg = {BENCH_DEFAULT_WARMUP, BENCH_DEFAULT_MIN_REPS, BENCH_DEFAULT_MAX_REPS,
+                          BENCH_DEFAULT_TARGET_CI, BENCH_DEFAULT_MAX_SECONDS, BENCH_MIN_SAMPLE_SECONDS};
+    bench_env_int("BENCH_WARMUP", &cfg.warmup);
+    bench_env_int("BENCH_MIN_REPS", &cfg.min_reps);
+    bench_env_int("BENCH_MAX_REPS", &cfg.max_reps);
+    bench_env_double("BENCH_TARGET_CI", &cfg.target_ci);
+    bench_env_double("BENCH_MAX_SECONDS", &cfg.max_seconds);
+    if (cfg.min_reps < 1) cfg.min_reps = 1;
+    if (cfg.max_reps < cfg.min_reps) cfg.max_reps = cfg.min_reps;
+    return cfg;
+}
+
+static inline int bench_compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline void bench_mean_stddev(const double *samples, int count, double *mean, double *stddev) {
+    double sum = 0.0, sq = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    *mean = sum / count;
+    for (int i = 0; i < count; i++) {
+        sq += (samples[i] - *mean) * (samples[i] - *mean);
+    }
+    *stddev = (count > 1) ? sqrt(sq / (count - 1)) : 0.0;
+}
+
+/**
+ * Times body(ctx). reset(ctx), which may be NULL, runs untimed before every sample.
+ * If samples_out isn't NULL it gets the per-call time of every sample in the order they were
+ * taken (room for cfg->max_reps), e.g. for the JSON output.
+ */
+static inline bench_stats_t bench_run_samples(const bench_config_t *cfg, bench_fn reset, bench_fn body, void *ctx,
+                                              double *samples_out) {
+    bench_stats_t st = {0, 1, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+    for (int w = 0; w < cfg->warmup; w++) {
+        if (reset) reset(ctx);
+        body(ctx);
+    }
+
+    // One calibration call decides how many calls it takes to get above the timer noise
+    if (reset) reset(ctx);
+    double t0 = bench_now();
+    body(ctx);
+    double single = bench_now() - t0;
+    if (single < cfg->min_sample) {
+        double inner = (single > 0.0) ? ceil(cfg->min_sample / single) : BENCH_MAX_INNER;
+        st.inner = (inner < BENCH_MAX_INNER) ? (int)inner : BENCH_MAX_INNER;
+    }
+
+    double *samples = (double *)malloc((size_t)cfg->max_reps * sizeof(double));
+    if (samples == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+
+    double spent = 0.0;
+    while (st.reps < cfg->max_reps) {
+        if (reset) reset(ctx);
+        double start = bench_now();
+        for (int i = 0; i < st.inner; i++) {
+            body(ctx);
+        }
+        double elapsed = bench_now() - start;
+        samples[st.reps++] = elapsed / st.inner;
+        spent += elapsed;
+
+        if (st.reps >= cfg->min_reps) {
+            bench_mean_stddev(samples, st.reps, &st.mean, &st.stddev);
+            st.ci95 = 1.96 * st.stddev / sqrt((double)st.reps);
+            if (st.ci95 <= cfg->target_ci * st.mean || spent >= cfg->max_seconds) {
+                break;
+            }
+        }
+    }
+
+    bench_mean_stddev(samples, st.reps, &st.mean, &st.stddev);
+    st.ci95 = 1.96 * st.stddev / sqrt((double)st.reps);
+    if (samples_out != NULL) {
+        memcpy(samples_out, samples, (size_t)st.reps * sizeof(double));
+    }
+    qsort(samples, st.reps, sizeof(double), bench_compare_doubles);
+    st.min = samples[0];
+    st.median = (st.reps % 2) ? samples[st.reps / 2] : 0.5 * (samples[st.reps / 2 - 1] + samples[st.reps / 2]);
+    free(samples);
+    return st;
+}
+
+static inline bench_stats_t bench_run(const bench_config_t *cfg, bench_fn reset, bench_fn body, void *ctx) {
+    return bench_run_samples(cfg, reset, body, ctx, NULL);
+}
+
+// Rescales every time in st, e.g. to per-matrix times for a batched call
+static inline void bench_scale_stats(bench_stats_t *st, double factor) {
+    st->min *= factor;
+    st->median *= factor;
+    st->mean *= factor;
+    st->stddev *= factor;
+    st->ci95 *= factor;
+}
+
+static inline double bench_gflops(int m, int n, int k, double seconds) {
+    return (seconds > 0.0) ? 2.0 * m * n * k / seconds * 1e-9 : 0.0;
+}
+
+/**
+ * Long-format stats CSV (one row per shape and implementation), next to the wide times CSV
+ * the plotting scripts read. Matrix Size is the square-equivalent size (see sweep_shape_size)
+ * and M, N, K the actual shape. GFLOP/s is computed from the median.
+ * Neither function ends the line, so callers can append more columns (e.g. perf counters).
+ */
+static inline void bench_write_stats_header(FILE *f) {
+    fprintf(f, "Matrix Size,M,N,K,Implementation,Reps,Inner,Min,Median,Mean,Stddev,CI95,GFLOPS");
+}
+
+static inline void bench_write_stats_row(FILE *f, int size, const char *name, const bench_stats_t *st,
+                                         int m, int n, int k) {
+    fprintf(f, "%d,%d,%d,%d,%s,%d,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.3f", size, m, n, k, name, st->reps, st->inner, st->min,
+            st->median, st->mean, st->stddev, st->ci95, bench_gflops(m, n, k, st->median));
+}
+
+#endif
@@ -0,0 +1,255 @@
+/**
+ * JSON lines benchmark output shared by GEMM.c and OptGEMM.c (--json FILE).
+ * The CSVs only say size and seconds, so results from two machines (or two builds) can't be
+ * told apart. Every line written here is one self-contained result: an environment
+ * fingerprint (host, CPU, kernel, compiler and flags, git revision), the program's settings
+ * (threads, block size, ...), the shape, the summary statistics, every timed sample and the
+ * perf counters when they were on.
+ *
+ * The file is opened for appending, so it doubles as the results history that
+ * check_regressions.py compares new runs against. All lines from one process share a run_id.
+ *
+ * Build-time details the binary can't see for itself come in as string macros, e.g.
+ *   -DBENCH_CFLAGS="\"-O3 -march=native\"" -DBENCH_GIT_REV="\"$(git rev-parse HEAD)\""
+ * Without BENCH_GIT_REV the revision is asked from git at startup (empty outside a checkout).
+ */
+#ifndef BENCH_JSON_H
+#define BENCH_JSON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "bench_harness.h"
+#include "perf_counters.h"
+
+#define BENCH_JSON_SCHEMA 1
+#define BENCH_JSON_MAX_ENV 4096
+#define BENCH_JSON_MAX_CONFIG 2048
+
+typedef struct {
+    FILE *f;
+    char run_id[64];
+    char env[BENCH_JSON_MAX_ENV];         // "env" object, built once
+    char config[BENCH_JSON_MAX_CONFIG];   // "config" members, added by the program
+    size_t config_len;
+} bench_json_t;
+
+// Appends s to out as a JSON string (quotes included), truncating at size
+static inline void bench_json_string(char *out, size_t size, const char *s) {
+    size_t len = strlen(out);
+    if (len + 3 > size) {
+        return;
+    }
+    out[len++] = '"';
+    for (; *s != '\0' && len + 8 < size; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[len++] = '\\';
+            out[len++] = (char)c;
+        } else if (c < 0x20) {
+            len += (size_t)snprintf(out + len, size - len, "\\u%04x", c);
+        } else {
+            out[len++] = (char)c;
+        }
+    }
+    out[len++] = '"';
+    out[len] = '\0';
+}
+
+static inline void bench_json_member(char *out, size_t size, const char *key, const char *value) {
+    size_t len = strlen(out);
+    snprintf(out + len, size - len, "%s\"%s\":", (len > 1) ? "," : "", key);
+    bench_json_string(out, size, value);
+}
+
+// First line of a command's output, without the newline ("" if it fails)
+static inline void bench_json_command(const char *cmd, char *out, size_t size) {
+    out[0] = '\0';
+    FILE *p = popen(cmd, "r");
+    if (p == NULL) {
+        return;
+    }
+    if (fgets(out, (int)size, p) == NULL) {
+        out[0] = '\0';
+    }
+    out[strcspn(out, "\r\n")] = '\0';
+    pclose(p);
+}
+
+static inline void bench_json_cpu_model(char *out, size_t size) {
+    snprintf(out, size, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "model name", 10) == 0 && strchr(line, ':') != NULL) {
+            const char *v = strchr(line, ':') + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            snprintf(out, size, "%s", v);
+            out[strcspn(out, "\r\n")] = '\0';
+            break;
+        }
+    }
+    fclose(f);
+}
+
+// Compile-time ISA and optimisation switches actually in effect, whatever the flags were
+static inline const char* bench_json_features(void) {
+    return ""
+#ifdef __OPTIMIZE__
+        "optimize "
+#endif
+#ifdef __FAST_MATH__
+        "fast-math "
+#endif
+#ifdef __AVX512F__
+        "avx512f "
+#endif
+#ifdef __AVX2__
+        "avx2 "
+#endif
+#ifdef __FMA__
+        "fma "
+#endif
+#ifdef __SSE2__
+        "sse2 "
+#endif
+        "";
+}
+
+static inline void bench_json_build_env(bench_json_t *j, const char *program) {
+    char buf[512];
+    char *env = j->env;
+    snprintf(env, BENCH_JSON_MAX_ENV, "{");
+
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "program", program);
+    if (gethostname(buf, sizeof(buf)) != 0) {
+        snprintf(buf, sizeof(buf), "unknown");
+    }
+    buf[sizeof(buf) - 1] = '\0';
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "host", buf);
+    bench_json_cpu_model(buf, sizeof(buf));
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "cpu", buf);
+    size_t len = strlen(env);
+    snprintf(env + len, BENCH_JSON_MAX_ENV - len, ",\"cpus\":%ld", sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct utsname u;
+    if (uname(&u) == 0) {
+        snprintf(buf, sizeof(buf), "%s %s %s", u.sysname, u.release, u.machine);
+        bench_json_member(env, BENCH_JSON_MAX_ENV, "kernel", buf);
+    }
+#ifdef __VERSION__
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "compiler", __VERSION__);
+#endif
+#ifdef BENCH_CFLAGS
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "cflags", BENCH_CFLAGS);
+#else
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "cflags", "");
+#endif
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "features", bench_json_features());
+
+#ifdef BENCH_GIT_REV
+    snprintf(buf, sizeof(buf), "%s", BENCH_GIT_REV);
+#else
+    bench_json_command("git rev-parse HEAD 2>/dev/null", buf, sizeof(buf));
+#endif
+    bench_json_member(env, BENCH_JSON_MAX_ENV, "git_rev", buf);
+    bench_json_command("git status --porcelain --untracked-files=no 2>/dev/null | head -n 1", buf, sizeof(buf));
+    len = strlen(env);
+    snprintf(env + len, BENCH_JSON_MAX_ENV - len, ",\"git_dirty\":%s}", (buf[0] != '\0') ? "true" : "false");
+}
+
+/**
+ * Opens path for appending and fingerprints the environment. Returns 0, or -1 if the file
+ * can't be opened (j->f is then NULL and the write functions do nothing).
+ */
+static inline int bench_json_open(bench_json_t *j, const char *path, const char *program) {
+    memset(j, 0, sizeof(*j));
+    j->f = fopen(path, "a");
+    if (j->f == NULL) {
+        fprintf(stderr, "Cannot open JSON output %s\n", path);
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &utc);
+    snprintf(j->run_id, sizeof(j->run_id), "%s-%ld", stamp, (long)getpid());
+
+    bench_json_build_env(j, program);
+    return 0;
+}
+
+static inline void bench_json_close(bench_json_t *j) {
+    if (j->f != NULL) {
+        fclose(j->f);
+        j->f = NULL;
+    }
+}
+
+/**
+ * Adds a setting to the "config" object written with every result.
+ */
+static inline void bench_json_config_int(bench_json_t *j, const char *key, long value) {
+    j->config_len += (size_t)snprintf(j->config + j->config_len, BENCH_JSON_MAX_CONFIG - j->config_len,
+                                      "%s\"%s\":%ld", j->config_len ? "," : "", key, value);
+    if (j->config_len >= BENCH_JSON_MAX_CONFIG) j->config_len = BENCH_JSON_MAX_CONFIG - 1;
+}
+
+static inline void bench_json_config_str(bench_json_t *j, const char *key, const char *value) {
+    char member[512] = "{";
+    bench_json_member(member, sizeof(member), key, value);
+    j->config_len += (size_t)snprintf(j->config + j->config_len, BENCH_JSON_MAX_CONFIG - j->config_len,
+                                      "%s%s", j->config_len ? "," : "", member + 1);
+    if (j->config_len >= BENCH_JSON_MAX_CONFIG) j->config_len = BENCH_JSON_MAX_CONFIG - 1;
+}
+
+/**
+ * Writes one result line. samples are the per-call times from bench_run_samples (may be
+ * NULL), counters the per-call perf values (NULL when counters are off).
+ */
+static inline void bench_json_write_result(bench_json_t *j, const char *variant, int m, int n, int k,
+                                           const bench_stats_t *st, const double *samples, const double *counters) {
+    if (j->f == NULL) {
+        return;
+    }
+    char name[256] = "";
+    bench_json_string(name, sizeof(name), variant);
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    fprintf(j->f, "{\"schema\":%d,\"run_id\":\"%s\",\"time\":\"%s\",\"env\":%s,\"config\":{%s},", BENCH_JSON_SCHEMA,
+            j->run_id, stamp, j->env, j->config);
+    fprintf(j->f, "\"variant\":%s,\"m\":%d,\"n\":%d,\"k\":%d,", name, m, n, k);
+    fprintf(j->f, "\"stats\":{\"reps\":%d,\"inner\":%d,\"min\":%.9e,\"median\":%.9e,\"mean\":%.9e,\"stddev\":%.9e,"
+                  "\"ci95\":%.9e,\"gflops\":%.3f},", st->reps, st->inner, st->min, st->median, st->mean, st->stddev,
+            st->ci95, bench_gflops(m, n, k, st->median));
+
+    fprintf(j->f, "\"samples\":[");
+    for (int i = 0; samples != NULL && i < st->reps; i++) {
+        fprintf(j->f, "%s%.9e", i ? "," : "", samples[i]);
+    }
+    fprintf(j->f, "],\"counters\":{");
+    int first = 1;
+    for (int e = 0; counters != NULL && e < PERF_NUM_EVENTS; e++) {
+        if (counters[e] >= 0.0) {
+            fprintf(j->f, "%s\"%s\":%.0f", first ? "" : ",", perf_event_names[e], counters[e]);
+            first = 0;
+        }
+    }
+    fprintf(j->f, "}}\n");
+    fflush(j->f);
+}
+
+#endif
@@ -0,0 +1,116 @@
+import argparse
+import json
+import os
+import statistics
+import sys
+
+def result_key(record):
+    """
+    What has to match for two results to be comparable: the program, the machine, the
+    settings and the shape. Compiler and git revision are what's being tested, so they're left out.
+    """
+    env = record.get('env', {})
+    config = record.get('config', {})
+    return (env.get('program'), env.get('host'), env.get('cpu'),
+            json.dumps(config, sort_keys=True), record.get('variant'),
+            record.get('m'), record.get('n'), record.get('k'))
+
+def load_history(history_file):
+    """
+    Read the JSON lines history written by GEMM / OptGEMM --json, skipping anything malformed.
+
+    Returns:
+        list of records in file order, and the run ids in the order they first appear
+    """
+    records, run_ids = [], []
+    with open(history_file) as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            try:
+                record = json.loads(line)
+            except json.JSONDecodeError:
+                print(f"Warning: skipping malformed line {line_number}", file=sys.stderr)
+                continue
+            records.append(record)
+            if record.get('run_id') not in run_ids:
+                run_ids.append(record.get('run_id'))
+    return records, run_ids
+
+def find_regressions(records, run_id, window, threshold):
+    """
+    Compare every result of run_id with the same result in up to window earlier runs.
+    The baseline is the median of their medians. A result counts as a regression when it's
+    slower by more than threshold and by more than twice the relative 95% CI of either side,
+    so a noisy small size doesn't trip it.
+
+    Returns:
+        list of (record, baseline median, slowdown ratio, regressed) for run_id's results
+    """
+    earlier = {}
+    for record in records:
+        if record.get('run_id') == run_id:
+            break
+        earlier.setdefault(result_key(record), []).append(record)
+
+    results = []
+    for record in records:
+        if record.get('run_id') != run_id:
+            continue
+        history = earlier.get(result_key(record), [])[-window:]
+        if not history:
+            continue
+        baseline = statistics.median(r['stats']['median'] for r in history)
+        median = record['stats']['median']
+        if baseline <= 0.0 or median <= 0.0:
+            continue
+        noise = max([record['stats']['ci95'] / median] +
+                    [r['stats']['ci95'] / r['stats']['median'] for r in history if r['stats']['median'] > 0.0])
+        ratio = median / baseline
+        results.append((record, baseline, ratio, ratio - 1.0 > max(threshold, 2.0 * noise)))
+    return results
+
+def main():
+    parser = argparse.ArgumentParser(description='Check a GEMM benchmark run against the results history')
+    parser.add_argument('--history', '-f', default='bench_history.jsonl',
+                       help='JSON lines file written with --json (default: bench_history.jsonl)')
+    parser.add_argument('--run', '-r', default=None, help='Run id to check (default: the latest run)')
+    parser.add_argument('--window', '-w', type=int, default=5,
+                       help='How many earlier runs make up the baseline (default: 5)')
+    parser.add_argument('--threshold', '-t', type=float, default=0.05,
+                       help='Relative slowdown that counts as a regression (default: 0.05)')
+
+    args = parser.parse_args()
+
+    if not os.path.exists(args.history):
+        print(f"Error: history file '{args.history}' not found.")
+        print(f"Run e.g. ./OptGEMM --json {args.history} first.")
+        return 2
+
+    records, run_ids = load_history(args.history)
+    if not run_ids:
+        print("No results in the history file")
+        return 2
+    run_id = args.run if args.run is not None else run_ids[-1]
+    if run_id not in run_ids:
+        print(f"Error: run '{run_id}' is not in the history")
+        return 2
+
+    results = find_regressions(records, run_id, args.window, args.threshold)
+    if not results:
+        print(f"Run {run_id}: no earlier results with matching settings to compare against")
+        return 0
+
+    regressions = [r for r in results if r[3]]
+    print(f"Run {run_id}: {len(results)} results compared, {len(regressions)} regression(s)")
+    for record, baseline, ratio, regressed in sorted(results, key=lambda r: -r[2]):
+        shape = f"{record['m']}x{record['n']}x{record['k']}"
+        flag = 'REGRESSION' if regressed else ''
+        print(f"  {record['env'].get('program', ''):8s} {record['variant']:24s} {shape:>16s} "
+              f"{record['stats']['median']:.6e} s vs {baseline:.6e} s ({100.0 * (ratio - 1.0):+.1f}%) {flag}")
+
+    return 1 if regressions else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
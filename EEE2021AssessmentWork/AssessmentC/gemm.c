@@ -0,0 +1,2408 @@
+/**
+ * libgemm: thread pool, matrix setup, the packed and blocked kernels, dgemm_general,
+ * batched, Strassen, autotuning and the reduced-precision kernels. The public API is in
+ * gemm.h; the loop orderings live in gemm_loops.c. Everything not in gemm.h stays static.
+ */
+#define _GNU_SOURCE   // pthread_setaffinity_np, sched_getaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+#include "gemm.h"
+#include "matrix_arena.h"
+#include "bench_harness.h"
+#include "gemm_trace.h"
+
+typedef struct tile_sched tile_sched_t;
+
+// Thread argument structure
+typedef struct {
+    int thread_id;
+    int num_threads;
+    int m, n, k;
+    int block_size;
+    double *A;
+    double *B;
+    double *C;
+    tile_sched_t *sched;   // dynamic tile scheduler (MT+Blocked only)
+    const gemm_epilogue_t *ep;   // applied to each finished tile (MT+Blocked only, may be NULL)
+} thread_args_t;
+
+/**
+ * CPU affinity and NUMA placement for the pool workers (off unless GEMM_AFFINITY is set).
+ * "compact" fills one NUMA node before moving to the next, "scatter" deals workers
+ * round-robin across nodes so each socket's memory bandwidth gets used.
+ * With a policy set, init_matrices also places the matrices: the rows of A and C each
+ * worker owns in mt_mnk_thread are first touched by that worker, so they land on its
+ * node, and B (read by everyone) is interleaved across the nodes.
+ */
+#define MAX_AFFINITY_CPUS 1024
+#define MAX_NUMA_NODES 64
+
+static affinity_policy_t gemm_affinity = AFFINITY_NONE;
+static int affinity_cpus[MAX_AFFINITY_CPUS];  // worker t runs on affinity_cpus[t % affinity_num_cpus]
+static int affinity_num_cpus = 0;
+static int numa_nodes[MAX_NUMA_NODES];        // nodes that have at least one usable CPU
+static int numa_num_nodes = 0;
+
+// Parses a sysfs cpulist like "0-3,8-11" into a cpu_set_t
+static void parse_cpulist(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+            CPU_SET((int)c, set);
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+}
+
+/**
+ * Builds the worker -> CPU order for the policy from the NUMA topology in sysfs,
+ * restricted to the CPUs this process is allowed to run on.
+ */
+static void build_affinity_order(affinity_policy_t policy) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (int c = 0; c < sysconf(_SC_NPROCESSORS_ONLN) && c < CPU_SETSIZE; c++) {
+            CPU_SET(c, &allowed);
+        }
+    }
+
+    // Per-node CPU lists; a machine without the node directory is treated as one node
+    static int node_cpus[MAX_NUMA_NODES][MAX_AFFINITY_CPUS];
+    int node_count[MAX_NUMA_NODES] = {0};
+    numa_num_nodes = 0;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[64], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        if (fgets(line, sizeof(line), f) != NULL) {
+            cpu_set_t set;
+            parse_cpulist(line, &set);
+            int idx = numa_num_nodes;
+            for (int c = 0; c < CPU_SETSIZE && node_count[idx] < MAX_AFFINITY_CPUS; c++) {
+                if (CPU_ISSET(c, &set) && CPU_ISSET(c, &allowed)) {
+                    node_cpus[idx][node_count[idx]++] = c;
+                }
+            }
+            if (node_count[idx] > 0) {
+                numa_nodes[numa_num_nodes++] = node;
+            }
+        }
+        fclose(f);
+    }
+    if (numa_num_nodes == 0) {
+        numa_nodes[0] = 0;
+        numa_num_nodes = 1;
+        for (int c = 0; c < CPU_SETSIZE && node_count[0] < MAX_AFFINITY_CPUS; c++) {
+            if (CPU_ISSET(c, &allowed)) {
+                node_cpus[0][node_count[0]++] = c;
+            }
+        }
+    }
+
+    affinity_num_cpus = 0;
+    if (policy == AFFINITY_COMPACT) {
+        for (int nd = 0; nd < numa_num_nodes; nd++) {
+            for (int i = 0; i < node_count[nd] && affinity_num_cpus < MAX_AFFINITY_CPUS; i++) {
+                affinity_cpus[affinity_num_cpus++] = node_cpus[nd][i];
+            }
+        }
+    } else {
+        // Round-robin over the nodes, taking the next unused CPU of each in turn
+        for (int i = 0, added = 1; added && affinity_num_cpus < MAX_AFFINITY_CPUS; i++) {
+            added = 0;
+            for (int nd = 0; nd < numa_num_nodes && affinity_num_cpus < MAX_AFFINITY_CPUS; nd++) {
+                if (i < node_count[nd]) {
+                    affinity_cpus[affinity_num_cpus++] = node_cpus[nd][i];
+                    added = 1;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Sets the affinity policy by name ("compact", "scatter" or "none").
+ * Must be called before the pool is created. Returns -1 for an unknown name.
+ */
+int set_affinity_policy(const char *name) {
+    affinity_policy_t policy;
+    if (name == NULL || strcmp(name, "none") == 0) {
+        policy = AFFINITY_NONE;
+    } else if (strcmp(name, "compact") == 0) {
+        policy = AFFINITY_COMPACT;
+    } else if (strcmp(name, "scatter") == 0) {
+        policy = AFFINITY_SCATTER;
+    } else {
+        return -1;
+    }
+
+    gemm_affinity = policy;
+    if (policy != AFFINITY_NONE) {
+        build_affinity_order(policy);
+    }
+    return 0;
+}
+
+affinity_policy_t get_affinity_policy(int *num_cpus, int *num_nodes) {
+    if (num_cpus != NULL) *num_cpus = affinity_num_cpus;
+    if (num_nodes != NULL) *num_nodes = numa_num_nodes;
+    return gemm_affinity;
+}
+
+static void pin_worker(pthread_t thread, int worker_id) {
+    if (gemm_affinity == AFFINITY_NONE || affinity_num_cpus == 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(affinity_cpus[worker_id % affinity_num_cpus], &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/**
+ * The calling thread is worker 0 only while it's inside pool_run, so it's pinned for the
+ * job and then gets its own affinity back. Returns 1 if it was pinned (saved is then valid).
+ */
+static int pin_caller(int worker_id, cpu_set_t *saved) {
+    if (gemm_affinity == AFFINITY_NONE || affinity_num_cpus == 0 ||
+        pthread_getaffinity_np(pthread_self(), sizeof(*saved), saved) != 0) {
+        return 0;
+    }
+    pin_worker(pthread_self(), worker_id);
+    return 1;
+}
+
+static void unpin_caller(const cpu_set_t *saved) {
+    pthread_setaffinity_np(pthread_self(), sizeof(*saved), saved);
+}
+
+// How many times an idle worker polls for new work before going to sleep on the condition variable
+#define POOL_SPIN_ITERS 4000
+
+#define POOL_JOB_GENERATION(job) ((unsigned)((job) >> 32))
+#define POOL_JOB_WORKERS(job) ((int)((job) & 0xffffffffu))
+#define POOL_JOB(generation, workers) (((unsigned long long)(generation) << 32) | (unsigned)(workers))
+
+/**
+ * Persistent worker pool, created once and reused by every multithreaded call.
+ * Spawning and joining pthreads on every GEMM is what made the MT variants lose
+ * below ~40x40, so the workers now stay alive and wait for the next job.
+ * Worker t runs task(args[t]) for t = 1..workers-1, the calling thread runs args[0].
+ * A job can use fewer workers than the pool has, so different thread counts share one pool.
+ * Jobs from different calling threads take turns on run_lock.
+ */
+struct thread_pool {
+    pthread_t *threads;
+    pid_t *tids;               // kernel thread ids, filled in by each worker as it starts
+    atomic_int tids_ready;
+    int num_threads;           // total number of workers, including the calling thread
+    int cpu_offset;            // worker t is pinned like worker cpu_offset + t would be
+    int pin_caller;            // pin the pool_run caller as worker 0 (restored afterwards)
+    const char *trace_name;    // names the workers' lanes in the timeline trace
+    int spin_iters;            // 0 when oversubscribed, spinning would only steal the core
+    pool_task_fn task;
+    char *args;
+    size_t arg_size;
+    // Generation (bumped once per job, workers wait for it to change) in the top 32 bits and
+    // the job's worker count in the bottom 32. One word, so a worker that sits a job out can't
+    // pair this job's generation with the next job's count and run that one early
+    atomic_ullong job;
+    atomic_int remaining;      // workers still busy with the current job
+    uint64_t trace_posted;     // when the current job was published, if tracing (0 otherwise)
+    atomic_int shutdown;
+    pthread_mutex_t run_lock;  // held by pool_run for the whole job
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    struct thread_pool *retired;   // the shared pool this one replaced, kept running until exit
+};
+
+typedef struct {
+    thread_pool_t *pool;
+    int worker_id;
+} pool_worker_t;
+
+// Read without the lock on the fast path; only replaced (never freed) under gemm_pool_lock
+static _Atomic(thread_pool_t *) gemm_pool = NULL;
+static pthread_mutex_t gemm_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void* pool_worker_main(void *arg) {
+    pool_worker_t *self = (pool_worker_t *)arg;
+    thread_pool_t *pool = self->pool;
+    int id = self->worker_id;
+    free(self);
+    pool->tids[id] = (pid_t)syscall(SYS_gettid);
+    atomic_fetch_add_explicit(&pool->tids_ready, 1, memory_order_release);
+    trace_set_worker(pool->trace_name, id);
+
+    unsigned seen = 0;
+    for (;;) {
+        // Spin for a short while first, most jobs arrive back to back in the benchmark loops
+        unsigned long long job = atomic_load_explicit(&pool->job, memory_order_acquire);
+        for (int spin = 0; POOL_JOB_GENERATION(job) == seen && spin < pool->spin_iters; spin++) {
+            cpu_relax();
+            job = atomic_load_explicit(&pool->job, memory_order_acquire);
+        }
+
+        if (POOL_JOB_GENERATION(job) == seen) {
+            pthread_mutex_lock(&pool->lock);
+            while (POOL_JOB_GENERATION(job = atomic_load(&pool->job)) == seen && !atomic_load(&pool->shutdown)) {
+                pthread_cond_wait(&pool->wake, &pool->lock);
+            }
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        if (atomic_load(&pool->shutdown)) {
+            break;
+        }
+        seen = POOL_JOB_GENERATION(job);
+        if (id >= POOL_JOB_WORKERS(job)) {
+            continue;
+        }
+
+        uint64_t trace_start = trace_begin();
+        if (trace_start != 0 && pool->trace_posted != 0) {
+            trace_record(TRACE_DISPATCH, pool->trace_posted, trace_start, POOL_JOB_WORKERS(job), 0);
+        }
+        pool->task(pool->args + (size_t)id * pool->arg_size);
+        trace_end(TRACE_TASK, trace_start, POOL_JOB_WORKERS(job), 0);
+
+        // Last one out wakes the caller (the lock makes sure the signal can't be missed)
+        if (atomic_fetch_sub_explicit(&pool->remaining, 1, memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    return NULL;
+}
+
+thread_pool_t* pool_create(int num_threads) {
+    return pool_create_on(num_threads, 0, 1, "pool");
+}
+
+thread_pool_t* pool_create_on(int num_threads, int cpu_offset, int pin_caller, const char *trace_name) {
+    thread_pool_t *pool = (thread_pool_t *)calloc(1, sizeof(thread_pool_t));
+    if (pool == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pool->num_threads = num_threads;
+    pool->cpu_offset = (cpu_offset > 0) ? cpu_offset : 0;
+    pool->pin_caller = pin_caller;
+    pool->trace_name = trace_name;
+    pool->spin_iters = (cores > 0 && num_threads > cores) ? 0 : POOL_SPIN_ITERS;
+    atomic_init(&pool->job, POOL_JOB(0, 0));
+    atomic_init(&pool->remaining, 0);
+    atomic_init(&pool->shutdown, 0);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    pool->tids = (pid_t *)calloc(num_threads, sizeof(pid_t));
+    atomic_init(&pool->tids_ready, 0);
+    if (pool->threads == NULL || pool->tids == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+
+    // Worker 0 is the calling thread, so only num_threads - 1 pthreads are created
+    for (int t = 1; t < num_threads; t++) {
+        pool_worker_t *worker = (pool_worker_t *)malloc(sizeof(pool_worker_t));
+        if (worker == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        worker->pool = pool;
+        worker->worker_id = t;
+        pthread_create(&pool->threads[t], NULL, pool_worker_main, worker);
+        pin_worker(pool->threads[t], pool->cpu_offset + t);
+    }
+    trace_set_worker(pool->trace_name, 0);
+
+    return pool;
+}
+
+void pool_destroy(thread_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->shutdown, 1);
+    atomic_store(&pool->job, POOL_JOB(POOL_JOB_GENERATION(atomic_load(&pool->job)) + 1, 0));
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 1; t < pool->num_threads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->run_lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->tids);
+    free(pool);
+}
+
+/**
+ * Runs task(args[t]) on the first num_workers workers and returns once they have all finished.
+ * args points at num_workers consecutive structs of arg_size bytes. A task must not start
+ * another job on the same pool.
+ */
+void pool_run(thread_pool_t *pool, int num_workers, pool_task_fn task, void *args, size_t arg_size) {
+    if (num_workers > pool->num_threads) {
+        num_workers = pool->num_threads;
+    }
+    if (num_workers <= 1) {
+        uint64_t trace_start = trace_begin();
+        task(args);
+        trace_end(TRACE_TASK, trace_start, 1, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->run_lock);
+    pool->task = task;
+    pool->args = (char *)args;
+    pool->arg_size = arg_size;
+    atomic_store_explicit(&pool->remaining, num_workers - 1, memory_order_relaxed);
+    pool->trace_posted = trace_begin();
+
+    // Publish the job, then wake anyone who already went to sleep
+    unsigned next = POOL_JOB_GENERATION(atomic_load_explicit(&pool->job, memory_order_relaxed)) + 1;
+    atomic_store_explicit(&pool->job, POOL_JOB(next, num_workers), memory_order_release);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    // The calling thread does its share instead of sitting idle
+    cpu_set_t caller_cpus;
+    int caller_pinned = pool->pin_caller && pin_caller(pool->cpu_offset, &caller_cpus);
+    uint64_t trace_start = trace_begin();
+    task(args);
+    trace_end(TRACE_TASK, trace_start, num_workers, 0);
+
+    uint64_t trace_wait = trace_begin();
+    for (int spin = 0; atomic_load_explicit(&pool->remaining, memory_order_acquire) > 0 && spin < pool->spin_iters; spin++) {
+        cpu_relax();
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load_explicit(&pool->remaining, memory_order_acquire) > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (caller_pinned) {
+        unpin_caller(&caller_cpus);
+    }
+    pthread_mutex_unlock(&pool->run_lock);
+    trace_end(TRACE_WAIT, trace_wait, num_workers, 0);
+}
+
+/**
+ * Writes the kernel thread id of every worker to tids (0 for worker 0, meaning the calling
+ * thread, which is how perf_event_open spells it). Returns the number of workers.
+ */
+int pool_thread_ids(thread_pool_t *pool, pid_t *tids) {
+    while (atomic_load_explicit(&pool->tids_ready, memory_order_acquire) < pool->num_threads - 1) {
+        cpu_relax();
+    }
+    tids[0] = 0;
+    for (int t = 1; t < pool->num_threads; t++) {
+        tids[t] = pool->tids[t];
+    }
+    return pool->num_threads;
+}
+
+static void gemm_pool_shutdown(void) {
+    thread_pool_t *pool = atomic_exchange(&gemm_pool, NULL);
+    while (pool != NULL) {
+        thread_pool_t *older = pool->retired;
+        pool_destroy(pool);
+        pool = older;
+    }
+}
+
+/**
+ * Returns the shared pool with at least num_threads workers, only replacing it when it has to grow.
+ * Another thread may still be running a job on the pool being replaced (or be about to, with
+ * the pointer it got earlier), so the old one isn't torn down: it sleeps until exit.
+ */
+thread_pool_t* get_gemm_pool(int num_threads) {
+    thread_pool_t *pool = atomic_load_explicit(&gemm_pool, memory_order_acquire);
+    if (pool != NULL && pool->num_threads >= num_threads) {
+        return pool;
+    }
+
+    pthread_mutex_lock(&gemm_pool_lock);
+    pool = atomic_load_explicit(&gemm_pool, memory_order_relaxed);
+    if (pool == NULL || pool->num_threads < num_threads) {
+        if (pool == NULL) {
+            atexit(gemm_pool_shutdown);
+            trace_from_env();
+        }
+        thread_pool_t *grown = pool_create(num_threads);
+        grown->retired = pool;
+        atomic_store_explicit(&gemm_pool, grown, memory_order_release);
+        pool = grown;
+    }
+    pthread_mutex_unlock(&gemm_pool_lock);
+    return pool;
+}
+
+double get_time(void) { // Monotonic clock from the benchmark harness
+    return bench_now();
+}
+
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+/**
+ * Counter-based RNG for the matrix fill.
+ * Element i of a matrix is splitmix64(key + i * golden), so each worker can generate its
+ * own range with no shared state (rand() takes a libc lock on every call), and the values
+ * don't depend on how many threads did the fill.
+ */
+#define SPLITMIX_GOLDEN 0x9E3779B97F4A7C15ULL
+
+// Below this many elements the setup loops stay on the calling thread
+#define SETUP_PARALLEL_MIN (1 << 15)
+// C bigger than this is zeroed with streaming stores, it won't fit in cache anyway
+#define RESET_STREAM_MIN_BYTES (32L * 1024 * 1024)
+
+static uint64_t matrix_seed = 0x853C49E6748FEA9BULL;
+static uint64_t matrix_stream = 0;   // bumped per matrix so A, B and every size differ
+static int setup_threads = 1;        // workers used by init_matrices and reset_matrix_c
+
+void set_matrix_seed(uint64_t seed) {
+    matrix_seed = seed;
+    matrix_stream = 0;
+}
+
+void set_setup_threads(int num_threads) {
+    setup_threads = (num_threads > 0) ? num_threads : 1;
+}
+
+static inline uint64_t splitmix64(uint64_t x) {
+    x += SPLITMIX_GOLDEN;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t next_matrix_key(void) {
+    return splitmix64(matrix_seed ^ splitmix64(matrix_stream++));
+}
+
+// Elements [first, first + count) of the stream for key, as doubles in [0, 1)
+void fill_uniform(double *dst, size_t count, uint64_t key, size_t first) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = (double)(splitmix64(key + (first + i) * SPLITMIX_GOLDEN) >> 11) * 0x1.0p-53;
+    }
+}
+
+// Zeroes count doubles, with non-temporal stores when stream is set
+static void zero_doubles(double *dst, size_t count, int stream) {
+#if defined(__x86_64__)
+    if (stream && ((uintptr_t)dst & 15) == 0) {
+        __m128d zero = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            _mm_stream_pd(&dst[i], zero);
+        }
+        for (; i < count; i++) {
+            dst[i] = 0.0;
+        }
+        _mm_sfence();
+        return;
+    }
+#endif
+    (void)stream;
+    memset(dst, 0, count * sizeof(double));
+}
+
+// Rows [start, end) of a rows-long matrix for one worker, the same split mt_mnk_thread uses
+static void thread_row_range(int rows, int thread_id, int num_threads, int *start, int *end) {
+    int rows_per_thread = (rows + num_threads - 1) / num_threads;
+    *start = thread_id * rows_per_thread;
+    *end = (*start + rows_per_thread < rows) ? *start + rows_per_thread : rows;
+    if (*start > rows) {
+        *start = rows;
+    }
+}
+
+typedef struct {
+    int thread_id;
+    int num_threads;
+    int m, n, k;
+    double *A;
+    double *B;
+    double *C;
+    uint64_t key_a, key_b;
+} init_args_t;
+
+/**
+ * Fills this worker's rows of A and B and zeroes its rows of C. With an affinity policy
+ * this is also the first touch, so each worker's rows of A and C land on its own node.
+ */
+static void* init_matrices_thread(void *arg) {
+    init_args_t *args = (init_args_t *)arg;
+    int start, end;
+
+    thread_row_range(args->m, args->thread_id, args->num_threads, &start, &end);
+    fill_uniform(&args->A[(size_t)start * args->k], (size_t)(end - start) * args->k, args->key_a, (size_t)start * args->k);
+    zero_doubles(&args->C[(size_t)start * args->n], (size_t)(end - start) * args->n, 0);
+
+    thread_row_range(args->k, args->thread_id, args->num_threads, &start, &end);
+    fill_uniform(&args->B[(size_t)start * args->n], (size_t)(end - start) * args->n, args->key_b, (size_t)start * args->n);
+    return NULL;
+}
+
+typedef struct {
+    int thread_id;
+    int num_threads;
+    int m, n;
+    int stream;
+    double *C;
+} reset_args_t;
+
+static void* reset_matrix_thread(void *arg) {
+    reset_args_t *args = (reset_args_t *)arg;
+    int start, end;
+    thread_row_range(args->m, args->thread_id, args->num_threads, &start, &end);
+    zero_doubles(&args->C[(size_t)start * args->n], (size_t)(end - start) * args->n, args->stream);
+    return NULL;
+}
+
+/**
+ * Drops the pages behind [p, p + bytes) so the next write faults them in again. Only for
+ * blocks in the arena mapping: the range is rounded out to whole pages, which for a
+ * posix_memalign fallback block could zero heap data sharing its first or last page.
+ */
+static void discard_pages(void *p, size_t bytes) {
+    if (!arena_owns(&matrix_arena, p)) {
+        return;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)p + bytes + page - 1) & ~(uintptr_t)(page - 1);
+    madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+/**
+ * Interleaves the pages of [p, p + bytes) over the usable NUMA nodes (raw mbind, no libnuma).
+ * Pages already faulted in are moved, new ones follow the policy when first touched.
+ */
+static void interleave_pages(void *p, size_t bytes) {
+#ifdef SYS_mbind
+    if (numa_num_nodes < 2) {
+        return;
+    }
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long)) + 1] = {0};
+    for (int i = 0; i < numa_num_nodes; i++) {
+        mask[numa_nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (numa_nodes[i] % (8 * sizeof(unsigned long)));
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(uintptr_t)(page - 1);
+    syscall(SYS_mbind, (void *)start, (uintptr_t)p + bytes - start, MPOL_INTERLEAVE, mask,
+            (unsigned long)(sizeof(mask) * 8), MPOL_MF_MOVE);
+#else
+    (void)p;
+    (void)bytes;
+#endif
+}
+
+/**
+ * Function to allocate and initialise matrices
+ * A and B get uniform values in [0, 1) from the counter-based RNG and C is zeroed, all on
+ * the pool once the matrices are big enough.
+ */
+void init_matrices(int m, int n, int k, double **A, double **B, double **C) {
+    // All three come from the matrix arena (64-byte aligned, huge-page backed, pages kept between sizes)
+    size_t a_bytes = (size_t)m * k * sizeof(double);
+    size_t b_bytes = (size_t)k * n * sizeof(double);
+    size_t c_bytes = (size_t)m * n * sizeof(double);
+    // NUMA placement works on whole pages, so each matrix then starts on its own huge page
+    int numa = (gemm_affinity != AFFINITY_NONE);
+    size_t align = numa ? ARENA_HUGE_PAGE_SIZE : ARENA_ALIGNMENT;
+    arena_reserve(&matrix_arena, a_bytes + b_bytes + c_bytes + 3 * align);
+    *A = (double *)arena_alloc_aligned(&matrix_arena, a_bytes, align);
+    *B = (double *)arena_alloc_aligned(&matrix_arena, b_bytes, align);
+    *C = (double *)arena_alloc_aligned(&matrix_arena, c_bytes, align);
+    
+    if (*A == NULL || *B == NULL || *C == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    
+    // The arena keeps its pages between sizes, so for NUMA placement they're dropped first,
+    // otherwise they'd stay wherever the previous size put them. B is read by every worker
+    // and gets interleaved instead.
+    if (numa) {
+        discard_pages(*A, a_bytes);
+        discard_pages(*C, c_bytes);
+        discard_pages(*B, b_bytes);
+        interleave_pages(*B, b_bytes);
+    }
+    
+    size_t elements = (size_t)m * k + (size_t)k * n + (size_t)m * n;
+    int num_threads = (numa || elements >= SETUP_PARALLEL_MIN) ? setup_threads : 1;
+    uint64_t key_a = next_matrix_key();
+    uint64_t key_b = next_matrix_key();
+    init_args_t args[num_threads];
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = (init_args_t){t, num_threads, m, n, k, *A, *B, *C, key_a, key_b};
+    }
+    pool_run(get_gemm_pool(num_threads), num_threads, init_matrices_thread, args, sizeof(init_args_t));
+}
+
+/**
+ * Zeroes C before each timed run, split over the same rows as init_matrices so the pages
+ * stay with the worker that owns them.
+ */
+void reset_matrix_c(double *C, int m, int n) {
+    size_t count = (size_t)m * n;
+    int num_threads = (count >= SETUP_PARALLEL_MIN) ? setup_threads : 1;
+    int stream = (count * sizeof(double) >= (size_t)RESET_STREAM_MIN_BYTES);
+    reset_args_t args[num_threads];
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = (reset_args_t){t, num_threads, m, n, stream, C};
+    }
+    pool_run(get_gemm_pool(num_threads), num_threads, reset_matrix_thread, args, sizeof(reset_args_t));
+}
+
+// Hands the matrices back to the arena, which keeps the pages for the next size
+void free_matrices(double *A, double *B, double *C) {
+    arena_release(&matrix_arena, A);
+    arena_release(&matrix_arena, B);
+    arena_release(&matrix_arena, C);
+}
+
+// The arena is static to this file, so callers ask here rather than including matrix_arena.h
+const char* matrix_arena_backing(void) {
+    return arena_backing_name(&matrix_arena);
+}
+
+/**
+ * Scalar Blocked/Tiled MNK implementation (the original version of 2.)
+ * Still used when the CPU has no AVX2/AVX-512, and kept as its own benchmark column.
+ */
+void scalar_blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int block_size) {
+    // Iterate over 'blocks'
+    for (int i0 = 0; i0 < m; i0 += block_size) {
+        int i_bound = (i0 + block_size < m) ? i0 + block_size : m;
+        
+        for (int j0 = 0; j0 < n; j0 += block_size) {
+            int j_bound = (j0 + block_size < n) ? j0 + block_size : n;
+            
+            for (int p0 = 0; p0 < k; p0 += block_size) {
+                int p_bound = (p0 + block_size < k) ? p0 + block_size : k;
+                
+                // Compute within the block
+                for (int i = i0; i < i_bound; i++) {
+                    for (int j = j0; j < j_bound; j++) {
+                        for (int p = p0; p < p_bound; p++) {
+                            C[i*n + j] += A[i*k + p] * B[p*n + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Register-blocked micro-kernels.
+ * Each one computes an MR x NR block of C += Ap * Bp, where Ap is kc columns of MR packed
+ * A values and Bp is kc rows of NR packed B values. The whole C block stays in vector
+ * registers for the full kc loop, so C is only loaded and stored once per tile.
+ * Bp always points into a 64-byte aligned packed panel, so its loads are aligned; C can be anywhere.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+// AVX-512: 8 rows x 16 columns (two zmm per row) -> 16 accumulators
+__attribute__((target("avx512f")))
+static void ukernel_avx512_8x16(int kc, const double *Ap, const double *Bp, double *C, int ldc) {
+    __m512d c[8][2];
+    #pragma GCC unroll 8
+    for (int i = 0; i < 8; i++) {
+        c[i][0] = _mm512_loadu_pd(&C[i*ldc]);
+        c[i][1] = _mm512_loadu_pd(&C[i*ldc + 8]);
+    }
+
+    for (int p = 0; p < kc; p++) {
+        __m512d b0 = _mm512_load_pd(&Bp[p*16]);
+        __m512d b1 = _mm512_load_pd(&Bp[p*16 + 8]);
+        #pragma GCC unroll 8
+        for (int i = 0; i < 8; i++) {
+            __m512d a = _mm512_set1_pd(Ap[p*8 + i]);
+            c[i][0] = _mm512_fmadd_pd(a, b0, c[i][0]);
+            c[i][1] = _mm512_fmadd_pd(a, b1, c[i][1]);
+        }
+    }
+
+    #pragma GCC unroll 8
+    for (int i = 0; i < 8; i++) {
+        _mm512_storeu_pd(&C[i*ldc], c[i][0]);
+        _mm512_storeu_pd(&C[i*ldc + 8], c[i][1]);
+    }
+}
+
+// AVX2 + FMA: 6 rows x 8 columns (two ymm per row) -> 12 of the 16 ymm registers
+__attribute__((target("avx2,fma")))
+static void ukernel_avx2_6x8(int kc, const double *Ap, const double *Bp, double *C, int ldc) {
+    __m256d c[6][2];
+    #pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        c[i][0] = _mm256_loadu_pd(&C[i*ldc]);
+        c[i][1] = _mm256_loadu_pd(&C[i*ldc + 4]);
+    }
+
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_load_pd(&Bp[p*8]);
+        __m256d b1 = _mm256_load_pd(&Bp[p*8 + 4]);
+        #pragma GCC unroll 6
+        for (int i = 0; i < 6; i++) {
+            __m256d a = _mm256_broadcast_sd(&Ap[p*6 + i]);
+            c[i][0] = _mm256_fmadd_pd(a, b0, c[i][0]);
+            c[i][1] = _mm256_fmadd_pd(a, b1, c[i][1]);
+        }
+    }
+
+    #pragma GCC unroll 6
+    for (int i = 0; i < 6; i++) {
+        _mm256_storeu_pd(&C[i*ldc], c[i][0]);
+        _mm256_storeu_pd(&C[i*ldc + 4], c[i][1]);
+    }
+}
+#endif
+
+/**
+ * Plain C 4x4 micro-kernel, only used by the general dgemm entry point on CPUs without AVX2
+ * so strided/transposed calls still go through the packed path.
+ */
+static void ukernel_scalar_4x4(int kc, const double *Ap, const double *Bp, double *C, int ldc) {
+    double c[4][4] = {{0.0}};
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                c[i][j] += Ap[p*4 + i] * Bp[p*4 + j];
+            }
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            C[i*ldc + j] += c[i][j];
+        }
+    }
+}
+
+static const ukernel_t *selected_ukernel = NULL;
+static pthread_once_t ukernel_once = PTHREAD_ONCE_INIT;
+
+static void select_ukernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    static const ukernel_t avx512 = {"AVX-512", 8, 16, ukernel_avx512_8x16};
+    static const ukernel_t avx2 = {"AVX2", 6, 8, ukernel_avx2_6x8};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected_ukernel = &avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected_ukernel = &avx2;
+    }
+#endif
+}
+
+/**
+ * Picks the widest micro-kernel the CPU supports (checked once at runtime, from whichever
+ * thread asks first). Returns NULL when there is no SIMD kernel, callers then use the scalar loop.
+ */
+const ukernel_t* get_ukernel(void) {
+    pthread_once(&ukernel_once, select_ukernel);
+    return selected_ukernel;
+}
+
+/**
+ * Same as get_ukernel, but never NULL: falls back to the plain C kernel.
+ */
+const ukernel_t* get_ukernel_or_scalar(void) {
+    static const ukernel_t scalar = {"scalar", 4, 4, ukernel_scalar_4x4};
+    const ukernel_t *uk = get_ukernel();
+    return (uk != NULL) ? uk : &scalar;
+}
+
+/**
+ * Growable 64-byte aligned scratch buffer for the packed panels.
+ * Kept between calls so repeated GEMMs don't pay for malloc/free (and page faults) every time.
+ */
+typedef struct {
+    double *ptr;
+    size_t cap;   // capacity in doubles
+} scratch_t;
+
+static double* scratch_reserve(scratch_t *s, size_t count) {
+    if (count > s->cap) {
+        free(s->ptr);
+        if (posix_memalign((void **)&s->ptr, 64, count * sizeof(double)) != 0) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        s->cap = count;
+    }
+    return s->ptr;
+}
+
+// Each thread packs its own A blocks, the serial path also keeps its own B panel
+static __thread scratch_t a_scratch;
+static __thread scratch_t b_scratch;
+// Packed A chunk and B panel that every worker of one mt_packed_gemm job shares. They belong
+// to the calling thread, so MT calls from several threads each have their own
+static __thread scratch_t shared_a_scratch;
+static __thread scratch_t shared_b_scratch;
+
+static inline int round_up(int x, int multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+static inline int clamp_int(int x, int lo, int hi) {
+    return (x < lo) ? lo : (x > hi) ? hi : x;
+}
+
+/**
+ * GotoBLAS-style cache blocking for the packed path:
+ *  - KC: depth of a k-panel, sized so one KC x NR micro-panel of B stays in L1
+ *  - MC: rows of the packed MC x KC block of A, sized to sit in L2
+ *  - NC: columns of the packed KC x NC panel of B, sized to sit in L3
+ * The single block_size argument only applies to the scalar loops now.
+ */
+// Used when neither sysconf nor CPUID tells us anything
+#define FALLBACK_L1D_SIZE (32L * 1024)
+#define FALLBACK_L2_SIZE (256L * 1024)
+#define FALLBACK_L3_SIZE (8L * 1024 * 1024)
+
+/**
+ * Reads the data cache sizes from CPUID leaf 4 (deterministic cache parameters).
+ * Only fills in levels that are still unknown.
+ */
+static void cpuid_cache_sizes(cache_sizes_t *cs) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 4) {
+        return;
+    }
+    for (unsigned sub = 0; sub < 16; sub++) {
+        __cpuid_count(4, sub, eax, ebx, ecx, edx);
+        unsigned type = eax & 0x1f;   // 0 = no more caches, 1 = data, 2 = instruction, 3 = unified
+        if (type == 0) {
+            break;
+        }
+        if (type == 2) {
+            continue;
+        }
+        unsigned level = (eax >> 5) & 0x7;
+        long ways = ((ebx >> 22) & 0x3ff) + 1;
+        long partitions = ((ebx >> 12) & 0x3ff) + 1;
+        long line = (ebx & 0xfff) + 1;
+        long sets = (long)ecx + 1;
+        long size = ways * partitions * line * sets;
+        if (level == 1 && cs->l1d <= 0) cs->l1d = size;
+        if (level == 2 && cs->l2 <= 0) cs->l2 = size;
+        if (level == 3 && cs->l3 <= 0) cs->l3 = size;
+    }
+#else
+    (void)cs;
+#endif
+}
+
+cache_sizes_t detect_cache_sizes(void) {
+    cache_sizes_t cs = {0, 0, 0};
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    cs.l1d = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    cs.l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    cs.l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (cs.l1d <= 0 || cs.l2 <= 0 || cs.l3 <= 0) {
+        cpuid_cache_sizes(&cs);
+    }
+    if (cs.l1d <= 0) cs.l1d = FALLBACK_L1D_SIZE;
+    if (cs.l2 <= 0) cs.l2 = FALLBACK_L2_SIZE;
+    if (cs.l3 <= 0) cs.l3 = FALLBACK_L3_SIZE;
+    return cs;
+}
+
+/**
+ * Works out MC/KC/NC for a micro-kernel from the cache sizes.
+ * Each level gets half of its cache for the packed data, the rest is left for C and everything else.
+ */
+blocking_t compute_blocking(cache_sizes_t cs, int mr, int nr) {
+    blocking_t bp;
+    bp.kc = clamp_int((int)(cs.l1d / 2 / (nr * (long)sizeof(double))) / 8 * 8, 32, 1024);
+    bp.mc = clamp_int((int)(cs.l2 / 2 / (bp.kc * (long)sizeof(double))) / mr * mr, mr, 4096 / mr * mr);
+    bp.nc = clamp_int((int)(cs.l3 / 2 / (bp.kc * (long)sizeof(double))) / nr * nr, nr, 8192 / nr * nr);
+    return bp;
+}
+
+// set_blocking's override, and the blocking computed once for the default micro-kernel
+static blocking_t gemm_blocking = {0, 0, 0};
+static blocking_t detected_blocking;
+static pthread_once_t blocking_once = PTHREAD_ONCE_INIT;
+
+static void detect_blocking(void) {
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    detected_blocking = compute_blocking(detect_cache_sizes(), uk->mr, uk->nr);
+}
+
+/**
+ * Blocking used by the packed paths: the CLI override if one was set, otherwise computed
+ * from the detected caches (once for the default micro-kernel, every call for any other).
+ */
+blocking_t get_blocking(const ukernel_t *uk) {
+    if (gemm_blocking.mc > 0 && gemm_blocking.kc > 0 && gemm_blocking.nc > 0) {
+        return gemm_blocking;
+    }
+    if (uk != get_ukernel_or_scalar()) {
+        return compute_blocking(detect_cache_sizes(), uk->mr, uk->nr);
+    }
+    pthread_once(&blocking_once, detect_blocking);
+    return detected_blocking;
+}
+
+/**
+ * Overrides the blocking (MC is rounded up to whole A micro-panels when used).
+ */
+void set_blocking(int mc, int kc, int nc) {
+    gemm_blocking.mc = mc;
+    gemm_blocking.kc = kc;
+    gemm_blocking.nc = nc;
+}
+
+/**
+ * Packs an mb x kb block of A into MR-row micro-panels, scaling by alpha on the way.
+ * Element (i, p) is read from A[i*rsa + p*csa], so transposed and column-major inputs
+ * are handled here for free. Within a micro-panel the MR values of each column are
+ * contiguous, which is the order the micro-kernel broadcasts them. Short panels are zero padded.
+ */
+static void pack_a_block(int mb, int kb, double alpha, const double *A, int rsa, int csa, int mr, double *Ap) {
+    for (int i0 = 0; i0 < mb; i0 += mr) {
+        int rows = (i0 + mr < mb) ? mr : mb - i0;
+        for (int p = 0; p < kb; p++) {
+            for (int i = 0; i < rows; i++) {
+                Ap[p*mr + i] = alpha * A[(size_t)(i0 + i)*rsa + (size_t)p*csa];
+            }
+            for (int i = rows; i < mr; i++) {
+                Ap[p*mr + i] = 0.0;
+            }
+        }
+        Ap += mr * kb;
+    }
+}
+
+/**
+ * Packs NR-column micro-panels [panel_start, panel_end) of a kb x nb panel of B,
+ * element (p, j) at B[p*rsb + j*csb]. Each step of p then reads NR contiguous values
+ * instead of striding B by n. Taking a panel range lets the multithreaded path split
+ * the packing between workers.
+ */
+static void pack_b_panel(int kb, int nb, const double *B, int rsb, int csb, int nr,
+                         int panel_start, int panel_end, double *Bp) {
+    for (int jp = panel_start; jp < panel_end; jp++) {
+        int j0 = jp * nr;
+        int cols = (j0 + nr < nb) ? nr : nb - j0;
+        double *dst = Bp + (size_t)jp * nr * kb;
+        for (int p = 0; p < kb; p++) {
+            const double *src = &B[(size_t)p*rsb + (size_t)j0*csb];
+            if (csb == 1) {
+                memcpy(&dst[p*nr], src, cols * sizeof(double));
+            } else {
+                for (int j = 0; j < cols; j++) {
+                    dst[p*nr + j] = src[(size_t)j*csb];
+                }
+            }
+            for (int j = cols; j < nr; j++) {
+                dst[p*nr + j] = 0.0;
+            }
+        }
+    }
+}
+
+/**
+ * c = act(scale * c + bias[j]) over a finished rows x cols piece of C whose first column
+ * is column cj of the whole matrix.
+ */
+static void epilogue_ops(const gemm_epilogue_t *ep, int rows, int cols, double *C, int ldc, int cj) {
+    // One branch-free loop per op, so each one vectorises over the row
+    double scale = ep->scale;
+    const double *restrict bias = (ep->bias != NULL) ? &ep->bias[cj] : NULL;
+    for (int i = 0; i < rows; i++) {
+        double *restrict c = &C[(size_t)i*ldc];
+        if (bias != NULL) {
+            for (int j = 0; j < cols; j++) c[j] = scale * c[j] + bias[j];
+        } else if (scale != 1.0) {
+            for (int j = 0; j < cols; j++) c[j] *= scale;
+        }
+        if (ep->act == GEMM_ACT_RELU) {
+            for (int j = 0; j < cols; j++) c[j] = (c[j] > 0.0) ? c[j] : 0.0;
+        }
+    }
+}
+
+// The float copy of a finished piece of C starting at (ci, cj), if the epilogue has one
+static void epilogue_store(const gemm_epilogue_t *ep, int rows, int cols, const double *C, int ldc, int ci, int cj) {
+    if (ep->out == NULL) {
+        return;
+    }
+    for (int i = 0; i < rows; i++) {
+        const double *restrict c = &C[(size_t)i*ldc];
+        float *restrict o = &ep->out[(size_t)(ci + i)*ep->ldo + cj];
+        for (int j = 0; j < cols; j++) o[j] = (float)c[j];
+    }
+}
+
+static void apply_epilogue(const gemm_epilogue_t *ep, int rows, int cols, double *C, int ldc, int ci, int cj) {
+    epilogue_ops(ep, rows, cols, C, ldc, cj);
+    epilogue_store(ep, rows, cols, C, ldc, ci, cj);
+}
+
+/**
+ * Runs the micro-kernel over one packed mb x nb block of C.
+ * Edge tiles are computed into a small scratch block and then added to C,
+ * so the kernels themselves never need bounds checks.
+ * On the last k-panel ep is set and each micro-tile gets the epilogue ops straight after the
+ * kernel stores it, while it is still in L1; (ci, cj) is where C starts in the whole matrix.
+ * The float copy is made once the whole block is done, row by row: storing it per
+ * micro-tile scatters short writes over MR rows of out and came out slower.
+ */
+static void compute_packed_block(const ukernel_t *uk, int mb, int nb, int kb,
+                                 const double *Ap, const double *Bp, double *C, int ldc,
+                                 const gemm_epilogue_t *ep, int ci, int cj) {
+    int mr = uk->mr, nr = uk->nr;
+    double edge[16 * 16] __attribute__((aligned(64)));
+
+    for (int j0 = 0; j0 < nb; j0 += nr) {
+        int cols = (j0 + nr < nb) ? nr : nb - j0;
+        const double *Bpanel = Bp + (size_t)(j0 / nr) * nr * kb;
+
+        for (int i0 = 0; i0 < mb; i0 += mr) {
+            int rows = (i0 + mr < mb) ? mr : mb - i0;
+            const double *Apanel = Ap + (size_t)(i0 / mr) * mr * kb;
+            double *Ctile = &C[i0*ldc + j0];
+
+            if (rows == mr && cols == nr) {
+                uk->fn(kb, Apanel, Bpanel, Ctile, ldc);
+            } else {
+                memset(edge, 0, sizeof(edge));
+                uk->fn(kb, Apanel, Bpanel, edge, nr);
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) {
+                        Ctile[i*ldc + j] += edge[i*nr + j];
+                    }
+                }
+            }
+            if (ep != NULL) {
+                epilogue_ops(ep, rows, cols, Ctile, ldc, cj + j0);
+            }
+        }
+    }
+    if (ep != NULL) {
+        epilogue_store(ep, mb, nb, C, ldc, ci, cj);
+    }
+}
+
+/**
+ * Serial packed driver: C += alpha * A * B with arbitrary strides for A and B
+ * (C is row-major with leading dimension ldc).
+ * Three-level blocked loop (jc -> pc -> ic): each KC x NC panel of B is packed once and
+ * reused by every MC-row block of A, which is packed in turn and handed to the micro-kernel.
+ */
+static void packed_gemm_ep(const ukernel_t *uk, int m, int n, int k, double alpha,
+                           const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                           double *C, int ldc, const gemm_epilogue_t *ep) {
+    if (k == 0 && ep != NULL) {
+        apply_epilogue(ep, m, n, C, ldc, 0, 0);
+        return;
+    }
+    blocking_t bp = get_blocking(uk);
+    int mc = round_up(bp.mc, uk->mr);
+    int kc = bp.kc;
+    int nc = round_up(bp.nc, uk->nr);
+    double *Ap = scratch_reserve(&a_scratch, (size_t)mc * kc);
+    double *Bp = scratch_reserve(&b_scratch, (size_t)nc * kc);
+
+    for (int j0 = 0; j0 < n; j0 += nc) {
+        int nb = (j0 + nc < n) ? nc : n - j0;
+        int n_panels = (nb + uk->nr - 1) / uk->nr;
+
+        for (int p0 = 0; p0 < k; p0 += kc) {
+            int kb = (p0 + kc < k) ? kc : k - p0;
+            pack_b_panel(kb, nb, &B[(size_t)p0*rsb + (size_t)j0*csb], rsb, csb, uk->nr, 0, n_panels, Bp);
+
+            for (int i0 = 0; i0 < m; i0 += mc) {
+                int mb = (i0 + mc < m) ? mc : m - i0;
+                pack_a_block(mb, kb, alpha, &A[(size_t)i0*rsa + (size_t)p0*csa], rsa, csa, uk->mr, Ap);
+                compute_packed_block(uk, mb, nb, kb, Ap, Bp, &C[(size_t)i0*ldc + j0], ldc,
+                                     (p0 + kb == k) ? ep : NULL, i0, j0);
+            }
+        }
+    }
+}
+
+void packed_gemm(const ukernel_t *uk, int m, int n, int k, double alpha,
+                 const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                 double *C, int ldc) {
+    packed_gemm_ep(uk, m, n, k, alpha, A, rsa, csa, B, rsb, csb, C, ldc, NULL);
+}
+
+/**
+ * 2. Blocked/Tiled MNK implementation
+ * Runs the packed driver with a SIMD micro-kernel (AVX-512 or AVX2, picked at runtime).
+ * block_size is only used by the scalar fallback, the packed path uses get_blocking().
+ */
+void blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int block_size) {
+    blocked_mnk_gemm_ep(m, n, k, A, B, C, block_size, NULL);
+}
+
+/**
+ * Blocked MNK with a fused epilogue (ep may be NULL). The scalar fallback has no tile
+ * to hook into, so there the epilogue is a separate pass over C afterwards.
+ */
+void blocked_mnk_gemm_ep(int m, int n, int k, double *A, double *B, double *C, int block_size,
+                         const gemm_epilogue_t *ep) {
+    const ukernel_t *uk = get_ukernel();
+    if (uk == NULL) {
+        scalar_blocked_mnk_gemm(m, n, k, A, B, C, block_size);
+        if (ep != NULL) {
+            apply_epilogue(ep, m, n, C, n, 0, 0);
+        }
+        return;
+    }
+    packed_gemm_ep(uk, m, n, k, 1.0, A, k, 1, B, n, 1, C, n, ep);
+}
+
+/**
+ * Thread function for multithreaded MNK implementation
+ * (check later, maybe not the best opion)
+ */
+static void* mt_mnk_thread(void *arg) {
+    thread_args_t *args = (thread_args_t *)arg;
+    int thread_id = args->thread_id;
+    int num_threads = args->num_threads;
+    int m = args->m;
+    int n = args->n;
+    int k = args->k;
+    double *A = args->A;
+    double *B = args->B;
+    double *C = args->C;
+    
+    // Each thread processes a subset of rows
+    int rows_per_thread = (m + num_threads - 1) / num_threads;
+    int start_row = thread_id * rows_per_thread;
+    int end_row = (start_row + rows_per_thread < m) ? start_row + rows_per_thread : m;
+    
+    // Perform MNK matrix multiplication on assigned rows
+    for (int i = start_row; i < end_row; i++) {
+        for (int j = 0; j < n; j++) {
+            for (int p = 0; p < k; p++) {
+                C[i*n + j] += A[i*k + p] * B[p*n + j];
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * 3. Multithreaded MNK implementation
+ */
+void mt_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads) {
+    thread_args_t args[num_threads];
+    
+    // Fill in the work for each pool worker
+    for (int t = 0; t < num_threads; t++) {
+        args[t].thread_id = t;
+        args[t].num_threads = num_threads;
+        args[t].m = m;
+        args[t].n = n;
+        args[t].k = k;
+        args[t].A = A;
+        args[t].B = B;
+        args[t].C = C;
+    }
+    
+    // Hand the job to the persistent pool, returns once every row range is done
+    pool_run(get_gemm_pool(num_threads), num_threads, mt_mnk_thread, args, sizeof(thread_args_t));
+}
+
+// Aim for at least this many tiles per worker so the atomic counter can even out ragged edges
+#define TILES_PER_THREAD 4
+
+/**
+ * Shared state for the dynamic tile scheduler. Workers claim tile indices from next_tile
+ * until they run out, so a thread that finishes early simply takes more tiles.
+ * Tiles are numbered row-major over (row tile, column tile).
+ */
+struct tile_sched {
+    atomic_int next_tile;
+    int num_tiles;
+    int tiles_j;          // column tiles per row of tiles
+    int tile_rows;        // rows per tile (multiple of MR, or block_size for the scalar path)
+    int tile_cols;        // columns per tile (multiple of NR, or block_size for the scalar path)
+};
+
+/**
+ * Picks a 2D tile shape for a rows x cols region. It starts from unit x max_cols tiles and
+ * halves whichever side has more micro-panels until there are enough tiles to go round,
+ * so tall-skinny shapes split over rows and short-wide shapes split over columns.
+ */
+static void init_tile_sched(tile_sched_t *ts, int rows, int cols, int max_rows, int row_unit, int col_unit, int num_threads) {
+    int row_panels = (rows + row_unit - 1) / row_unit;
+    int col_panels = (cols + col_unit - 1) / col_unit;
+    int tr = (max_rows + row_unit - 1) / row_unit;   // micro-panels per tile, row direction
+    int tc = col_panels;                              // micro-panels per tile, column direction
+    if (tr > row_panels) tr = row_panels;
+    int wanted = TILES_PER_THREAD * num_threads;
+
+    while (((row_panels + tr - 1) / tr) * ((col_panels + tc - 1) / tc) < wanted && (tr > 1 || tc > 1)) {
+        if (tc >= tr && tc > 1) {
+            tc = (tc + 1) / 2;
+        } else {
+            tr = (tr + 1) / 2;
+        }
+    }
+
+    ts->tile_rows = tr * row_unit;
+    ts->tile_cols = tc * col_unit;
+    ts->tiles_j = (col_panels + tc - 1) / tc;
+    ts->num_tiles = ((row_panels + tr - 1) / tr) * ts->tiles_j;
+    atomic_init(&ts->next_tile, 0);
+}
+
+/**
+ * Claims the next tile, returns 0 once everything has been handed out.
+ */
+static int claim_tile(tile_sched_t *ts, int *row0, int *col0) {
+    int t = atomic_fetch_add_explicit(&ts->next_tile, 1, memory_order_relaxed);
+    if (t >= ts->num_tiles) {
+        return 0;
+    }
+    *row0 = (t / ts->tiles_j) * ts->tile_rows;
+    *col0 = (t % ts->tiles_j) * ts->tile_cols;
+    return 1;
+}
+
+/**
+ * Thread function for combined multithreaded and blocked MNK implementation (scalar fallback)
+ * Tiles come from the shared scheduler instead of a fixed split of the i-blocks,
+ * so ragged or skinny shapes still keep every thread busy.
+ */
+static void* mt_blocked_mnk_thread(void *arg) {
+    thread_args_t *args = (thread_args_t *)arg;
+    int m = args->m;
+    int n = args->n;
+    int k = args->k;
+    int block_size = args->block_size;
+    double *A = args->A;
+    double *B = args->B;
+    double *C = args->C;
+    tile_sched_t *ts = args->sched;
+    int i0, j0;
+    
+    // Keep claiming tiles until there are none left.
+    // Complexity is higher than just multithreading.
+    while (claim_tile(ts, &i0, &j0)) {
+        uint64_t trace_start = trace_begin();
+        int i_bound = (i0 + ts->tile_rows < m) ? i0 + ts->tile_rows : m;
+        int j_bound = (j0 + ts->tile_cols < n) ? j0 + ts->tile_cols : n;
+        
+        for (int p0 = 0; p0 < k; p0 += block_size) {
+            int p_bound = (p0 + block_size < k) ? p0 + block_size : k;
+            
+            // Compute within the block
+            for (int i = i0; i < i_bound; i++) {
+                for (int j = j0; j < j_bound; j++) {
+                    for (int p = p0; p < p_bound; p++) {
+                        C[i*n + j] += A[i*k + p] * B[p*n + j];
+                    }
+                }
+            }
+        }
+        
+        // The tile is done and still in cache
+        if (args->ep != NULL) {
+            apply_epilogue(args->ep, i_bound - i0, j_bound - j0, &C[i0*n + j0], n, i0, j0);
+        }
+        trace_end(TRACE_TILE, trace_start, i0, j0);
+    }
+    
+    return NULL;
+}
+
+// Per-worker arguments for one KC x NC panel (and one chunk of rows) of the packed multithreaded path
+typedef struct {
+    int thread_id;
+    int num_threads;
+    int i0, rows;         // chunk of rows of A/C covered by this pass
+    int p0, kb, j0, nb;
+    double alpha;
+    const ukernel_t *uk;
+    const double *A;
+    int rsa, csa;
+    const double *B;
+    int rsb, csb;
+    double *C;
+    int ldc;
+    double *Ap;           // shared packed A chunk (rows x kb)
+    double *Bp;           // shared packed B panel (kb x nb)
+    tile_sched_t *sched;
+    const gemm_epilogue_t *ep;   // set on the last k-panel only
+} packed_args_t;
+
+/**
+ * Phase 1: every worker packs its share of the A and B micro-panels into the shared buffers.
+ */
+static void* mt_pack_thread(void *arg) {
+    packed_args_t *args = (packed_args_t *)arg;
+    int mr = args->uk->mr, nr = args->uk->nr;
+    int t = args->thread_id, T = args->num_threads;
+    uint64_t trace_start = trace_begin();
+
+    int b_panels = (args->nb + nr - 1) / nr;
+    int per_thread = (b_panels + T - 1) / T;
+    int start = t * per_thread;
+    int end = (start + per_thread < b_panels) ? start + per_thread : b_panels;
+    if (start < end) {
+        const double *B = &args->B[(size_t)args->p0 * args->rsb + (size_t)args->j0 * args->csb];
+        pack_b_panel(args->kb, args->nb, B, args->rsb, args->csb, nr, start, end, args->Bp);
+    }
+
+    int a_panels = (args->rows + mr - 1) / mr;
+    per_thread = (a_panels + T - 1) / T;
+    start = t * per_thread;
+    end = (start + per_thread < a_panels) ? start + per_thread : a_panels;
+    if (start < end) {
+        int r0 = start * mr;
+        int r1 = (end * mr < args->rows) ? end * mr : args->rows;
+        const double *A = &args->A[(size_t)(args->i0 + r0) * args->rsa + (size_t)args->p0 * args->csa];
+        pack_a_block(r1 - r0, args->kb, args->alpha, A, args->rsa, args->csa, mr,
+                     args->Ap + (size_t)start * mr * args->kb);
+    }
+    trace_end(TRACE_PACK, trace_start, args->i0, args->p0);
+    return NULL;
+}
+
+/**
+ * Phase 2: workers pull (row tile, column tile) pairs off the shared counter and run the
+ * micro-kernel over them. Each tile owns its piece of C, so no locking is needed.
+ */
+static void* mt_packed_compute_thread(void *arg) {
+    packed_args_t *args = (packed_args_t *)arg;
+    const ukernel_t *uk = args->uk;
+    tile_sched_t *ts = args->sched;
+    int kb = args->kb, ldc = args->ldc;
+    int r0, c0;
+
+    while (claim_tile(ts, &r0, &c0)) {
+        uint64_t trace_start = trace_begin();
+        int mb = (r0 + ts->tile_rows < args->rows) ? ts->tile_rows : args->rows - r0;
+        int nb = (c0 + ts->tile_cols < args->nb) ? ts->tile_cols : args->nb - c0;
+        const double *Ap = args->Ap + (size_t)r0 * kb;   // r0 is a multiple of MR
+        const double *Bp = args->Bp + (size_t)c0 * kb;   // c0 is a multiple of NR
+        compute_packed_block(uk, mb, nb, kb, Ap, Bp, &args->C[(size_t)(args->i0 + r0) * ldc + args->j0 + c0], ldc,
+                             args->ep, args->i0 + r0, args->j0 + c0);
+        trace_end(TRACE_TILE, trace_start, args->i0 + r0, args->j0 + c0);
+    }
+    return NULL;
+}
+
+/**
+ * Multithreaded packed driver, same contract as packed_gemm.
+ * Each KC x NC panel of B and the matching rows of A are packed once into shared buffers
+ * (split across the workers), then the C panel is cut into 2D tiles that the workers claim
+ * dynamically. The pool_run between the two phases acts as the barrier. Rows are processed
+ * in chunks of MC per thread to bound the packed A buffer.
+ */
+static void mt_packed_gemm_ep(const ukernel_t *uk, int m, int n, int k, double alpha,
+                              const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                              double *C, int ldc, int num_threads, const gemm_epilogue_t *ep) {
+    if (k == 0 && ep != NULL) {
+        apply_epilogue(ep, m, n, C, ldc, 0, 0);
+        return;
+    }
+    thread_pool_t *pool = get_gemm_pool(num_threads);
+    packed_args_t packed[num_threads];
+    tile_sched_t sched;
+    blocking_t bp = get_blocking(uk);
+    int mc = round_up(bp.mc, uk->mr);
+    int kc = bp.kc;
+    int nc = round_up(bp.nc, uk->nr);
+    int chunk = mc * num_threads;
+    double *Ap = scratch_reserve(&shared_a_scratch, (size_t)chunk * kc);
+    double *Bp = scratch_reserve(&shared_b_scratch, (size_t)nc * kc);
+
+    for (int j0 = 0; j0 < n; j0 += nc) {
+        int nb = (j0 + nc < n) ? nc : n - j0;
+
+        for (int p0 = 0; p0 < k; p0 += kc) {
+            int kb = (p0 + kc < k) ? kc : k - p0;
+
+            for (int i0 = 0; i0 < m; i0 += chunk) {
+                int rows = (i0 + chunk < m) ? chunk : m - i0;
+                init_tile_sched(&sched, rows, nb, mc, uk->mr, uk->nr, num_threads);
+                for (int t = 0; t < num_threads; t++) {
+                    packed[t] = (packed_args_t){t, num_threads, i0, rows, p0, kb, j0, nb, alpha, uk,
+                                                A, rsa, csa, B, rsb, csb, C, ldc, Ap, Bp, &sched,
+                                                (p0 + kb == k) ? ep : NULL};
+                }
+                pool_run(pool, num_threads, mt_pack_thread, packed, sizeof(packed_args_t));
+                pool_run(pool, num_threads, mt_packed_compute_thread, packed, sizeof(packed_args_t));
+            }
+        }
+    }
+}
+
+void mt_packed_gemm(const ukernel_t *uk, int m, int n, int k, double alpha,
+                    const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                    double *C, int ldc, int num_threads) {
+    mt_packed_gemm_ep(uk, m, n, k, alpha, A, rsa, csa, B, rsb, csb, C, ldc, num_threads, NULL);
+}
+
+/**
+ * 4. Combined multithreaded and blocked MNK implementation
+ * Runs the multithreaded packed driver when a SIMD micro-kernel is available. Without SIMD
+ * the scalar thread function is used, with the same dynamic 2D tiles.
+ */
+void mt_blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads, int block_size) {
+    mt_blocked_mnk_gemm_ep(m, n, k, A, B, C, num_threads, block_size, NULL);
+}
+
+/**
+ * MT+Blocked MNK with a fused epilogue (ep may be NULL), applied per tile on both paths.
+ */
+void mt_blocked_mnk_gemm_ep(int m, int n, int k, double *A, double *B, double *C, int num_threads, int block_size,
+                            const gemm_epilogue_t *ep) {
+    const ukernel_t *uk = get_ukernel();
+    if (uk != NULL) {
+        mt_packed_gemm_ep(uk, m, n, k, 1.0, A, k, 1, B, n, 1, C, n, num_threads, ep);
+        return;
+    }
+    if (k == 0 && ep != NULL) {
+        apply_epilogue(ep, m, n, C, n, 0, 0);
+        return;
+    }
+
+    thread_args_t args[num_threads];
+    tile_sched_t sched;
+    init_tile_sched(&sched, m, n, block_size, block_size, block_size, num_threads);
+    
+    // Fill in the work for each pool worker
+    for (int t = 0; t < num_threads; t++) {
+        args[t].thread_id = t;
+        args[t].num_threads = num_threads;
+        args[t].m = m;
+        args[t].n = n;
+        args[t].k = k;
+        args[t].block_size = block_size;
+        args[t].A = A;
+        args[t].B = B;
+        args[t].C = C;
+        args[t].sched = &sched;
+        args[t].ep = ep;
+    }
+    
+    pool_run(get_gemm_pool(num_threads), num_threads, mt_blocked_mnk_thread, args, sizeof(thread_args_t));
+}
+
+/**
+ * Autotuning.
+ * Which variant wins depends on the shape (serial MNK at 10-30, the MT paths later), so
+ * --tune benchmarks every (variant, block_size, num_threads) candidate on a set of shapes
+ * and saves the winner for each shape bucket to a tuning file. dgemm_general loads that
+ * file the first time it runs (GEMM_TUNING_FILE overrides the path) and takes the tuned
+ * path whenever the call's shape falls in a tuned bucket.
+ * Buckets are floor(log2) of m, n and k, so 16..31 share one bucket, 32..63 the next, etc.
+ * --tune only fills the square buckets, so a shape in an untuned bucket takes the nearest
+ * tuned one (fewest bucket steps summed over m, n and k, ties to the bigger shape).
+ */
+static const char *tune_variant_names[TUNE_NUM_VARIANTS] = {"mnk", "scalar_blocked", "mt_mnk", "packed", "mt_packed"};
+
+#define TUNE_MAX_BUCKET 16
+#define MAX_TUNE_CANDIDATES 64
+
+static tune_entry_t tuning_table[TUNE_MAX_BUCKET][TUNE_MAX_BUCKET][TUNE_MAX_BUCKET];
+// The entry a lookup in each bucket gets: its own if tuned, otherwise the nearest tuned one (NULL if none is)
+static const tune_entry_t *tuning_nearest[TUNE_MAX_BUCKET][TUNE_MAX_BUCKET][TUNE_MAX_BUCKET];
+static int tuning_loaded = 0;
+static pthread_once_t tuning_once = PTHREAD_ONCE_INIT;
+
+static int size_bucket(int x) {
+    int b = 0;
+    while (x > 1 && b < TUNE_MAX_BUCKET - 1) {
+        x >>= 1;
+        b++;
+    }
+    return b;
+}
+
+// Recomputes tuning_nearest after tuning_table has changed
+static void update_tuning_nearest(void) {
+    static int tuned[TUNE_MAX_BUCKET * TUNE_MAX_BUCKET * TUNE_MAX_BUCKET][3];
+    int num_tuned = 0;
+    for (int bm = 0; bm < TUNE_MAX_BUCKET; bm++) {
+        for (int bn = 0; bn < TUNE_MAX_BUCKET; bn++) {
+            for (int bk = 0; bk < TUNE_MAX_BUCKET; bk++) {
+                if (tuning_table[bm][bn][bk].valid) {
+                    tuned[num_tuned][0] = bm;
+                    tuned[num_tuned][1] = bn;
+                    tuned[num_tuned][2] = bk;
+                    num_tuned++;
+                }
+            }
+        }
+    }
+
+    for (int bm = 0; bm < TUNE_MAX_BUCKET; bm++) {
+        for (int bn = 0; bn < TUNE_MAX_BUCKET; bn++) {
+            for (int bk = 0; bk < TUNE_MAX_BUCKET; bk++) {
+                int best = -1, best_dist = 0, best_size = 0;
+                for (int t = 0; t < num_tuned; t++) {
+                    int dist = abs(tuned[t][0] - bm) + abs(tuned[t][1] - bn) + abs(tuned[t][2] - bk);
+                    int size = tuned[t][0] + tuned[t][1] + tuned[t][2];
+                    if (best < 0 || dist < best_dist || (dist == best_dist && size > best_size)) {
+                        best = t;
+                        best_dist = dist;
+                        best_size = size;
+                    }
+                }
+                tuning_nearest[bm][bn][bk] = (best < 0) ? NULL
+                                                        : &tuning_table[tuned[best][0]][tuned[best][1]][tuned[best][2]];
+            }
+        }
+    }
+}
+
+/**
+ * Reads a tuning file written by save_tuning_file. Returns the number of entries read,
+ * or -1 if the file can't be opened. Malformed lines are skipped.
+ */
+int load_tuning_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    int count = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int bm, bn, bk, block_size, num_threads;
+        char name[32];
+        double seconds;
+        if (line[0] == '#' ||
+            sscanf(line, "%d %d %d %31s %d %d %lf", &bm, &bn, &bk, name, &block_size, &num_threads, &seconds) != 7) {
+            continue;
+        }
+        if (bm < 0 || bn < 0 || bk < 0 || bm >= TUNE_MAX_BUCKET || bn >= TUNE_MAX_BUCKET || bk >= TUNE_MAX_BUCKET) {
+            continue;
+        }
+        for (int v = 0; v < TUNE_NUM_VARIANTS; v++) {
+            if (strcmp(name, tune_variant_names[v]) == 0) {
+                tune_entry_t *e = &tuning_table[bm][bn][bk];
+                e->valid = 1;
+                e->choice = (tune_candidate_t){(tune_variant_t)v, block_size, num_threads < 1 ? 1 : num_threads};
+                e->seconds = seconds;
+                count++;
+                break;
+            }
+        }
+    }
+
+    fclose(f);
+    update_tuning_nearest();
+    tuning_loaded = 1;
+    return count;
+}
+
+int save_tuning_file(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+
+    fprintf(f, "# GEMM tuning file written by OptGEMM --tune\n");
+    fprintf(f, "# m_bucket n_bucket k_bucket variant block_size threads seconds  (bucket = floor(log2(size)))\n");
+    for (int bm = 0; bm < TUNE_MAX_BUCKET; bm++) {
+        for (int bn = 0; bn < TUNE_MAX_BUCKET; bn++) {
+            for (int bk = 0; bk < TUNE_MAX_BUCKET; bk++) {
+                tune_entry_t *e = &tuning_table[bm][bn][bk];
+                if (e->valid) {
+                    fprintf(f, "%d %d %d %s %d %d %.9f\n", bm, bn, bk, tune_variant_names[e->choice.variant],
+                            e->choice.block_size, e->choice.num_threads, e->seconds);
+                }
+            }
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Loads GEMM_TUNING_FILE (or the default file) unless a table was already loaded or tuned
+static void load_default_tuning(void) {
+    if (!tuning_loaded) {
+        const char *path = getenv("GEMM_TUNING_FILE");
+        load_tuning_file(path != NULL ? path : DEFAULT_TUNING_FILE);
+        tuning_loaded = 1;
+    }
+}
+
+/**
+ * Tuned choice for a shape: its bucket's, or the nearest tuned bucket's; NULL if nothing was
+ * tuned (the tuning file is loaded lazily, once).
+ */
+const tune_entry_t* lookup_tuning(int m, int n, int k) {
+    pthread_once(&tuning_once, load_default_tuning);
+    return tuning_nearest[size_bucket(m)][size_bucket(n)][size_bucket(k)];
+}
+
+/**
+ * Runs one tuning candidate on a plain row-major C += A * B.
+ */
+void run_tune_candidate(const tune_candidate_t *c, int m, int n, int k, double *A, double *B, double *C) {
+    switch (c->variant) {
+    case TUNE_MNK:
+        mnk_gemm(m, n, k, A, B, C);
+        break;
+    case TUNE_SCALAR_BLOCKED:
+        scalar_blocked_mnk_gemm(m, n, k, A, B, C, c->block_size);
+        break;
+    case TUNE_MT_MNK:
+        mt_mnk_gemm(m, n, k, A, B, C, c->num_threads);
+        break;
+    case TUNE_PACKED:
+        packed_gemm(get_ukernel_or_scalar(), m, n, k, 1.0, A, k, 1, B, n, 1, C, n);
+        break;
+    case TUNE_MT_PACKED:
+        mt_packed_gemm(get_ukernel_or_scalar(), m, n, k, 1.0, A, k, 1, B, n, 1, C, n, c->num_threads);
+        break;
+    default:
+        break;
+    }
+}
+
+static int build_tune_candidates(tune_candidate_t *cands, int max_threads) {
+    static const int block_sizes[] = {16, 32, 64, 128};
+    int count = 0;
+
+    cands[count++] = (tune_candidate_t){TUNE_MNK, 0, 1};
+    for (unsigned b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+        cands[count++] = (tune_candidate_t){TUNE_SCALAR_BLOCKED, block_sizes[b], 1};
+    }
+    cands[count++] = (tune_candidate_t){TUNE_PACKED, 0, 1};
+
+    // Powers of two up to max_threads, plus max_threads itself
+    for (int t = 2; max_threads > 1 && count + 2 <= MAX_TUNE_CANDIDATES; t *= 2) {
+        if (t > max_threads) {
+            t = max_threads;
+        }
+        cands[count++] = (tune_candidate_t){TUNE_MT_MNK, 0, t};
+        cands[count++] = (tune_candidate_t){TUNE_MT_PACKED, 0, t};
+        if (t == max_threads) {
+            break;
+        }
+    }
+    return count;
+}
+
+typedef struct {
+    const tune_candidate_t *cand;
+    int m, n, k;
+    double *A, *B, *C;
+} tune_bench_t;
+
+static void run_tune_bench(void *ctx) {
+    tune_bench_t *t = (tune_bench_t *)ctx;
+    run_tune_candidate(t->cand, t->m, t->n, t->k, t->A, t->B, t->C);
+}
+
+static void reset_tune_bench(void *ctx) {
+    tune_bench_t *t = (tune_bench_t *)ctx;
+    reset_matrix_c(t->C, t->m, t->n);
+}
+
+/**
+ * Benchmarks every candidate on each square size and records the winner per bucket.
+ * When several sizes land in the same bucket, the candidate with the lowest total of
+ * (time / best time for that size) wins, so no single size dominates the choice.
+ */
+void autotune(const int *sizes, int num_sizes, int max_threads, const char *path) {
+    tune_candidate_t cands[MAX_TUNE_CANDIDATES];
+    int num_cands = build_tune_candidates(cands, max_threads);
+    double score[TUNE_MAX_BUCKET][MAX_TUNE_CANDIDATES] = {{0.0}};
+    double best_seen[TUNE_MAX_BUCKET];
+    int bucket_used[TUNE_MAX_BUCKET] = {0};
+
+    bench_config_t bench_cfg = bench_config_from_env();
+    get_gemm_pool(max_threads);
+    set_setup_threads(max_threads);
+    printf("Autotuning %d candidates over %d sizes (up to %d threads)\n", num_cands, num_sizes, max_threads);
+
+    for (int s = 0; s < num_sizes; s++) {
+        int size = sizes[s];
+        int m = size, n = size, k = size;
+        int b = size_bucket(size);
+        double times[MAX_TUNE_CANDIDATES];
+        double best = 0.0;
+
+        double *A, *B, *C;
+        init_matrices(m, n, k, &A, &B, &C);
+
+        for (int c = 0; c < num_cands; c++) {
+            // Candidates are compared on their fastest run, the least noisy statistic
+            tune_bench_t bench = {&cands[c], m, n, k, A, B, C};
+            bench_stats_t st = bench_run(&bench_cfg, reset_tune_bench, run_tune_bench, &bench);
+            times[c] = (st.min > 1e-9) ? st.min : 1e-9;
+            if (c == 0 || times[c] < best) {
+                best = times[c];
+            }
+        }
+
+        for (int c = 0; c < num_cands; c++) {
+            score[b][c] += times[c] / best;
+        }
+        if (!bucket_used[b] || best < best_seen[b]) {
+            best_seen[b] = best;
+        }
+        bucket_used[b] = 1;
+
+        free_matrices(A, B, C);
+    }
+
+    for (int b = 0; b < TUNE_MAX_BUCKET; b++) {
+        if (!bucket_used[b]) {
+            continue;
+        }
+        int winner = 0;
+        for (int c = 1; c < num_cands; c++) {
+            if (score[b][c] < score[b][winner]) {
+                winner = c;
+            }
+        }
+        tune_entry_t *e = &tuning_table[b][b][b];
+        e->valid = 1;
+        e->choice = cands[winner];
+        e->seconds = best_seen[b];
+        printf("  sizes %d..%d: %s (block %d, %d threads)\n", 1 << b, (1 << (b + 1)) - 1,
+               tune_variant_names[cands[winner].variant], cands[winner].block_size, cands[winner].num_threads);
+    }
+    update_tuning_nearest();
+    tuning_loaded = 1;
+
+    if (save_tuning_file(path) != 0) {
+        fprintf(stderr, "Error writing tuning file %s\n", path);
+    } else {
+        printf("Tuning results saved to %s\n", path);
+    }
+}
+
+/**
+ * General-purpose entry point, modelled on BLAS dgemm:
+ *     C = alpha * op(A) * op(B) + beta * C
+ * op(A) is m x k, op(B) is k x n and C is m x n, each with its own leading dimension,
+ * in either row-major or column-major layout. Nothing is copied up front: transposes
+ * and strides are absorbed by the packing routines.
+ */
+// Below this many flops (2*m*n*k) the dispatcher stays on the calling thread
+#define MT_MIN_FLOPS (2.0 * 96 * 96 * 96)
+// Up to this k a product is a rank-k update of C rather than a GEMM
+#define RANK_K_MAX 8
+
+static int gemm_num_threads = 1;
+
+/**
+ * Sets how many threads dgemm_general may use (the pool is shared with the MT variants).
+ */
+void set_gemm_threads(int num_threads) {
+    gemm_num_threads = (num_threads < 1) ? 1 : num_threads;
+}
+
+/**
+ * Scales C by beta before accumulating (beta == 0 overwrites, so NaNs in C don't leak through).
+ */
+static void scale_matrix_c(int m, int n, double beta, double *C, int ldc) {
+    if (beta == 1.0) {
+        return;
+    }
+    for (int i = 0; i < m; i++) {
+        double *row = &C[(size_t)i*ldc];
+        if (beta == 0.0) {
+            memset(row, 0, n * sizeof(double));
+        } else {
+            for (int j = 0; j < n; j++) {
+                row[j] *= beta;
+            }
+        }
+    }
+}
+
+/**
+ * Returns 0 on success, or -i if argument i is invalid (same numbering as the BLAS argument list).
+ */
+int dgemm_general(gemm_layout_t layout, gemm_trans_t trans_a, gemm_trans_t trans_b,
+                  int m, int n, int k, double alpha, const double *A, int lda,
+                  const double *B, int ldb, double beta, double *C, int ldc) {
+    int row_major = (layout == GEMM_ROW_MAJOR);
+    int ta = (trans_a == GEMM_TRANS), tb = (trans_b == GEMM_TRANS);
+
+    // Stored shape of each operand (rows x cols in the chosen layout)
+    int a_rows = ta ? k : m, a_cols = ta ? m : k;
+    int b_rows = tb ? n : k, b_cols = tb ? k : n;
+    int info = 0;
+    if (layout != GEMM_ROW_MAJOR && layout != GEMM_COL_MAJOR) info = -1;
+    else if (trans_a != GEMM_NO_TRANS && trans_a != GEMM_TRANS) info = -2;
+    else if (trans_b != GEMM_NO_TRANS && trans_b != GEMM_TRANS) info = -3;
+    else if (m < 0) info = -4;
+    else if (n < 0) info = -5;
+    else if (k < 0) info = -6;
+    else if (lda < ((row_major ? a_cols : a_rows) > 1 ? (row_major ? a_cols : a_rows) : 1)) info = -9;
+    else if (ldb < ((row_major ? b_cols : b_rows) > 1 ? (row_major ? b_cols : b_rows) : 1)) info = -11;
+    else if (ldc < ((row_major ? n : m) > 1 ? (row_major ? n : m) : 1)) info = -14;
+    if (info != 0) {
+        fprintf(stderr, "dgemm_general: invalid argument %d\n", -info);
+        return info;
+    }
+    if (m == 0 || n == 0) {
+        return 0;
+    }
+
+    // Strides of op(A)(i, p) and op(B)(p, j) in memory
+    int rsa = row_major ? lda : 1, csa = row_major ? 1 : lda;
+    int rsb = row_major ? ldb : 1, csb = row_major ? 1 : ldb;
+    if (ta) { int t = rsa; rsa = csa; csa = t; }
+    if (tb) { int t = rsb; rsb = csb; csb = t; }
+
+    // The kernels want row-major C. For column-major C, compute C^T = op(B)^T * op(A)^T instead.
+    int mm = m, nn = n;
+    const double *X = A, *Y = B;
+    int rsx = rsa, csx = csa, rsy = rsb, csy = csb;
+    if (!row_major) {
+        mm = n; nn = m;
+        X = B; rsx = csb; csx = rsb;
+        Y = A; rsy = csa; csy = rsa;
+    }
+
+    scale_matrix_c(mm, nn, beta, C, ldc);
+    if (alpha == 0.0 || k == 0) {
+        return 0;
+    }
+    // Small square shapes with plain row-major operands skip the packing altogether
+    if (csx == 1 && rsx == k && csy == 1 && rsy == nn && ldc == nn && fixed_gemm(mm, nn, k, alpha, X, Y, C)) {
+        return 0;
+    }
+    // Matrix-vector products and thin updates are memory-bound, their own kernels just stream the data
+    if (nn == 1) {
+        gemv(mm, k, alpha, X, rsx, csx, Y, rsy, C, ldc, gemm_num_threads);
+        return 0;
+    }
+    if (mm == 1) {
+        gemv(nn, k, alpha, Y, csy, rsy, X, csx, C, 1, gemm_num_threads);
+        return 0;
+    }
+    if (k <= RANK_K_MAX) {
+        rank_k_update(mm, nn, k, alpha, X, rsx, csx, Y, rsy, csy, C, ldc, gemm_num_threads);
+        return 0;
+    }
+
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    int num_threads = gemm_num_threads;
+    int use_mt = (num_threads > 1 && 2.0 * m * n * k >= MT_MIN_FLOPS);
+
+    // A tuned bucket overrides the default heuristic, within set_gemm_threads' limit (a capped
+    // MT choice drops to its serial variant). The plain loop variants only take packed
+    // row-major operands, anything else stays on the packed path with the tuned threads.
+    const tune_entry_t *tuned = lookup_tuning(mm, nn, k);
+    if (tuned != NULL) {
+        tune_candidate_t choice = tuned->choice;
+        if (choice.num_threads > gemm_num_threads) {
+            choice.num_threads = gemm_num_threads;
+        }
+        if (choice.num_threads <= 1) {
+            choice.num_threads = 1;
+            if (choice.variant == TUNE_MT_MNK) {
+                choice.variant = TUNE_MNK;
+            } else if (choice.variant == TUNE_MT_PACKED) {
+                choice.variant = TUNE_PACKED;
+            }
+        }
+        int plain = (alpha == 1.0 && csx == 1 && rsx == k && csy == 1 && rsy == nn && ldc == nn);
+        if (choice.variant == TUNE_PACKED || choice.variant == TUNE_MT_PACKED || !plain) {
+            num_threads = choice.num_threads;
+            use_mt = (choice.variant == TUNE_MT_PACKED || choice.variant == TUNE_MT_MNK) && num_threads > 1;
+        } else {
+            run_tune_candidate(&choice, mm, nn, k, (double *)X, (double *)Y, C);
+            return 0;
+        }
+    }
+
+    if (use_mt) {
+        mt_packed_gemm(uk, mm, nn, k, alpha, X, rsx, csx, Y, rsy, csy, C, ldc, num_threads);
+    } else {
+        packed_gemm(uk, mm, nn, k, alpha, X, rsx, csx, Y, rsy, csy, C, ldc);
+    }
+    return 0;
+}
+
+/**
+ * Batched GEMM: C[b] += A[b] * B[b] for b = 0..batch-1, all the same m x n x k shape
+ * (row-major, packed). Small matrices are handed out whole to the pool workers through
+ * an atomic counter, each one running the serial packed kernel, so there is one pool
+ * dispatch for the whole batch instead of one per matrix. Matrices big enough to be
+ * worth splitting run one after another on the multithreaded packed driver.
+ */
+typedef struct {
+    int m, n, k;
+    int batch;
+    const ukernel_t *uk;
+    // Either pointer arrays (A_array etc.) or one base pointer plus a stride per operand
+    double **A_array, **B_array, **C_array;
+    const double *A_base, *B_base;
+    double *C_base;
+    long stride_a, stride_b, stride_c;
+    atomic_int *next;
+} batch_args_t;
+
+static void batch_operands(const batch_args_t *args, int b, const double **A, const double **B, double **C) {
+    if (args->A_array != NULL) {
+        *A = args->A_array[b];
+        *B = args->B_array[b];
+        *C = args->C_array[b];
+    } else {
+        *A = args->A_base + (size_t)b * args->stride_a;
+        *B = args->B_base + (size_t)b * args->stride_b;
+        *C = args->C_base + (size_t)b * args->stride_c;
+    }
+}
+
+static void* batched_gemm_thread(void *arg) {
+    batch_args_t *args = (batch_args_t *)arg;
+    int b;
+
+    while ((b = atomic_fetch_add_explicit(args->next, 1, memory_order_relaxed)) < args->batch) {
+        const double *A, *B;
+        double *C;
+        batch_operands(args, b, &A, &B, &C);
+        packed_gemm(args->uk, args->m, args->n, args->k, 1.0, A, args->k, 1, B, args->n, 1, C, args->n);
+    }
+    return NULL;
+}
+
+static void run_batched_gemm(batch_args_t *proto, int num_threads) {
+    int m = proto->m, n = proto->n, k = proto->k;
+    if (proto->batch <= 0 || m == 0 || n == 0 || k == 0) {
+        return;
+    }
+
+    // Large matrices: parallelise inside each one instead
+    if (num_threads > 1 && 2.0 * m * n * k >= MT_MIN_FLOPS * num_threads) {
+        for (int b = 0; b < proto->batch; b++) {
+            const double *A, *B;
+            double *C;
+            batch_operands(proto, b, &A, &B, &C);
+            mt_packed_gemm(proto->uk, m, n, k, 1.0, A, k, 1, B, n, 1, C, n, num_threads);
+        }
+        return;
+    }
+
+    atomic_int next;
+    atomic_init(&next, 0);
+    proto->next = &next;
+
+    // Every worker gets the same arguments, the counter decides who does what
+    batch_args_t args[num_threads];
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = *proto;
+    }
+    pool_run(get_gemm_pool(num_threads), num_threads, batched_gemm_thread, args, sizeof(batch_args_t));
+}
+
+/**
+ * Pointer-array batch: A[b], B[b] and C[b] each point at one packed row-major matrix.
+ */
+void batched_gemm(int batch, int m, int n, int k, double **A, double **B, double **C, int num_threads) {
+    batch_args_t proto = {m, n, k, batch, get_ukernel_or_scalar(), A, B, C, NULL, NULL, NULL, 0, 0, 0, NULL};
+    run_batched_gemm(&proto, num_threads);
+}
+
+/**
+ * Strided batch: matrix b of A starts at A + b*stride_a (strides in elements), same for B and C.
+ */
+void strided_batched_gemm(int batch, int m, int n, int k, const double *A, long stride_a,
+                          const double *B, long stride_b, double *C, long stride_c, int num_threads) {
+    batch_args_t proto = {m, n, k, batch, get_ukernel_or_scalar(), NULL, NULL, NULL, A, B, C,
+                          stride_a, stride_b, stride_c, NULL};
+    run_batched_gemm(&proto, num_threads);
+}
+
+/**
+ * Strassen-Winograd for large square products.
+ * Each level replaces 8 half-size multiplies with 7 plus 15 additions, so it trades a
+ * little accuracy for ~12% fewer flops per level. It recurses while n is above the cutoff,
+ * then hands the block to the packed kernel (MT when gemm_num_threads says so). An odd n
+ * peels off its last row and column: the even n-1 block recurses, and the rest is a rank-1
+ * update of that block plus a GEMV each for the last column and the last row.
+ * All temporaries live in one workspace sized up front, so there are no mallocs per level.
+ */
+static __thread scratch_t strassen_scratch;
+
+// Z = X + Y (Z may alias X or Y)
+static void strassen_add(int n, const double *X, int ldx, const double *Y, int ldy, double *Z, int ldz) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            Z[(size_t)i*ldz + j] = X[(size_t)i*ldx + j] + Y[(size_t)i*ldy + j];
+        }
+    }
+}
+
+// Z = X - Y (Z may alias X or Y)
+static void strassen_sub(int n, const double *X, int ldx, const double *Y, int ldy, double *Z, int ldz) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            Z[(size_t)i*ldz + j] = X[(size_t)i*ldx + j] - Y[(size_t)i*ldy + j];
+        }
+    }
+}
+
+/**
+ * Doubles of workspace winograd_rec needs below a size-n call: two h x h temporaries per
+ * even level, and an n-long copy of B's last column per odd one (reusing the space the
+ * peeled n-1 call is done with).
+ */
+static size_t strassen_workspace_size(int n, int cutoff) {
+    size_t total = 0, needed = 0;
+    while (n > cutoff) {
+        if (n & 1) {
+            if (total + n > needed) {
+                needed = total + n;
+            }
+            n--;
+            continue;
+        }
+        n /= 2;
+        total += 2 * (size_t)n * n;
+    }
+    return total > needed ? total : needed;
+}
+
+/**
+ * C = A * B for n x n blocks with leading dimensions, using the Winograd schedule
+ * that only needs two temporaries (X for A-side sums, Y for B-side sums) per level.
+ */
+static void winograd_rec(int n, const double *A, int lda, const double *B, int ldb, double *C, int ldc,
+                         double *work, int cutoff) {
+    if (n <= cutoff) {
+        scale_matrix_c(n, n, 0.0, C, ldc);
+        if (gemm_num_threads > 1 && 2.0 * n * n * n >= MT_MIN_FLOPS) {
+            mt_packed_gemm(get_ukernel_or_scalar(), n, n, n, 1.0, A, lda, 1, B, ldb, 1, C, ldc, gemm_num_threads);
+        } else {
+            packed_gemm(get_ukernel_or_scalar(), n, n, n, 1.0, A, lda, 1, B, ldb, 1, C, ldc);
+        }
+        return;
+    }
+    if (n & 1) {
+        int e = n - 1;
+        winograd_rec(e, A, lda, B, ldb, C, ldc, work, cutoff);
+        // C11 += A(0:e, e) * B(e, 0:e), then C(0:e, e) = A(0:e, :) * B(:, e) and C(e, :) = A(e, :) * B
+        rank_k_update(e, e, 1, 1.0, A + e, lda, 1, B + (size_t)e*ldb, ldb, 1, C, ldc, gemm_num_threads);
+        for (int i = 0; i < e; i++) {
+            C[(size_t)i*ldc + e] = 0.0;
+        }
+        // B's last column goes contiguous into the workspace so gemv doesn't copy it itself
+        for (int p = 0; p < n; p++) {
+            work[p] = B[(size_t)p*ldb + e];
+        }
+        gemv(e, n, 1.0, A, lda, 1, work, 1, C + e, ldc, gemm_num_threads);
+        scale_matrix_c(1, n, 0.0, C + (size_t)e*ldc, ldc);
+        gemv(n, n, 1.0, B, 1, ldb, A + (size_t)e*lda, 1, C + (size_t)e*ldc, 1, gemm_num_threads);
+        return;
+    }
+
+    int h = n / 2;
+    const double *A11 = A, *A12 = A + h, *A21 = A + (size_t)h*lda, *A22 = A21 + h;
+    const double *B11 = B, *B12 = B + h, *B21 = B + (size_t)h*ldb, *B22 = B21 + h;
+    double *C11 = C, *C12 = C + h, *C21 = C + (size_t)h*ldc, *C22 = C21 + h;
+    double *X = work;
+    double *Y = work + (size_t)h * h;
+    double *rest = Y + (size_t)h * h;
+
+    strassen_sub(h, A11, lda, A21, lda, X, h);              // S3 = A11 - A21
+    strassen_sub(h, B22, ldb, B12, ldb, Y, h);              // T3 = B22 - B12
+    winograd_rec(h, X, h, Y, h, C21, ldc, rest, cutoff);    // M7 = S3 * T3
+
+    strassen_add(h, A21, lda, A22, lda, X, h);              // S1 = A21 + A22
+    strassen_sub(h, B12, ldb, B11, ldb, Y, h);              // T1 = B12 - B11
+    winograd_rec(h, X, h, Y, h, C22, ldc, rest, cutoff);    // M5 = S1 * T1
+
+    strassen_sub(h, X, h, A11, lda, X, h);                  // S2 = S1 - A11
+    strassen_sub(h, B22, ldb, Y, h, Y, h);                  // T2 = B22 - T1
+    winograd_rec(h, X, h, Y, h, C12, ldc, rest, cutoff);    // M6 = S2 * T2
+
+    strassen_sub(h, A12, lda, X, h, X, h);                  // S4 = A12 - S2
+    winograd_rec(h, X, h, B22, ldb, C11, ldc, rest, cutoff); // M3 = S4 * B22
+
+    winograd_rec(h, A11, lda, B11, ldb, X, h, rest, cutoff); // M1 = A11 * B11
+
+    strassen_add(h, X, h, C12, ldc, C12, ldc);              // U2 = M1 + M6
+    strassen_add(h, C12, ldc, C21, ldc, C21, ldc);          // U3 = U2 + M7
+    strassen_add(h, C12, ldc, C22, ldc, C12, ldc);          // U4 = U2 + M5
+    strassen_add(h, C21, ldc, C22, ldc, C22, ldc);          // C22 = U3 + M5
+    strassen_add(h, C12, ldc, C11, ldc, C12, ldc);          // C12 = U4 + M3
+
+    strassen_sub(h, Y, h, B21, ldb, Y, h);                  // T4 = T2 - B21
+    winograd_rec(h, A22, lda, Y, h, C11, ldc, rest, cutoff); // M4 = A22 * T4
+    strassen_sub(h, C21, ldc, C11, ldc, C21, ldc);          // C21 = U3 - M4
+
+    winograd_rec(h, A12, lda, B21, ldb, C11, ldc, rest, cutoff); // M2 = A12 * B21
+    strassen_add(h, X, h, C11, ldc, C11, ldc);              // C11 = M1 + M2
+}
+
+/**
+ * C += A * B for n x n row-major matrices, like the other variants.
+ * cutoff <= 0 uses DEFAULT_STRASSEN_CUTOFF.
+ */
+void strassen_gemm(int n, const double *A, const double *B, double *C, int cutoff) {
+    if (cutoff <= 0) {
+        cutoff = DEFAULT_STRASSEN_CUTOFF;
+    }
+    // The product goes to its own n x n block first so C keeps the += contract
+    size_t product = (size_t)n * n;
+    double *P = scratch_reserve(&strassen_scratch, product + strassen_workspace_size(n, cutoff));
+    winograd_rec(n, A, n, B, n, P, n, P + product, cutoff);
+    strassen_add(n, C, n, P, n, C, n);
+}
+
+/**
+ * Reduced-precision variants: float, bf16 and fp16 inputs, all accumulated in fp32
+ * (bf16_t, f16_t and the conversions are in gemm.h).
+ */
+static void convert_row_f32(float *dst, const float *src, int count) {
+    memcpy(dst, src, count * sizeof(float));
+}
+
+static void convert_row_bf16(float *dst, const bf16_t *src, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = bf16_to_float(src[i]);
+    }
+}
+
+#ifdef HAVE_FLOAT16
+#if defined(__x86_64__) || defined(__i386__)
+// The compiler won't vectorise _Float16 -> float on its own, so use F16C directly
+__attribute__((target("avx,f16c")))
+static void convert_row_f16_f16c(float *dst, const f16_t *src, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)&src[i]);
+        _mm256_storeu_ps(&dst[i], _mm256_cvtph_ps(h));
+    }
+    for (; i < count; i++) {
+        dst[i] = (float)src[i];
+    }
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+static int has_f16c = 0;
+static pthread_once_t f16c_once = PTHREAD_ONCE_INIT;
+
+static void detect_f16c(void) {
+    __builtin_cpu_init();
+    has_f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+#endif
+
+static void convert_row_f16(float *dst, const f16_t *src, int count) {
+#if defined(__x86_64__) || defined(__i386__)
+    pthread_once(&f16c_once, detect_f16c);
+    if (has_f16c) {
+        convert_row_f16_f16c(dst, src, count);
+        return;
+    }
+#endif
+    for (int i = 0; i < count; i++) {
+        dst[i] = (float)src[i];
+    }
+}
+#endif
+
+/**
+ * fp32 tile kernel shared by every reduced-precision variant: C += A * B on float tiles.
+ * Full MR x NR blocks go through a register-blocked FMA kernel (8x32 on AVX-512, 6x16 on
+ * AVX2), the ragged edges through a plain loop. One copy is built per ISA and the widest
+ * one is picked at runtime, like the double micro-kernels.
+ */
+#define SGEMM_EDGE_LOOP(i_start, i_end, j_start, j_end) \
+    for (int i = (i_start); i < (i_end); i++) { \
+        float *restrict c = &C[(size_t)i*ldc]; \
+        for (int p = 0; p < kb; p++) { \
+            float a = A[(size_t)i*lda + p]; \
+            const float *restrict b = &B[(size_t)p*ldb]; \
+            for (int j = (j_start); j < (j_end); j++) { \
+                c[j] += a * b[j]; \
+            } \
+        } \
+    }
+
+typedef void (*sgemm_tile_fn)(int mb, int nb, int kb, const float *A, int lda,
+                              const float *B, int ldb, float *C, int ldc);
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static void sgemm_tile_avx512(int mb, int nb, int kb, const float *A, int lda, const float *B, int ldb, float *C, int ldc) {
+    int m_full = mb / 8 * 8, n_full = nb / 32 * 32;
+
+    for (int i0 = 0; i0 < m_full; i0 += 8) {
+        for (int j0 = 0; j0 < n_full; j0 += 32) {
+            __m512 c[8][2];
+            #pragma GCC unroll 8
+            for (int i = 0; i < 8; i++) {
+                c[i][0] = _mm512_loadu_ps(&C[(size_t)(i0 + i)*ldc + j0]);
+                c[i][1] = _mm512_loadu_ps(&C[(size_t)(i0 + i)*ldc + j0 + 16]);
+            }
+            for (int p = 0; p < kb; p++) {
+                __m512 b0 = _mm512_loadu_ps(&B[(size_t)p*ldb + j0]);
+                __m512 b1 = _mm512_loadu_ps(&B[(size_t)p*ldb + j0 + 16]);
+                #pragma GCC unroll 8
+                for (int i = 0; i < 8; i++) {
+                    __m512 a = _mm512_set1_ps(A[(size_t)(i0 + i)*lda + p]);
+                    c[i][0] = _mm512_fmadd_ps(a, b0, c[i][0]);
+                    c[i][1] = _mm512_fmadd_ps(a, b1, c[i][1]);
+                }
+            }
+            #pragma GCC unroll 8
+            for (int i = 0; i < 8; i++) {
+                _mm512_storeu_ps(&C[(size_t)(i0 + i)*ldc + j0], c[i][0]);
+                _mm512_storeu_ps(&C[(size_t)(i0 + i)*ldc + j0 + 16], c[i][1]);
+            }
+        }
+    }
+    SGEMM_EDGE_LOOP(0, m_full, n_full, nb)
+    SGEMM_EDGE_LOOP(m_full, mb, 0, nb)
+}
+
+__attribute__((target("avx2,fma")))
+static void sgemm_tile_avx2(int mb, int nb, int kb, const float *A, int lda, const float *B, int ldb, float *C, int ldc) {
+    int m_full = mb / 6 * 6, n_full = nb / 16 * 16;
+
+    for (int i0 = 0; i0 < m_full; i0 += 6) {
+        for (int j0 = 0; j0 < n_full; j0 += 16) {
+            __m256 c[6][2];
+            #pragma GCC unroll 6
+            for (int i = 0; i < 6; i++) {
+                c[i][0] = _mm256_loadu_ps(&C[(size_t)(i0 + i)*ldc + j0]);
+                c[i][1] = _mm256_loadu_ps(&C[(size_t)(i0 + i)*ldc + j0 + 8]);
+            }
+            for (int p = 0; p < kb; p++) {
+                __m256 b0 = _mm256_loadu_ps(&B[(size_t)p*ldb + j0]);
+                __m256 b1 = _mm256_loadu_ps(&B[(size_t)p*ldb + j0 + 8]);
+                #pragma GCC unroll 6
+                for (int i = 0; i < 6; i++) {
+                    __m256 a = _mm256_broadcast_ss(&A[(size_t)(i0 + i)*lda + p]);
+                    c[i][0] = _mm256_fmadd_ps(a, b0, c[i][0]);
+                    c[i][1] = _mm256_fmadd_ps(a, b1, c[i][1]);
+                }
+            }
+            #pragma GCC unroll 6
+            for (int i = 0; i < 6; i++) {
+                _mm256_storeu_ps(&C[(size_t)(i0 + i)*ldc + j0], c[i][0]);
+                _mm256_storeu_ps(&C[(size_t)(i0 + i)*ldc + j0 + 8], c[i][1]);
+            }
+        }
+    }
+    SGEMM_EDGE_LOOP(0, m_full, n_full, nb)
+    SGEMM_EDGE_LOOP(m_full, mb, 0, nb)
+}
+#endif
+
+static void sgemm_tile_generic(int mb, int nb, int kb, const float *A, int lda, const float *B, int ldb, float *C, int ldc) {
+    SGEMM_EDGE_LOOP(0, mb, 0, nb)
+}
+
+static sgemm_tile_fn selected_sgemm_tile = sgemm_tile_generic;
+static pthread_once_t sgemm_tile_once = PTHREAD_ONCE_INIT;
+
+static void select_sgemm_tile(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected_sgemm_tile = sgemm_tile_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected_sgemm_tile = sgemm_tile_avx2;
+    }
+#endif
+}
+
+static void sgemm_tile(int mb, int nb, int kb, const float *A, int lda, const float *B, int ldb, float *C, int ldc) {
+    pthread_once(&sgemm_tile_once, select_sgemm_tile);
+    selected_sgemm_tile(mb, nb, kb, A, lda, B, ldb, C, ldc);
+}
+
+// Per-thread float tiles for the converted A/B blocks
+static __thread scratch_t typed_scratch;
+
+#define GT_SUFFIX f32
+#define GT_IN float
+#define GT_CONVERT_ROW convert_row_f32
+#include "gemm_typed.h"
+
+#define GT_SUFFIX bf16
+#define GT_IN bf16_t
+#define GT_CONVERT_ROW convert_row_bf16
+#include "gemm_typed.h"
+
+#ifdef HAVE_FLOAT16
+#define GT_SUFFIX f16
+#define GT_IN f16_t
+#define GT_CONVERT_ROW convert_row_f16
+#include "gemm_typed.h"
+#endif
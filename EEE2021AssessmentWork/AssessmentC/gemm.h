@@ -0,0 +1,336 @@
+/**
+ * libgemm: the GEMM kernels behind the GEMM and OptGEMM benchmarks, as one library.
+ * Everything is row-major double precision with C += A * B unless stated otherwise, A is
+ * m x k, B is k x n and C is m x n. Build with `make` (build/libgemm.a and build/libgemm.so);
+ * with LTO the benchmark programs call these exactly as if the kernels were in their own file.
+ *
+ * Runtime settings come from the environment, as before: GEMM_TUNING_FILE, GEMM_AFFINITY,
+ * MATRIX_ARENA_HUGEPAGES, and GEMM_TRACE (with GEMM_TRACE_EVENTS) for the timeline trace.
+ */
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+// Default number of threads and block size
+#define DEFAULT_NUM_THREADS 4
+#define DEFAULT_BLOCK_SIZE 32
+// Strassen recursion stops at or below this size (strassen_gemm with cutoff <= 0)
+#define DEFAULT_STRASSEN_CUTOFF 512
+#define DEFAULT_TUNING_FILE "gemm_tuning.txt"
+
+/* Matrix setup ----------------------------------------------------------------------- */
+
+// A and B uniform in [0, 1) from a counter-based RNG, C zeroed, all from the matrix arena
+void init_matrices(int m, int n, int k, double **A, double **B, double **C);
+void reset_matrix_c(double *C, int m, int n);
+void free_matrices(double *A, double *B, double *C);
+void set_matrix_seed(uint64_t seed);
+// Workers used by init_matrices and reset_matrix_c (1 = calling thread only)
+void set_setup_threads(int num_threads);
+// How the matrix arena got its memory ("huge pages", "THP", ...)
+const char* matrix_arena_backing(void);
+// Elements [first, first + count) of the uniform [0, 1) stream for key, the values init_matrices uses
+void fill_uniform(double *dst, size_t count, uint64_t key, size_t first);
+
+// Monotonic wall clock in seconds
+double get_time(void);
+
+/* Threads and placement --------------------------------------------------------------- */
+
+typedef enum { AFFINITY_NONE, AFFINITY_COMPACT, AFFINITY_SCATTER } affinity_policy_t;
+
+// "none", "compact" or "scatter"; returns 0, or -1 for an unknown name
+int set_affinity_policy(const char *name);
+// The policy in effect, and the CPUs and NUMA nodes it spreads the workers over
+affinity_policy_t get_affinity_policy(int *num_cpus, int *num_nodes);
+
+/*
+ * Thread safety: the compute entry points below may be called from several threads at once.
+ * Their jobs take turns on the shared pool and the multithreaded paths' scratch belongs to
+ * the calling thread. Not thread-safe, call them before the compute starts: the set_* calls
+ * (set_blocking, set_gemm_threads, set_setup_threads, set_matrix_seed, set_affinity_policy,
+ * set_async_threads), load_tuning_file, save_tuning_file and autotune. A pool_run task may
+ * not start another job on the same pool, and a pool must be idle when it is destroyed.
+ */
+typedef struct thread_pool thread_pool_t;
+typedef void *(*pool_task_fn)(void *);
+
+// The shared worker pool, grown to at least num_threads workers (safe from any thread)
+thread_pool_t* get_gemm_pool(int num_threads);
+// A private pool for work that runs alongside the shared one; the creating thread is worker 0
+thread_pool_t* pool_create(int num_threads);
+// Same, with worker t pinned to the (cpu_offset + t)th CPU of the affinity order, the
+// thread calling pool_run pinned for the job only if pin_caller is set, and the workers'
+// trace lanes named "<trace_name> worker t" (a string literal)
+thread_pool_t* pool_create_on(int num_threads, int cpu_offset, int pin_caller, const char *trace_name);
+void pool_destroy(thread_pool_t *pool);
+// Worker t runs task(args + t * arg_size) for t = 1..num_workers-1, the caller runs args
+void pool_run(thread_pool_t *pool, int num_workers, pool_task_fn task, void *args, size_t arg_size);
+// Kernel thread ids of the workers (the caller's included); returns how many
+int pool_thread_ids(thread_pool_t *pool, pid_t *tids);
+
+/**
+ * Timeline tracing (gemm_trace.c): per-thread pool tasks, wake-up latency, the caller's
+ * barrier wait, packing and every tile of the multithreaded paths, dumped as Chrome trace
+ * JSON. Off by default and close to free while off. GEMM_TRACE=file traces a whole run.
+ */
+// Drops earlier events and starts recording, events_per_thread per ring (0 = 65536)
+void gemm_trace_start(size_t events_per_thread);
+void gemm_trace_stop(void);
+// Writes the recorded events (call with no GEMM running); returns how many, or -1
+long gemm_trace_dump(const char *path);
+
+/* Micro-kernels and blocking ----------------------------------------------------------- */
+
+typedef void (*ukernel_fn)(int kc, const double *Ap, const double *Bp, double *C, int ldc);
+
+typedef struct {
+    const char *name;
+    int mr, nr;
+    ukernel_fn fn;
+} ukernel_t;
+
+typedef struct {
+    int mc, kc, nc;
+} blocking_t;
+
+typedef struct {
+    long l1d, l2, l3;   // bytes
+} cache_sizes_t;
+
+// Widest micro-kernel the CPU supports, or NULL if it only has the scalar loops
+const ukernel_t* get_ukernel(void);
+const ukernel_t* get_ukernel_or_scalar(void);
+cache_sizes_t detect_cache_sizes(void);
+blocking_t compute_blocking(cache_sizes_t cs, int mr, int nr);
+blocking_t get_blocking(const ukernel_t *uk);
+// Overrides the cache blocking (0 keeps the computed value)
+void set_blocking(int mc, int kc, int nc);
+
+/* Kernels ----------------------------------------------------------------------------- */
+
+// The six loop orderings of the naive triple loop
+void mnk_gemm(int m, int n, int k, double *A, double *B, double *C);
+void mkn_gemm(int m, int n, int k, double *A, double *B, double *C);
+void nmk_gemm(int m, int n, int k, double *A, double *B, double *C);
+void nkm_gemm(int m, int n, int k, double *A, double *B, double *C);
+void kmn_gemm(int m, int n, int k, double *A, double *B, double *C);
+void knm_gemm(int m, int n, int k, double *A, double *B, double *C);
+
+void scalar_blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int block_size);
+void blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int block_size);
+void mt_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads);
+void mt_blocked_mnk_gemm(int m, int n, int k, double *A, double *B, double *C, int num_threads, int block_size);
+
+/**
+ * Fused epilogue for the blocked and MT+Blocked paths. Once an element of C has its full
+ * sum it becomes act(scale * c + bias[j]), and is also stored as float to out if set.
+ * It runs on each tile as it finishes, while the tile is still in cache, instead of as
+ * extra passes over C. Start from GEMM_EPILOGUE_INIT and set what's needed.
+ */
+typedef enum { GEMM_ACT_NONE, GEMM_ACT_RELU } gemm_activation_t;
+
+typedef struct {
+    double scale;            // 1.0 leaves C as it is
+    const double *bias;      // n values, bias[j] added to column j (NULL for none)
+    gemm_activation_t act;
+    float *out;              // m x n row-major copy of the result with leading dimension ldo (NULL for none)
+    int ldo;
+} gemm_epilogue_t;
+
+#define GEMM_EPILOGUE_INIT {1.0, NULL, GEMM_ACT_NONE, NULL, 0}
+
+void blocked_mnk_gemm_ep(int m, int n, int k, double *A, double *B, double *C, int block_size,
+                         const gemm_epilogue_t *ep);
+void mt_blocked_mnk_gemm_ep(int m, int n, int k, double *A, double *B, double *C, int num_threads, int block_size,
+                            const gemm_epilogue_t *ep);
+
+// Square sizes with a fully unrolled kernel (gemm_fixed.c, same order as its tables)
+#define FIXED_GEMM_SIZES 4, 8, 10, 16, 20, 30, 32
+// C += alpha * A * B if m = n = k is one of FIXED_GEMM_SIZES; returns 0 (C untouched) otherwise
+int fixed_gemm(int m, int n, int k, double alpha, const double *A, const double *B, double *C);
+// fixed_gemm, falling back to mnk_gemm for every other shape
+void fixed_mnk_gemm(int m, int n, int k, double *A, double *B, double *C);
+
+// C += alpha * A * B with arbitrary strides for A and B (C row-major with leading dimension ldc)
+void packed_gemm(const ukernel_t *uk, int m, int n, int k, double alpha,
+                 const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                 double *C, int ldc);
+void mt_packed_gemm(const ukernel_t *uk, int m, int n, int k, double alpha,
+                    const double *A, int rsa, int csa, const double *B, int rsb, int csb,
+                    double *C, int ldc, int num_threads);
+
+// Memory-bound shapes (gemm_level2.c), element (i, p) of each matrix at M[i * rs + p * cs]
+// y += alpha * M * x, M m x k, rows split over the pool when M is large
+void gemv(int m, int k, double alpha, const double *M, int rs, int cs, const double *x, int incx,
+          double *y, int incy, int num_threads);
+// C += alpha * X * Y for a small k, C m x n row-major, split over the pool along the longer side
+void rank_k_update(int m, int n, int k, double alpha, const double *X, int rsx, int csx,
+                   const double *Y, int rsy, int csy, double *C, int ldc, int num_threads);
+
+typedef enum { GEMM_ROW_MAJOR, GEMM_COL_MAJOR } gemm_layout_t;
+typedef enum { GEMM_NO_TRANS, GEMM_TRANS } gemm_trans_t;
+
+// Threads dgemm_general may use
+void set_gemm_threads(int num_threads);
+// C = alpha * op(A) * op(B) + beta * C; returns 0, or -i if argument i is invalid
+int dgemm_general(gemm_layout_t layout, gemm_trans_t trans_a, gemm_trans_t trans_b,
+                  int m, int n, int k, double alpha, const double *A, int lda,
+                  const double *B, int ldb, double beta, double *C, int ldc);
+
+// C[b] += A[b] * B[b] for b < batch, whole products spread over the threads
+void batched_gemm(int batch, int m, int n, int k, double **A, double **B, double **C, int num_threads);
+void strided_batched_gemm(int batch, int m, int n, int k, const double *A, long stride_a,
+                          const double *B, long stride_b, double *C, long stride_c, int num_threads);
+
+/**
+ * Asynchronous GEMM (gemm_async.c): gemm_submit queues C += A * B (row-major, packed) on a
+ * persistent pool of its own and returns at once. It starts when every future in deps
+ * has completed, so the C of one submit can be the A or B of the next; independent
+ * submits share the workers. Operands must stay valid until the future is done.
+ */
+typedef struct gemm_future gemm_future_t;
+
+// Workers for the asynchronous pool (default: online CPUs); only before the first submit
+void set_async_threads(int num_threads);
+// Returns NULL if out of memory
+gemm_future_t* gemm_submit(int m, int n, int k, const double *A, const double *B, double *C,
+                           gemm_future_t *const *deps, int num_deps);
+int gemm_done(gemm_future_t *f);
+void gemm_wait(gemm_future_t *f);
+// Waits for f, then frees it
+void gemm_future_free(gemm_future_t *f);
+
+// n x n Strassen-Winograd, C += A * B
+void strassen_gemm(int n, const double *A, const double *B, double *C, int cutoff);
+
+/* Sparse A (gemm_sparse.c) ------------------------------------------------------------ */
+
+// CSR: row i's nonzeros are col_idx[row_ptr[i] .. row_ptr[i + 1]) with the matching values
+typedef struct {
+    int rows, cols;
+    long nnz;
+    long *row_ptr;       // rows + 1 entries
+    int *col_idx;
+    double *values;
+} csr_matrix_t;
+
+// Dense row-major m x k to CSR (exact zeros dropped); returns 0, or -1 if out of memory
+int dense_to_csr(int m, int k, const double *A, csr_matrix_t *csr);
+void free_csr(csr_matrix_t *csr);
+// C += A * B with A in CSR, B dense A->cols x n and C dense A->rows x n
+void csr_gemm(const csr_matrix_t *A, int n, const double *B, double *C);
+// csr_gemm over the pool, with the row ranges balanced by nonzeros
+void mt_csr_gemm(const csr_matrix_t *A, int n, const double *B, double *C, int num_threads);
+
+/* Out of core (gemm_ooc.c) ------------------------------------------------------------ */
+
+/**
+ * Matrix files: a 32-byte header ("GEMMMAT1", then rows and cols as 64-bit integers)
+ * followed by the rows x cols doubles in row-major order. Tiles are read and written
+ * with pread/pwrite, so a file is never mapped or loaded whole.
+ */
+#define GEMM_MATRIX_MAGIC "GEMMMAT1"
+
+typedef struct {
+    int fd;
+    int rows, cols;
+} matrix_file_t;
+
+typedef struct {
+    int tile_m, tile_n, tile_k;   // tile sizes picked for the memory budget
+    double seconds;
+    double io_wait;               // seconds the compute thread spent waiting on I/O
+    double bytes_read, bytes_written;
+} ooc_stats_t;
+
+// Creates (or truncates) a rows x cols file of zeros; returns 0, or -1 with a message on stderr
+int matrix_file_create(matrix_file_t *f, const char *path, int rows, int cols);
+// Opens an existing matrix file read/write; returns -1 if it's missing or malformed
+int matrix_file_open(matrix_file_t *f, const char *path);
+void matrix_file_close(matrix_file_t *f);
+// rows x cols tile at (r0, c0) to or from a buffer with leading dimension ld; 0 or -1
+int matrix_file_read_tile(const matrix_file_t *f, int r0, int c0, int rows, int cols, double *dst, int ld);
+int matrix_file_write_tile(const matrix_file_t *f, int r0, int c0, int rows, int cols, const double *src, int ld);
+// C = A * B with about mem_bytes of tile buffers, prefetching the next tiles during compute
+int ooc_gemm(const matrix_file_t *A, const matrix_file_t *B, const matrix_file_t *C,
+             size_t mem_bytes, int num_threads, ooc_stats_t *stats);
+
+/* Autotuning -------------------------------------------------------------------------- */
+
+typedef enum {
+    TUNE_MNK,
+    TUNE_SCALAR_BLOCKED,
+    TUNE_MT_MNK,
+    TUNE_PACKED,
+    TUNE_MT_PACKED,
+    TUNE_NUM_VARIANTS
+} tune_variant_t;
+
+typedef struct {
+    tune_variant_t variant;
+    int block_size;       // scalar_blocked only, 0 otherwise
+    int num_threads;
+} tune_candidate_t;
+
+typedef struct {
+    int valid;
+    tune_candidate_t choice;
+    double seconds;       // best time seen for a shape in this bucket
+} tune_entry_t;
+
+// Returns the number of entries loaded, or -1 if the file can't be read
+int load_tuning_file(const char *path);
+int save_tuning_file(const char *path);
+const tune_entry_t* lookup_tuning(int m, int n, int k);
+void run_tune_candidate(const tune_candidate_t *c, int m, int n, int k, double *A, double *B, double *C);
+// Benchmarks every candidate on sizes x sizes x sizes and writes the winners to path
+void autotune(const int *sizes, int num_sizes, int max_threads, const char *path);
+
+/* Reduced precision ------------------------------------------------------------------- */
+
+/**
+ * float, bf16 and fp16 inputs, all accumulated in fp32 into a float C.
+ * bf16 is stored as the top 16 bits of an IEEE float; fp16 uses the compiler's _Float16.
+ */
+typedef uint16_t bf16_t;
+#if defined(__FLT16_MAX__)
+#define HAVE_FLOAT16 1
+typedef _Float16 f16_t;
+#endif
+
+static inline float bf16_to_float(bf16_t h) {
+    uint32_t u = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// Round to nearest even, NaNs stay NaNs
+static inline bf16_t float_to_bf16(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    if ((u & 0x7fffffff) > 0x7f800000) {
+        return (bf16_t)((u >> 16) | 0x40);
+    }
+    u += 0x7fff + ((u >> 16) & 1);
+    return (bf16_t)(u >> 16);
+}
+
+void blocked_mnk_gemm_f32(int m, int n, int k, const float *A, const float *B, float *C, int block_size);
+void mt_blocked_mnk_gemm_f32(int m, int n, int k, const float *A, const float *B, float *C,
+                             int num_threads, int block_size);
+void blocked_mnk_gemm_bf16(int m, int n, int k, const bf16_t *A, const bf16_t *B, float *C, int block_size);
+void mt_blocked_mnk_gemm_bf16(int m, int n, int k, const bf16_t *A, const bf16_t *B, float *C,
+                              int num_threads, int block_size);
+#ifdef HAVE_FLOAT16
+void blocked_mnk_gemm_f16(int m, int n, int k, const f16_t *A, const f16_t *B, float *C, int block_size);
+void mt_blocked_mnk_gemm_f16(int m, int n, int k, const f16_t *A, const f16_t *B, float *C,
+                             int num_threads, int block_size);
+#endif
+
+#endif
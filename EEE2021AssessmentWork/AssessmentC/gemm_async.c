@@ -0,0 +1,259 @@
+/**
+ * Asynchronous GEMM: gemm_submit() queues C += A * B and returns a future straight away;
+ * a submit can name futures it has to wait for, so C of one multiply can feed A (or B)
+ * of the next without the caller blocking in between.
+ *
+ * The work runs on a persistent pool of its own, driven by one background thread. While
+ * anything is outstanding, every pool worker loops taking pieces of ready multiplies off
+ * a shared queue, like batched_gemm hands out whole matrices. A multiply is cut into row
+ * chunks (at least ASYNC_MIN_PIECE_FLOPS each, at most two per worker), so a big one still
+ * uses all the cores and several small ones run side by side. When the last piece of a
+ * multiply finishes, the multiplies waiting on it whose other dependencies are done join
+ * the queue. Once nothing is outstanding the workers leave the job and the pool sleeps.
+ *
+ * Everything here is under one mutex; pieces are big enough that it's never contended
+ * for long. The pool is separate from the one the synchronous MT kernels use, so calling
+ * both at once shares the cores between them; when workers are pinned, the async ones
+ * start from the other end of the CPU list.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "gemm.h"
+
+#define ASYNC_MIN_PIECE_FLOPS (2.0 * 64 * 64 * 64)
+#define ASYNC_PIECES_PER_THREAD 2
+
+struct gemm_future {
+    int m, n, k;
+    const double *A, *B;
+    double *C;
+    int rows_per_piece;
+    int num_pieces, next_piece, pieces_left;
+    int deps_left;            // unfinished futures this one waits for
+    gemm_future_t **dependents;
+    int num_dependents, cap_dependents;
+    gemm_future_t *next_ready;
+    int done;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;       // workers: a piece became ready, or everything is done
+    pthread_cond_t submitted;  // driver: there's something to start the pool for
+    pthread_cond_t finished;   // gemm_wait: some future completed
+    gemm_future_t *ready_head, *ready_tail;
+    int outstanding;           // submitted and not yet done
+    int num_threads;           // 0 until the driver is started
+    int shutdown;
+    pthread_t driver;
+} async = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0};
+
+static int async_threads_requested = 0;
+
+// Caller holds the lock
+static void push_ready(gemm_future_t *f) {
+    f->next_ready = NULL;
+    if (async.ready_tail != NULL) {
+        async.ready_tail->next_ready = f;
+    } else {
+        async.ready_head = f;
+    }
+    async.ready_tail = f;
+    pthread_cond_broadcast(&async.work);
+}
+
+// Caller holds the lock: marks f done and releases whatever was waiting on it
+static void complete(gemm_future_t *f) {
+    for (int d = 0; d < f->num_dependents; d++) {
+        if (--f->dependents[d]->deps_left == 0) {
+            push_ready(f->dependents[d]);
+        }
+    }
+    free(f->dependents);
+    f->dependents = NULL;
+    f->num_dependents = 0;
+    f->done = 1;
+    if (--async.outstanding == 0) {
+        pthread_cond_broadcast(&async.work);
+    }
+    pthread_cond_broadcast(&async.finished);
+}
+
+// Pool task: run pieces until nothing is outstanding
+static void* async_worker(void *arg) {
+    (void)arg;
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    pthread_mutex_lock(&async.lock);
+    for (;;) {
+        while (async.ready_head == NULL && async.outstanding > 0) {
+            pthread_cond_wait(&async.work, &async.lock);
+        }
+        if (async.ready_head == NULL) {
+            break;
+        }
+        gemm_future_t *f = async.ready_head;
+        int piece = f->next_piece++;
+        if (f->next_piece == f->num_pieces) {
+            async.ready_head = f->next_ready;
+            if (async.ready_head == NULL) {
+                async.ready_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&async.lock);
+
+        int r0 = piece * f->rows_per_piece;
+        int rows = (r0 + f->rows_per_piece < f->m) ? f->rows_per_piece : f->m - r0;
+        if (rows > 0 && f->n > 0 && f->k > 0) {
+            packed_gemm(uk, rows, f->n, f->k, 1.0, f->A + (size_t)r0 * f->k, f->k, 1, f->B, f->n, 1,
+                        f->C + (size_t)r0 * f->n, f->n);
+        }
+
+        pthread_mutex_lock(&async.lock);
+        if (--f->pieces_left == 0) {
+            complete(f);
+        }
+    }
+    pthread_mutex_unlock(&async.lock);
+    return NULL;
+}
+
+static void* async_driver(void *arg) {
+    (void)arg;
+    // Created here so this thread is worker 0 of the pool, like the caller of pool_run always
+    // is. With pinning on, the workers take the CPUs at the end of the affinity order (the
+    // shared pool fills it from the front) and this thread stays unpinned.
+    int num_cpus = 0;
+    get_affinity_policy(&num_cpus, NULL);
+    int offset = (num_cpus > async.num_threads) ? num_cpus - async.num_threads : 0;
+    thread_pool_t *pool = pool_create_on(async.num_threads, offset, 0, "async");
+    pthread_mutex_lock(&async.lock);
+    for (;;) {
+        while (async.outstanding == 0 && !async.shutdown) {
+            pthread_cond_wait(&async.submitted, &async.lock);
+        }
+        if (async.outstanding == 0) {
+            break;
+        }
+        pthread_mutex_unlock(&async.lock);
+        pool_run(pool, async.num_threads, async_worker, NULL, 0);
+        pthread_mutex_lock(&async.lock);
+    }
+    pthread_mutex_unlock(&async.lock);
+    pool_destroy(pool);
+    return NULL;
+}
+
+// Lets queued work finish, then stops the driver and its pool
+static void async_shutdown(void) {
+    pthread_mutex_lock(&async.lock);
+    async.shutdown = 1;
+    pthread_cond_signal(&async.submitted);
+    pthread_mutex_unlock(&async.lock);
+    pthread_join(async.driver, NULL);
+}
+
+/**
+ * Workers for the asynchronous pool (default: one per online CPU). Only has an effect
+ * before the first gemm_submit.
+ */
+void set_async_threads(int num_threads) {
+    async_threads_requested = (num_threads > 0) ? num_threads : 0;
+}
+
+/**
+ * Queues C += A * B (row-major, A m x k, B k x n, C m x n, all packed) to run once every
+ * future in deps (num_deps of them, may be 0) has completed. The operands must stay
+ * valid, and C untouched by anyone else, until the returned future is done. Two
+ * multiplies into the same C must be ordered through deps. Returns NULL if out of memory.
+ */
+gemm_future_t* gemm_submit(int m, int n, int k, const double *A, const double *B, double *C,
+                           gemm_future_t *const *deps, int num_deps) {
+    gemm_future_t *f = (gemm_future_t *)calloc(1, sizeof(gemm_future_t));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->m = m;
+    f->n = n;
+    f->k = k;
+    f->A = A;
+    f->B = B;
+    f->C = C;
+
+    pthread_mutex_lock(&async.lock);
+    if (async.num_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        async.num_threads = (async_threads_requested > 0) ? async_threads_requested
+                                                          : (cores > 0 ? (int)cores : DEFAULT_NUM_THREADS);
+        pthread_create(&async.driver, NULL, async_driver, NULL);
+        atexit(async_shutdown);
+    }
+
+    // Row chunks: big enough to be worth a hand-off, small enough to spread over the pool
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    double flops = 2.0 * m * n * k;
+    int pieces = (int)(flops / ASYNC_MIN_PIECE_FLOPS);
+    int most = async.num_threads * ASYNC_PIECES_PER_THREAD;
+    if (pieces > most) pieces = most;
+    if (pieces > m) pieces = m;
+    if (pieces < 1) pieces = 1;
+    int rows = (m + pieces - 1) / pieces;
+    f->rows_per_piece = (rows + uk->mr - 1) / uk->mr * uk->mr;
+    if (f->rows_per_piece < 1) f->rows_per_piece = 1;
+    f->num_pieces = (m > 0) ? (m + f->rows_per_piece - 1) / f->rows_per_piece : 1;
+    f->pieces_left = f->num_pieces;
+
+    for (int d = 0; d < num_deps; d++) {
+        gemm_future_t *dep = deps[d];
+        if (dep == NULL || dep->done) {
+            continue;
+        }
+        if (dep->num_dependents == dep->cap_dependents) {
+            int cap = dep->cap_dependents ? 2 * dep->cap_dependents : 4;
+            gemm_future_t **grown = (gemm_future_t **)realloc(dep->dependents, cap * sizeof(gemm_future_t *));
+            if (grown == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            dep->dependents = grown;
+            dep->cap_dependents = cap;
+        }
+        dep->dependents[dep->num_dependents++] = f;
+        f->deps_left++;
+    }
+
+    async.outstanding++;
+    if (f->deps_left == 0) {
+        push_ready(f);
+    }
+    pthread_cond_signal(&async.submitted);
+    pthread_mutex_unlock(&async.lock);
+    return f;
+}
+
+// 1 if f has completed, 0 if it's still queued or running
+int gemm_done(gemm_future_t *f) {
+    pthread_mutex_lock(&async.lock);
+    int done = f->done;
+    pthread_mutex_unlock(&async.lock);
+    return done;
+}
+
+void gemm_wait(gemm_future_t *f) {
+    pthread_mutex_lock(&async.lock);
+    while (!f->done) {
+        pthread_cond_wait(&async.finished, &async.lock);
+    }
+    pthread_mutex_unlock(&async.lock);
+}
+
+// Waits for f if needed and frees it; f can't be used as a dependency after this
+void gemm_future_free(gemm_future_t *f) {
+    if (f == NULL) {
+        return;
+    }
+    gemm_wait(f);
+    free(f);
+}
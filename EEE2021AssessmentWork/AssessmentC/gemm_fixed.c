@@ -0,0 +1,109 @@
+/**
+ * Fixed-size kernels for the small square shapes at the low end of the sweeps.
+ * At 10x10 the generic loops spend more time on bounds, index arithmetic and (for the
+ * packed path) packing than on the 2000 flops themselves. Here M = N = K is a compile-time
+ * constant, so the compiler unrolls everything, keeps a row of C in registers for the
+ * whole k loop and vectorises across it; the ragged tail of 10, 20 and 30 becomes a
+ * fixed masked or scalar step instead of a loop.
+ *
+ * One copy per ISA comes out of the same macro and the widest one is picked at runtime,
+ * like the micro-kernels. The order of the additions is the same as mnk_gemm's.
+ */
+#include <stddef.h>
+#include <pthread.h>
+#include "gemm.h"
+
+typedef void (*fixed_gemm_fn)(double alpha, const double *restrict A, const double *restrict B, double *restrict C);
+
+#define FIXED_GEMM_KERNEL(N, isa, attr) \
+    attr static void fixed_gemm_##N##_##isa(double alpha, const double *restrict A, const double *restrict B, \
+                                             double *restrict C) { \
+        for (int i = 0; i < N; i++) { \
+            double c[N]; \
+            _Pragma("GCC unroll 32") \
+            for (int j = 0; j < N; j++) c[j] = C[i*N + j]; \
+            _Pragma("GCC unroll 32") \
+            for (int p = 0; p < N; p++) { \
+                double a = alpha * A[i*N + p]; \
+                _Pragma("GCC unroll 32") \
+                for (int j = 0; j < N; j++) c[j] += a * B[p*N + j]; \
+            } \
+            _Pragma("GCC unroll 32") \
+            for (int j = 0; j < N; j++) C[i*N + j] = c[j]; \
+        } \
+    }
+
+// Every size in FIXED_GEMM_SIZES, for one ISA
+#define FIXED_GEMM_KERNELS(isa, attr) \
+    FIXED_GEMM_KERNEL(4, isa, attr) \
+    FIXED_GEMM_KERNEL(8, isa, attr) \
+    FIXED_GEMM_KERNEL(10, isa, attr) \
+    FIXED_GEMM_KERNEL(16, isa, attr) \
+    FIXED_GEMM_KERNEL(20, isa, attr) \
+    FIXED_GEMM_KERNEL(30, isa, attr) \
+    FIXED_GEMM_KERNEL(32, isa, attr) \
+    static const fixed_gemm_fn fixed_kernels_##isa[] = { \
+        fixed_gemm_4_##isa, fixed_gemm_8_##isa, fixed_gemm_10_##isa, fixed_gemm_16_##isa, \
+        fixed_gemm_20_##isa, fixed_gemm_30_##isa, fixed_gemm_32_##isa, \
+    };
+
+static const int fixed_sizes[] = {FIXED_GEMM_SIZES};
+#define NUM_FIXED_SIZES ((int)(sizeof(fixed_sizes) / sizeof(fixed_sizes[0])))
+
+FIXED_GEMM_KERNELS(generic, )
+#if defined(__x86_64__) || defined(__i386__)
+FIXED_GEMM_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+FIXED_GEMM_KERNELS(avx512, __attribute__((target("avx512f"))))
+#endif
+
+static const fixed_gemm_fn *selected_fixed_kernels = fixed_kernels_generic;
+static pthread_once_t fixed_kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_fixed_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected_fixed_kernels = fixed_kernels_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected_fixed_kernels = fixed_kernels_avx2;
+    }
+#endif
+}
+
+static const fixed_gemm_fn* fixed_kernels(void) {
+    pthread_once(&fixed_kernels_once, select_fixed_kernels);
+    return selected_fixed_kernels;
+}
+
+static int fixed_index(int m, int n, int k) {
+    if (m != n || n != k) {
+        return -1;
+    }
+    for (int i = 0; i < NUM_FIXED_SIZES; i++) {
+        if (fixed_sizes[i] == m) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * C += alpha * A * B through the fixed-size kernel when there is one for the shape.
+ * alpha scales A as it's read, like the packing does. Returns 0 if there isn't a kernel
+ * (C is left alone).
+ */
+int fixed_gemm(int m, int n, int k, double alpha, const double *A, const double *B, double *C) {
+    int i = fixed_index(m, n, k);
+    if (i < 0) {
+        return 0;
+    }
+    fixed_kernels()[i](alpha, A, B, C);
+    return 1;
+}
+
+// Same contract as mnk_gemm, so it can sit in the same benchmark and tuning slots
+void fixed_mnk_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    if (!fixed_gemm(m, n, k, 1.0, A, B, C)) {
+        mnk_gemm(m, n, k, A, B, C);
+    }
+}
@@ -0,0 +1,360 @@
+/**
+ * Matrix-vector (GEMV) and rank-k update kernels for the degenerate shapes dgemm_general
+ * sees: n == 1 or m == 1, and k of a few columns.
+ *
+ * These are memory-bound. A GEMV reads every element of the matrix once and does one FMA
+ * with it, and a rank-k update reads and writes every element of C for only 2k flops, so
+ * packing panels and walking the cache-blocking loops of the GEMM driver is pure overhead.
+ * Here each kernel streams its operand once with unit stride, with enough independent
+ * accumulators to keep the loads in flight, and the pool splits the long dimension.
+ *
+ * Like gemm_fixed.c, the kernels come out of one macro per ISA (the dot products are
+ * written with intrinsics instead) and the widest copy the CPU supports is picked at runtime.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "gemm.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Below this many matrix (GEMV) or C (rank-k) elements the kernels stay on the calling thread
+#define LEVEL2_MT_MIN (1L << 17)
+// Rows per worker are a multiple of this, so the four-row GEMV kernel keeps its shape
+#define LEVEL2_ROW_GRAIN 8
+// Rows of the column-access GEMV done per pass, so that slice of the result stays in L1
+#define GEMV_COL_TILE 512
+
+typedef void (*gemv_dot_fn)(int rows, int k, double alpha, const double *M, long rs, const double *x, double *y,
+                            long incy);
+typedef void (*gemv_axpy_fn)(int rows, int k, double alpha, const double *M, long cs, const double *x, double *y,
+                             long incy);
+typedef void (*rank_k_fn)(int rows, int cols, int k, double alpha, const double *X, long rsx, long csx,
+                          const double *Y, long rsy, double *C, long ldc);
+
+typedef struct {
+    gemv_dot_fn dot;
+    gemv_axpy_fn axpy;
+    rank_k_fn rank_k;
+} level2_kernels_t;
+
+#define LEVEL2_KERNELS(isa, attr) \
+    /* y[i] += alpha * M(i, :) . x with the columns of M contiguous: axpys of four columns at a time, */ \
+    /* summed for one tile of rows in L1 and added to y once */ \
+    attr static void gemv_axpy_##isa(int rows, int k, double alpha, const double *restrict M, long cs, \
+                                     const double *restrict x, double *restrict y, long incy) { \
+        double tt[GEMV_COL_TILE]; \
+        for (int i0 = 0; i0 < rows; i0 += GEMV_COL_TILE) { \
+            int ni = (i0 + GEMV_COL_TILE < rows) ? GEMV_COL_TILE : rows - i0; \
+            for (int i = 0; i < ni; i++) tt[i] = 0.0; \
+            int p = 0; \
+            for (; p + 4 <= k; p += 4) { \
+                const double *c0 = M + p * cs + i0, *c1 = c0 + cs, *c2 = c1 + cs, *c3 = c2 + cs; \
+                double x0 = x[p], x1 = x[p + 1], x2 = x[p + 2], x3 = x[p + 3]; \
+                for (int i = 0; i < ni; i++) tt[i] += x0 * c0[i] + x1 * c1[i] + x2 * c2[i] + x3 * c3[i]; \
+            } \
+            for (; p < k; p++) { \
+                const double *c0 = M + p * cs + i0; \
+                double x0 = x[p]; \
+                for (int i = 0; i < ni; i++) tt[i] += x0 * c0[i]; \
+            } \
+            for (int i = 0; i < ni; i++) y[(i0 + i) * incy] += alpha * tt[i]; \
+        } \
+    } \
+    \
+    /* C(i, :) += alpha * X(i, :) * Y for rows x cols of C, Y rows contiguous, C streamed once per 4 of k */ \
+    attr static void rank_k_##isa(int rows, int cols, int k, double alpha, const double *restrict X, long rsx, \
+                                  long csx, const double *restrict Y, long rsy, double *restrict C, long ldc) { \
+        for (int i = 0; i < rows; i++) { \
+            double *restrict c = C + i * ldc; \
+            const double *xi = X + i * rsx; \
+            int p = 0; \
+            for (; p + 4 <= k; p += 4) { \
+                double a0 = alpha * xi[p * csx], a1 = alpha * xi[(p + 1) * csx]; \
+                double a2 = alpha * xi[(p + 2) * csx], a3 = alpha * xi[(p + 3) * csx]; \
+                const double *y0 = Y + p * rsy, *y1 = y0 + rsy, *y2 = y1 + rsy, *y3 = y2 + rsy; \
+                for (int j = 0; j < cols; j++) c[j] += a0 * y0[j] + a1 * y1[j] + a2 * y2[j] + a3 * y3[j]; \
+            } \
+            for (; p < k; p++) { \
+                double a0 = alpha * xi[p * csx]; \
+                const double *y0 = Y + p * rsy; \
+                for (int j = 0; j < cols; j++) c[j] += a0 * y0[j]; \
+            } \
+        } \
+    } \
+    static const level2_kernels_t level2_kernels_##isa = {gemv_dot_##isa, gemv_axpy_##isa, rank_k_##isa};
+
+/**
+ * y[i] += alpha * M(i, :) . x with the rows of M contiguous. The compiler won't reorder a sum, so
+ * the SIMD versions below are written out: four rows share each load of x, each with two
+ * vector accumulators, and the lanes are only added up at the end of the row.
+ */
+static void gemv_dot_generic(int rows, int k, double alpha, const double *restrict M, long rs,
+                             const double *restrict x, double *restrict y, long incy) {
+    for (int i = 0; i < rows; i++) {
+        const double *m0 = M + i * rs;
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        int p = 0;
+        for (; p + 4 <= k; p += 4) {
+            s0 += m0[p] * x[p];
+            s1 += m0[p + 1] * x[p + 1];
+            s2 += m0[p + 2] * x[p + 2];
+            s3 += m0[p + 3] * x[p + 3];
+        }
+        for (; p < k; p++) s0 += m0[p] * x[p];
+        y[i * incy] += alpha * ((s0 + s1) + (s2 + s3));
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static void gemv_dot_avx512(int rows, int k, double alpha, const double *restrict M, long rs,
+                            const double *restrict x, double *restrict y, long incy) {
+    __mmask8 tail = (__mmask8)((1u << (k & 7)) - 1);
+    int i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        const double *m[4] = {M + i * rs, M + (i + 1) * rs, M + (i + 2) * rs, M + (i + 3) * rs};
+        __m512d s[4][2];
+        for (int r = 0; r < 4; r++) s[r][0] = s[r][1] = _mm512_setzero_pd();
+        int p = 0;
+        for (; p + 16 <= k; p += 16) {
+            __m512d x0 = _mm512_loadu_pd(x + p), x1 = _mm512_loadu_pd(x + p + 8);
+            for (int r = 0; r < 4; r++) {
+                s[r][0] = _mm512_fmadd_pd(_mm512_loadu_pd(m[r] + p), x0, s[r][0]);
+                s[r][1] = _mm512_fmadd_pd(_mm512_loadu_pd(m[r] + p + 8), x1, s[r][1]);
+            }
+        }
+        if (p + 8 <= k) {
+            __m512d x0 = _mm512_loadu_pd(x + p);
+            for (int r = 0; r < 4; r++) s[r][0] = _mm512_fmadd_pd(_mm512_loadu_pd(m[r] + p), x0, s[r][0]);
+            p += 8;
+        }
+        if (p < k) {
+            __m512d x0 = _mm512_maskz_loadu_pd(tail, x + p);
+            for (int r = 0; r < 4; r++) s[r][1] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, m[r] + p), x0, s[r][1]);
+        }
+        for (int r = 0; r < 4; r++) y[(i + r) * incy] += alpha * _mm512_reduce_add_pd(_mm512_add_pd(s[r][0], s[r][1]));
+    }
+    gemv_dot_generic(rows - i, k, alpha, M + i * rs, rs, x, y + i * incy, incy);
+}
+
+__attribute__((target("avx2,fma")))
+static void gemv_dot_avx2(int rows, int k, double alpha, const double *restrict M, long rs,
+                          const double *restrict x, double *restrict y, long incy) {
+    int i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        const double *m[4] = {M + i * rs, M + (i + 1) * rs, M + (i + 2) * rs, M + (i + 3) * rs};
+        __m256d s[4][2];
+        for (int r = 0; r < 4; r++) s[r][0] = s[r][1] = _mm256_setzero_pd();
+        int p = 0;
+        for (; p + 8 <= k; p += 8) {
+            __m256d x0 = _mm256_loadu_pd(x + p), x1 = _mm256_loadu_pd(x + p + 4);
+            for (int r = 0; r < 4; r++) {
+                s[r][0] = _mm256_fmadd_pd(_mm256_loadu_pd(m[r] + p), x0, s[r][0]);
+                s[r][1] = _mm256_fmadd_pd(_mm256_loadu_pd(m[r] + p + 4), x1, s[r][1]);
+            }
+        }
+        for (int r = 0; r < 4; r++) {
+            __m256d v = _mm256_add_pd(s[r][0], s[r][1]);
+            __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            double sum = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+            for (int q = p; q < k; q++) sum += m[r][q] * x[q];
+            y[(i + r) * incy] += alpha * sum;
+        }
+    }
+    gemv_dot_generic(rows - i, k, alpha, M + i * rs, rs, x, y + i * incy, incy);
+}
+#endif
+
+LEVEL2_KERNELS(generic, )
+#if defined(__x86_64__) || defined(__i386__)
+LEVEL2_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+LEVEL2_KERNELS(avx512, __attribute__((target("avx512f"))))
+#endif
+
+static const level2_kernels_t *selected_level2_kernels = &level2_kernels_generic;
+static pthread_once_t level2_kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_level2_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected_level2_kernels = &level2_kernels_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected_level2_kernels = &level2_kernels_avx2;
+    }
+#endif
+}
+
+static const level2_kernels_t* level2_kernels(void) {
+    pthread_once(&level2_kernels_once, select_level2_kernels);
+    return selected_level2_kernels;
+}
+
+static double* alloc_scratch(size_t count) {
+    double *p = (double *)malloc((count > 0 ? count : 1) * sizeof(double));
+    if (p == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Workers for a long dimension of len, at most num_threads and only if there are elements enough
+static int level2_workers(int len, double elements, int num_threads) {
+    if (num_threads <= 1 || elements < LEVEL2_MT_MIN) {
+        return 1;
+    }
+    int most = (len + LEVEL2_ROW_GRAIN - 1) / LEVEL2_ROW_GRAIN;
+    return (num_threads < most) ? num_threads : most;
+}
+
+// Start of worker t's share of len, in multiples of LEVEL2_ROW_GRAIN
+static int level2_split(int len, int workers, int t) {
+    if (t >= workers) {
+        return len;
+    }
+    int grains = (len + LEVEL2_ROW_GRAIN - 1) / LEVEL2_ROW_GRAIN;
+    int start = (int)((long)grains * t / workers) * LEVEL2_ROW_GRAIN;
+    return (start < len) ? start : len;
+}
+
+typedef struct {
+    const level2_kernels_t *kern;
+    int start, end;       // rows of M (GEMV) or the split dimension of C (rank-k)
+    int k;
+    double alpha;
+    const double *M;
+    long rs, cs;
+    const double *x;
+    double *y;
+    long incy;
+} gemv_args_t;
+
+static void* gemv_thread(void *arg) {
+    gemv_args_t *a = (gemv_args_t *)arg;
+    int rows = a->end - a->start;
+    if (a->cs == 1) {
+        a->kern->dot(rows, a->k, a->alpha, a->M + a->start * a->rs, a->rs, a->x, a->y + a->start * a->incy, a->incy);
+    } else {
+        a->kern->axpy(rows, a->k, a->alpha, a->M + a->start * a->rs, a->cs, a->x, a->y + a->start * a->incy,
+                      a->incy);
+    }
+    return NULL;
+}
+
+/**
+ * y += alpha * M * x for an m x k matrix with element (i, p) at M[i * rs + p * cs].
+ * Contiguous rows (cs == 1) take dot products, contiguous columns (rs == 1) take column
+ * axpys; any other stride, and strided x, is copied to contiguous scratch first.
+ * Rows are split over num_threads pool workers when the matrix is big enough; each worker
+ * adds its rows' results straight into y, which it alone writes.
+ */
+void gemv(int m, int k, double alpha, const double *M, int rs, int cs, const double *x, int incx,
+          double *y, int incy, int num_threads) {
+    if (m <= 0 || k <= 0 || alpha == 0.0) {
+        return;
+    }
+    double *packed_M = NULL, *packed_x = NULL;
+    if (cs != 1 && rs != 1) {
+        packed_M = alloc_scratch((size_t)m * k);
+        for (int i = 0; i < m; i++) {
+            for (int p = 0; p < k; p++) {
+                packed_M[(size_t)i * k + p] = M[(size_t)i * rs + (size_t)p * cs];
+            }
+        }
+        M = packed_M;
+        rs = k;
+        cs = 1;
+    }
+    if (incx != 1) {
+        packed_x = alloc_scratch((size_t)k);
+        for (int p = 0; p < k; p++) {
+            packed_x[p] = x[(size_t)p * incx];
+        }
+        x = packed_x;
+    }
+    // rs == 1 with cs == 1 only happens for k == 1 or m == 1; either kernel is fine
+    if (cs == 1 && rs == 1) {
+        rs = k;
+    }
+
+    const level2_kernels_t *kern = level2_kernels();
+    int workers = level2_workers(m, (double)m * k, num_threads);
+    gemv_args_t args[workers];
+    for (int w = 0; w < workers; w++) {
+        args[w] = (gemv_args_t){kern, level2_split(m, workers, w), level2_split(m, workers, w + 1), k, alpha, M, rs, cs,
+                                x, y, incy};
+    }
+    if (workers > 1) {
+        pool_run(get_gemm_pool(workers), workers, gemv_thread, args, sizeof(gemv_args_t));
+    } else {
+        gemv_thread(&args[0]);
+    }
+    free(packed_M);
+    free(packed_x);
+}
+
+typedef struct {
+    const level2_kernels_t *kern;
+    int i0, i1, j0, j1;
+    int k;
+    double alpha;
+    const double *X;
+    long rsx, csx;
+    const double *Y;
+    long rsy;
+    double *C;
+    long ldc;
+} rank_k_args_t;
+
+static void* rank_k_thread(void *arg) {
+    rank_k_args_t *a = (rank_k_args_t *)arg;
+    a->kern->rank_k(a->i1 - a->i0, a->j1 - a->j0, a->k, a->alpha, a->X + a->i0 * a->rsx, a->rsx, a->csx,
+                    a->Y + a->j0, a->rsy, a->C + a->i0 * a->ldc + a->j0, a->ldc);
+    return NULL;
+}
+
+/**
+ * C += alpha * X * Y for a small k (rank-k update), C m x n row-major with leading
+ * dimension ldc, X(i, p) at X[i * rsx + p * csx] and Y(p, j) at Y[p * rsy + j * csy].
+ * Each row of C is read and written once per four columns of X. Y with strided rows is
+ * copied to contiguous scratch (k x n, small by definition). The longer of m and n is
+ * split over the pool workers.
+ */
+void rank_k_update(int m, int n, int k, double alpha, const double *X, int rsx, int csx,
+                   const double *Y, int rsy, int csy, double *C, int ldc, int num_threads) {
+    if (m <= 0 || n <= 0 || k <= 0 || alpha == 0.0) {
+        return;
+    }
+    double *packed_Y = NULL;
+    if (csy != 1) {
+        packed_Y = alloc_scratch((size_t)k * n);
+        for (int p = 0; p < k; p++) {
+            for (int j = 0; j < n; j++) {
+                packed_Y[(size_t)p * n + j] = Y[(size_t)p * rsy + (size_t)j * csy];
+            }
+        }
+        Y = packed_Y;
+        rsy = n;
+    }
+
+    const level2_kernels_t *kern = level2_kernels();
+    int split_rows = (m >= n);
+    int workers = level2_workers(split_rows ? m : n, (double)m * n, num_threads);
+    rank_k_args_t args[workers];
+    for (int w = 0; w < workers; w++) {
+        int len = split_rows ? m : n;
+        int s = level2_split(len, workers, w), e = level2_split(len, workers, w + 1);
+        args[w] = (rank_k_args_t){kern, split_rows ? s : 0, split_rows ? e : m, split_rows ? 0 : s,
+                                  split_rows ? n : e, k, alpha, X, rsx, csx, Y, rsy, C, ldc};
+    }
+    if (workers > 1) {
+        pool_run(get_gemm_pool(workers), workers, rank_k_thread, args, sizeof(rank_k_args_t));
+    } else {
+        rank_k_thread(&args[0]);
+    }
+
+    free(packed_Y);
+}
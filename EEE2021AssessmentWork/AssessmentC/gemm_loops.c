@@ -0,0 +1,99 @@
+/**
+ * The six loop orderings of the naive triple loop, C += A * B for row-major matrices.
+ * GEMM benchmarks all of them; MNK is also the baseline column in OptGEMM.
+ */
+#include "gemm.h"
+
+/**
+ * MNK implementation (row-by-row) Time Complexity of O(n^3).
+ * The reason why it is n^3 is becuase of the 3 nested 'for' loops,
+ * The outermost loop runs 'm' times.
+ * The middle loop runs 'n' times for each iteration of the outer loop.
+ * The innermost loop runs 'k' times for each iteration of the middle loop, 
+ * So the Big O notation will amount to  O(m * n * k), -> O(n^3).
+ * Even if the loop ordering changes, it will always be O(n^3). 
+ * 
+ * Space complexity is much more simpler for this algorithm/loop ordering.
+ * Since no additional data structures are allocated within the function 
+ * (only the given matrices are used), the space complexity is O(1), regardless of loop ordering.
+ */
+void mnk_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            for (int p = 0; p < k; p++) {
+                C[i*n + j] += A[i*k + p] * B[p*n + j];
+            }
+        }
+    }
+}
+
+/**
+ * MKN implementation (row-inner-column) Time Complexity of O(n^3).
+ * In practice, there should be very minimal difference between the different orderings,
+ * but locality should be considered for each different ordering. 
+ */
+void mkn_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int i = 0; i < m; i++) {
+        for (int p = 0; p < k; p++) {
+            double a_ip = A[i*k + p];
+            for (int j = 0; j < n; j++) {
+                C[i*n + j] += a_ip * B[p*n + j];
+            }
+        }
+    }
+}
+
+/**
+ * NMK implementation (column-by-column) Time Complexity of O(n^3)
+ */
+void nmk_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < m; i++) {
+            for (int p = 0; p < k; p++) {
+                C[i*n + j] += A[i*k + p] * B[p*n + j];
+            }
+        }
+    }
+}
+
+/**
+ * NKM implementation (column-inner-row) Time Complexity of O(n^3)
+ */
+void nkm_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int j = 0; j < n; j++) {
+        for (int p = 0; p < k; p++) {
+            double b_pj = B[p*n + j];
+            for (int i = 0; i < m; i++) {
+                C[i*n + j] += A[i*k + p] * b_pj;
+            }
+        }
+    }
+}
+
+/**
+ * KMN implementation (inner-row-column) Time Complexity of O(n^3)
+ */
+void kmn_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int p = 0; p < k; p++) {
+        for (int i = 0; i < m; i++) {
+            double a_ip = A[i*k + p];
+            for (int j = 0; j < n; j++) {
+                C[i*n + j] += a_ip * B[p*n + j];
+            }
+        }
+    }
+}
+
+/**
+ * KNM implementation (inner-column-row) Time Complexity of O(n^3)
+ */
+void knm_gemm(int m, int n, int k, double *A, double *B, double *C) {
+    for (int p = 0; p < k; p++) {
+        for (int j = 0; j < n; j++) {
+            double b_pj = B[p*n + j];
+            for (int i = 0; i < m; i++) {
+                C[i*n + j] += A[i*k + p] * b_pj;
+            }
+        }
+    }
+}
@@ -0,0 +1,421 @@
+/**
+ * Out-of-core GEMM for matrices that live in files and don't have to fit in memory.
+ *
+ * C is computed in tiles: for each ib x jb tile of C, the ib x kb tiles of A and kb x jb
+ * tiles of B along k are streamed in and multiplied with the packed kernels, then the
+ * finished C tile is written back. An I/O thread does every pread and pwrite. While the
+ * kernel runs on one pair of A/B tiles it is already reading the next pair into the other
+ * buffer, and a finished C tile is written while the next one is computed (two C buffers).
+ * Only those six tiles are ever allocated, so peak RSS is set by the memory budget, not by
+ * the matrix sizes.
+ *
+ * Plain pread/pwrite rather than mmap: mapped pages count against RSS until the kernel
+ * decides to evict them, and a reader thread keeps the prefetch explicit.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "gemm.h"
+
+#define MATRIX_FILE_HEADER 32   // magic, rows, cols, padded so the data is 32-byte aligned
+#define OOC_MIN_TILE 64
+#define OOC_QUEUE 8
+
+/* Raw transfers ---------------------------------------------------------------------------- */
+
+// Why a transfer stopped: errno from the failing call, or 0 for a short read or write
+typedef struct {
+    int err;
+    int writing;
+    off_t offset;         // where the transfer started
+    size_t done, count;   // bytes moved before it stopped, of count
+} io_error_t;
+
+// All of count bytes at offset, retrying short transfers. On failure fills *error and returns -1
+static int transfer(int fd, void *buf, size_t count, off_t offset, int writing, io_error_t *error) {
+    char *p = (char *)buf;
+    size_t left = count;
+    while (left > 0) {
+        ssize_t done = writing ? pwrite(fd, p, left, offset) : pread(fd, p, left, offset);
+        int err = errno;   // before anything else can change it
+        if (done < 0 && err == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            // pread returns 0 at the end of the file, and neither call sets errno for that
+            *error = (io_error_t){(done < 0) ? err : 0, writing, offset - (off_t)(count - left), count - left, count};
+            return -1;
+        }
+        p += done;
+        offset += done;
+        left -= (size_t)done;
+    }
+    return 0;
+}
+
+// "<what>: short read at byte 32: got 0 of 4096 bytes", or the system error
+static void report_io_error(const char *what, const io_error_t *e) {
+    if (e->err != 0) {
+        fprintf(stderr, "%s: %s of %zu bytes at byte %lld failed: %s\n", what, e->writing ? "write" : "read",
+                e->count, (long long)e->offset, strerror(e->err));
+    } else {
+        fprintf(stderr, "%s: short %s at byte %lld: got %zu of %zu bytes\n", what, e->writing ? "write" : "read",
+                (long long)e->offset, e->done, e->count);
+    }
+}
+
+/* Matrix files ---------------------------------------------------------------------------- */
+
+static int write_header(int fd, int rows, int cols, io_error_t *error) {
+    unsigned char header[MATRIX_FILE_HEADER] = {0};
+    uint64_t dims[2] = {(uint64_t)rows, (uint64_t)cols};
+    memcpy(header, GEMM_MATRIX_MAGIC, 8);
+    memcpy(header + 8, dims, sizeof(dims));
+    return transfer(fd, header, sizeof(header), 0, 1, error);
+}
+
+int matrix_file_create(matrix_file_t *f, const char *path, int rows, int cols) {
+    f->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    f->rows = rows;
+    f->cols = cols;
+    if (f->fd < 0) {
+        fprintf(stderr, "Cannot create matrix file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    io_error_t error;
+    if (write_header(f->fd, rows, cols, &error) != 0) {
+        report_io_error(path, &error);
+        matrix_file_close(f);
+        return -1;
+    }
+    off_t bytes = MATRIX_FILE_HEADER + (off_t)rows * cols * (off_t)sizeof(double);
+    if (ftruncate(f->fd, bytes) != 0) {
+        int err = errno;
+        fprintf(stderr, "Cannot size matrix file %s: %s\n", path, strerror(err));
+        matrix_file_close(f);
+        return -1;
+    }
+    return 0;
+}
+
+int matrix_file_open(matrix_file_t *f, const char *path) {
+    unsigned char header[MATRIX_FILE_HEADER];
+    uint64_t dims[2];
+    f->fd = open(path, O_RDWR);
+    if (f->fd < 0) {
+        return -1;
+    }
+    io_error_t error;
+    if (transfer(f->fd, header, sizeof(header), 0, 0, &error) != 0) {
+        if (error.err != 0) {
+            report_io_error(path, &error);
+        } else {
+            fprintf(stderr, "%s is not a matrix file (%zu bytes, shorter than the header)\n", path, error.done);
+        }
+        matrix_file_close(f);
+        return -1;
+    }
+    if (memcmp(header, GEMM_MATRIX_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not a matrix file\n", path);
+        matrix_file_close(f);
+        return -1;
+    }
+    memcpy(dims, header + 8, sizeof(dims));
+    if (dims[0] < 1 || dims[0] > INT_MAX || dims[1] < 1 || dims[1] > INT_MAX) {
+        fprintf(stderr, "%s has an invalid %llu x %llu header\n", path, (unsigned long long)dims[0],
+                (unsigned long long)dims[1]);
+        matrix_file_close(f);
+        return -1;
+    }
+    f->rows = (int)dims[0];
+    f->cols = (int)dims[1];
+    // At most INT_MAX^2 * 8 bytes, so this fits in 64 bits
+    uint64_t expected = MATRIX_FILE_HEADER + dims[0] * dims[1] * sizeof(double);
+    off_t bytes = lseek(f->fd, 0, SEEK_END);
+    if (bytes < 0 || (uint64_t)bytes < expected) {
+        fprintf(stderr, "%s is shorter than its %d x %d header says\n", path, f->rows, f->cols);
+        matrix_file_close(f);
+        return -1;
+    }
+    return 0;
+}
+
+void matrix_file_close(matrix_file_t *f) {
+    if (f->fd >= 0) {
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+// rows x cols tile at (r0, c0), to or from buf with leading dimension ld
+static int transfer_tile(const matrix_file_t *f, int r0, int c0, int rows, int cols, double *buf, int ld, int writing,
+                         io_error_t *error) {
+    off_t base = MATRIX_FILE_HEADER + ((off_t)r0 * f->cols + c0) * (off_t)sizeof(double);
+    // Whole rows with a dense buffer are one contiguous range of the file
+    if (c0 == 0 && cols == f->cols && ld == cols) {
+        return transfer(f->fd, buf, (size_t)rows * cols * sizeof(double), base, writing, error);
+    }
+    for (int r = 0; r < rows; r++) {
+        off_t offset = base + (off_t)r * f->cols * (off_t)sizeof(double);
+        if (transfer(f->fd, buf + (size_t)r * ld, (size_t)cols * sizeof(double), offset, writing, error) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int matrix_file_read_tile(const matrix_file_t *f, int r0, int c0, int rows, int cols, double *dst, int ld) {
+    io_error_t error;
+    if (transfer_tile(f, r0, c0, rows, cols, dst, ld, 0, &error) != 0) {
+        report_io_error("matrix_file_read_tile", &error);
+        return -1;
+    }
+    return 0;
+}
+
+int matrix_file_write_tile(const matrix_file_t *f, int r0, int c0, int rows, int cols, const double *src, int ld) {
+    io_error_t error;
+    if (transfer_tile(f, r0, c0, rows, cols, (double *)src, ld, 1, &error) != 0) {
+        report_io_error("matrix_file_write_tile", &error);
+        return -1;
+    }
+    return 0;
+}
+
+/* I/O thread --------------------------------------------------------------------------------- */
+
+typedef struct {
+    const matrix_file_t *file;
+    int r0, c0, rows, cols;
+    double *buf;          // dense, leading dimension cols
+    int writing;
+    int done;             // set by the I/O thread under the lock
+    int status;
+} ooc_request_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    ooc_request_t *queue[OOC_QUEUE];
+    int head, tail;       // requests run in the order they were submitted
+    int shutdown;
+    int failed;           // a request failed, error says how (the first one)
+    io_error_t error;
+} ooc_io_t;
+
+static void* ooc_io_main(void *arg) {
+    ooc_io_t *io = (ooc_io_t *)arg;
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (io->head == io->tail && !io->shutdown) {
+            pthread_cond_wait(&io->work, &io->lock);
+        }
+        if (io->head == io->tail) {
+            break;
+        }
+        ooc_request_t *r = io->queue[io->head % OOC_QUEUE];
+        pthread_mutex_unlock(&io->lock);
+
+        io_error_t error;
+        int status = transfer_tile(r->file, r->r0, r->c0, r->rows, r->cols, r->buf, r->cols, r->writing, &error);
+
+        pthread_mutex_lock(&io->lock);
+        if (status != 0 && !io->failed) {
+            io->failed = 1;
+            io->error = error;
+        }
+        r->status = status;
+        r->done = 1;
+        io->head++;
+        pthread_cond_broadcast(&io->done);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+static void ooc_submit(ooc_io_t *io, ooc_request_t *r, const matrix_file_t *file, int r0, int c0,
+                       int rows, int cols, double *buf, int writing) {
+    *r = (ooc_request_t){file, r0, c0, rows, cols, buf, writing, 0, 0};
+    pthread_mutex_lock(&io->lock);
+    // At most six requests are ever in flight, so the queue can't overflow
+    io->queue[io->tail % OOC_QUEUE] = r;
+    io->tail++;
+    pthread_cond_signal(&io->work);
+    pthread_mutex_unlock(&io->lock);
+}
+
+// Waits for r (if it was ever submitted) and adds the wait to *waited; returns its status
+static int ooc_wait(ooc_io_t *io, ooc_request_t *r, double *waited) {
+    if (r->file == NULL) {
+        return 0;
+    }
+    double start = get_time();
+    pthread_mutex_lock(&io->lock);
+    while (!r->done) {
+        pthread_cond_wait(&io->done, &io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+    *waited += get_time() - start;
+    r->file = NULL;
+    return r->status;
+}
+
+/* Driver --------------------------------------------------------------------------------------- */
+
+/**
+ * Tile sizes for a memory budget: two A tiles, two B tiles and two C tiles must fit.
+ * kb takes up to a square share, ib = jb then get what is left (roots of
+ * 2 x^2 + 4 kb x = budget), and everything is clamped to the matrix.
+ */
+static void ooc_tiles(int m, int n, int k, size_t mem_bytes, int *ib, int *jb, int *kb) {
+    double budget = (double)mem_bytes / sizeof(double);
+    int t = (int)sqrt(budget / 6.0);
+    t = (t / OOC_MIN_TILE) * OOC_MIN_TILE;
+    if (t < OOC_MIN_TILE) t = OOC_MIN_TILE;
+    *kb = (t < k) ? t : k;
+    int x = (int)((-4.0 * *kb + sqrt(16.0 * *kb * *kb + 8.0 * budget)) / 4.0);
+    x = (x / OOC_MIN_TILE) * OOC_MIN_TILE;
+    if (x < OOC_MIN_TILE) x = OOC_MIN_TILE;
+    *ib = (x < m) ? x : m;
+    *jb = (x < n) ? x : n;
+}
+
+/**
+ * C = A * B for matrix files (C already created at m x n), using about mem_bytes of
+ * buffers and num_threads compute threads. Returns 0, or -1 on a size mismatch or I/O error.
+ */
+int ooc_gemm(const matrix_file_t *A, const matrix_file_t *B, const matrix_file_t *C,
+             size_t mem_bytes, int num_threads, ooc_stats_t *stats) {
+    int m = A->rows, k = A->cols, n = B->cols;
+    if (m < 1 || n < 1 || k < 1) {
+        fprintf(stderr, "ooc_gemm: %dx%d * %dx%d has an empty dimension\n", A->rows, A->cols, B->rows, B->cols);
+        return -1;
+    }
+    if (B->rows != k || C->rows != m || C->cols != n) {
+        fprintf(stderr, "ooc_gemm: %dx%d * %dx%d doesn't fit a %dx%d C\n", A->rows, A->cols, B->rows, B->cols,
+                C->rows, C->cols);
+        return -1;
+    }
+    ooc_stats_t st = {0};
+    ooc_tiles(m, n, k, mem_bytes, &st.tile_m, &st.tile_n, &st.tile_k);
+    int ib = st.tile_m, jb = st.tile_n, kb = st.tile_k;
+
+    size_t a_tile = (size_t)ib * kb, b_tile = (size_t)kb * jb, c_tile = (size_t)ib * jb;
+    double *mem = (double *)malloc((2 * (a_tile + b_tile) + 2 * c_tile) * sizeof(double));
+    if (mem == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    double *Abuf[2] = {mem, mem + a_tile};
+    double *Bbuf[2] = {mem + 2 * a_tile, mem + 2 * a_tile + b_tile};
+    double *Cbuf[2] = {mem + 2 * (a_tile + b_tile), mem + 2 * (a_tile + b_tile) + c_tile};
+
+    ooc_io_t io = {0};
+    pthread_mutex_init(&io.lock, NULL);
+    pthread_cond_init(&io.work, NULL);
+    pthread_cond_init(&io.done, NULL);
+    pthread_create(&io.thread, NULL, ooc_io_main, &io);
+
+    ooc_request_t reads[2][2] = {0}, writes[2] = {0};
+    const ukernel_t *uk = get_ukernel_or_scalar();
+    int tiles_i = (m + ib - 1) / ib, tiles_j = (n + jb - 1) / jb, tiles_k = (k + kb - 1) / kb;
+    long steps = (long)tiles_i * tiles_j * tiles_k;
+    int status = 0;
+    double start = get_time();
+
+    // Step s multiplies A(i, p) by B(p, j) for s = ((i * tiles_j) + j) * tiles_k + p
+#define OOC_STEP_TILES(s, i0, j0, p0) \
+    int i0 = (int)((s) / ((long)tiles_j * tiles_k)) * ib; \
+    int j0 = (int)(((s) / tiles_k) % tiles_j) * jb; \
+    int p0 = (int)((s) % tiles_k) * kb
+#define OOC_SUBMIT_READS(s) do { \
+        OOC_STEP_TILES(s, ri, rj, rp); \
+        int buf = (int)((s) & 1); \
+        ooc_submit(&io, &reads[buf][0], A, ri, rp, (ri + ib < m) ? ib : m - ri, (rp + kb < k) ? kb : k - rp, Abuf[buf], 0); \
+        ooc_submit(&io, &reads[buf][1], B, rp, rj, (rp + kb < k) ? kb : k - rp, (rj + jb < n) ? jb : n - rj, Bbuf[buf], 0); \
+        st.bytes_read += (double)(((ri + ib < m) ? ib : m - ri) + ((rj + jb < n) ? jb : n - rj)) * \
+                         ((rp + kb < k) ? kb : k - rp) * sizeof(double); \
+    } while (0)
+
+    if (steps > 0) {
+        OOC_SUBMIT_READS(0);
+    }
+    long c_index = 0;
+    for (long s = 0; s < steps && status == 0; s++) {
+        OOC_STEP_TILES(s, i0, j0, p0);
+        int buf = (int)(s & 1), cb = (int)(c_index & 1);
+        int rows = (i0 + ib < m) ? ib : m - i0;
+        int cols = (j0 + jb < n) ? jb : n - j0;
+        int depth = (p0 + kb < k) ? kb : k - p0;
+
+        status |= ooc_wait(&io, &reads[buf][0], &st.io_wait);
+        status |= ooc_wait(&io, &reads[buf][1], &st.io_wait);
+        // The other buffer was freed by the last step, start filling it for the next one
+        if (s + 1 < steps) {
+            OOC_SUBMIT_READS(s + 1);
+        }
+        if (p0 == 0) {
+            // This C buffer was last written out two tiles ago
+            status |= ooc_wait(&io, &writes[cb], &st.io_wait);
+            memset(Cbuf[cb], 0, (size_t)rows * cols * sizeof(double));
+        }
+
+        if (num_threads > 1) {
+            mt_packed_gemm(uk, rows, cols, depth, 1.0, Abuf[buf], depth, 1, Bbuf[buf], cols, 1, Cbuf[cb], cols,
+                           num_threads);
+        } else {
+            packed_gemm(uk, rows, cols, depth, 1.0, Abuf[buf], depth, 1, Bbuf[buf], cols, 1, Cbuf[cb], cols);
+        }
+
+        if (p0 + depth == k) {
+            ooc_submit(&io, &writes[cb], C, i0, j0, rows, cols, Cbuf[cb], 1);
+            st.bytes_written += (double)rows * cols * sizeof(double);
+            c_index++;
+        }
+    }
+#undef OOC_SUBMIT_READS
+#undef OOC_STEP_TILES
+
+    // Drain whatever is still queued (including reads started before an error)
+    for (int b = 0; b < 2; b++) {
+        status |= ooc_wait(&io, &reads[b][0], &st.io_wait);
+        status |= ooc_wait(&io, &reads[b][1], &st.io_wait);
+        status |= ooc_wait(&io, &writes[b], &st.io_wait);
+    }
+    pthread_mutex_lock(&io.lock);
+    io.shutdown = 1;
+    pthread_cond_signal(&io.work);
+    pthread_mutex_unlock(&io.lock);
+    pthread_join(io.thread, NULL);
+    pthread_mutex_destroy(&io.lock);
+    pthread_cond_destroy(&io.work);
+    pthread_cond_destroy(&io.done);
+    free(mem);
+
+    int sync_err = 0;
+    if (status == 0 && fdatasync(C->fd) != 0) {
+        sync_err = errno;
+    }
+    st.seconds = get_time() - start;
+    if (stats != NULL) {
+        *stats = st;
+    }
+    if (status != 0) {
+        report_io_error("ooc_gemm", &io.error);
+        return -1;
+    }
+    if (sync_err != 0) {
+        fprintf(stderr, "ooc_gemm: fdatasync: %s\n", strerror(sync_err));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * Sparse A times dense B, for A matrices that are mostly zeros.
+ *
+ * A is held in CSR (compressed sparse row): the nonzeros of each row in column order, with
+ * row_ptr[i] .. row_ptr[i + 1] indexing row i's entries of col_idx and values. Each
+ * nonzero a(i, p) adds a * B[p, :] to C[i, :], so the work is nnz * n FMAs instead of
+ * m * n * k, and the inner loop is a unit-stride axpy over rows of B and C that the
+ * compiler vectorises.
+ *
+ * The threaded version splits the rows into contiguous ranges like mt_mnk_gemm, but cuts
+ * them where the running nonzero count crosses t * nnz / num_threads instead of every
+ * m / num_threads rows, so a few dense rows don't leave one worker with most of the work.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "gemm.h"
+
+/**
+ * Converts a dense row-major m x k matrix to CSR, keeping the entries that aren't exactly
+ * zero. The arrays are sized to the nonzero count. Returns 0, or -1 (csr left empty) if
+ * an allocation fails.
+ */
+int dense_to_csr(int m, int k, const double *A, csr_matrix_t *csr) {
+    size_t nnz = 0;
+    for (size_t i = 0; i < (size_t)m * k; i++) {
+        nnz += (A[i] != 0.0);
+    }
+    csr->rows = m;
+    csr->cols = k;
+    csr->nnz = (long)nnz;
+    csr->row_ptr = (long *)malloc(((size_t)m + 1) * sizeof(long));
+    csr->col_idx = (int *)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    csr->values = (double *)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    if (csr->row_ptr == NULL || csr->col_idx == NULL || csr->values == NULL) {
+        free_csr(csr);
+        return -1;
+    }
+
+    long pos = 0;
+    for (int i = 0; i < m; i++) {
+        csr->row_ptr[i] = pos;
+        const double *row = A + (size_t)i * k;
+        for (int p = 0; p < k; p++) {
+            if (row[p] != 0.0) {
+                csr->col_idx[pos] = p;
+                csr->values[pos] = row[p];
+                pos++;
+            }
+        }
+    }
+    csr->row_ptr[m] = pos;
+    return 0;
+}
+
+void free_csr(csr_matrix_t *csr) {
+    free(csr->row_ptr);
+    free(csr->col_idx);
+    free(csr->values);
+    csr->row_ptr = NULL;
+    csr->col_idx = NULL;
+    csr->values = NULL;
+    csr->nnz = 0;
+}
+
+// C[i, :] += A[i, :] * B for rows [start, end); two nonzeros per pass halve the C traffic
+static void csr_rows(const csr_matrix_t *A, int start, int end, int n, const double *restrict B,
+                     double *restrict C) {
+    for (int i = start; i < end; i++) {
+        double *restrict c = C + (size_t)i * n;
+        long q = A->row_ptr[i], q_end = A->row_ptr[i + 1];
+        for (; q + 1 < q_end; q += 2) {
+            double a0 = A->values[q], a1 = A->values[q + 1];
+            const double *restrict b0 = B + (size_t)A->col_idx[q] * n;
+            const double *restrict b1 = B + (size_t)A->col_idx[q + 1] * n;
+            for (int j = 0; j < n; j++) {
+                c[j] += a0 * b0[j] + a1 * b1[j];
+            }
+        }
+        if (q < q_end) {
+            double a0 = A->values[q];
+            const double *restrict b0 = B + (size_t)A->col_idx[q] * n;
+            for (int j = 0; j < n; j++) {
+                c[j] += a0 * b0[j];
+            }
+        }
+    }
+}
+
+// C += A * B with A in CSR (A->rows x A->cols), B dense A->cols x n, C dense A->rows x n
+void csr_gemm(const csr_matrix_t *A, int n, const double *B, double *C) {
+    csr_rows(A, 0, A->rows, n, B, C);
+}
+
+typedef struct {
+    const csr_matrix_t *A;
+    int start_row, end_row;
+    int n;
+    const double *B;
+    double *C;
+} csr_thread_args_t;
+
+static void* csr_thread(void *arg) {
+    csr_thread_args_t *args = (csr_thread_args_t *)arg;
+    csr_rows(args->A, args->start_row, args->end_row, args->n, args->B, args->C);
+    return NULL;
+}
+
+// First row at or after which row_ptr reaches target (row_ptr is non-decreasing)
+static int row_for_nnz(const csr_matrix_t *A, long target) {
+    int lo = 0, hi = A->rows;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (A->row_ptr[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Multithreaded CSR x dense, row ranges balanced by nonzero count. Each row of C is written
+ * by one worker, so there's no synchronisation beyond the pool's own.
+ */
+void mt_csr_gemm(const csr_matrix_t *A, int n, const double *B, double *C, int num_threads) {
+    if (num_threads > A->rows) num_threads = (A->rows > 0) ? A->rows : 1;
+    if (num_threads <= 1) {
+        csr_gemm(A, n, B, C);
+        return;
+    }
+    csr_thread_args_t args[num_threads];
+
+    int start = 0;
+    for (int t = 0; t < num_threads; t++) {
+        int end = (t == num_threads - 1) ? A->rows : row_for_nnz(A, A->nnz * (t + 1) / num_threads);
+        if (end < start) end = start;
+        args[t] = (csr_thread_args_t){A, start, end, n, B, C};
+        start = end;
+    }
+
+    pool_run(get_gemm_pool(num_threads), num_threads, csr_thread, args, sizeof(csr_thread_args_t));
+}
@@ -0,0 +1,222 @@
+/**
+ * Per-thread timeline tracing for the multithreaded paths, written out as Chrome trace
+ * JSON (load it in chrome://tracing or ui.perfetto.dev).
+ *
+ * Each thread records into its own ring buffer, so recording takes no lock and shares no
+ * cache line with the other workers: the owner writes the event and then publishes the
+ * new head with a release store. A full ring overwrites its oldest events, so a long run
+ * keeps its most recent part. The dump reads every ring once the pool is idle.
+ *
+ * Turned on by gemm_trace_start(), or for a whole run by GEMM_TRACE=trace.json, which
+ * starts tracing when the pool is first created and writes the file at exit.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "gemm.h"
+#include "gemm_trace.h"
+
+#define TRACE_DEFAULT_EVENTS (1 << 16)
+#define TRACE_MAX_THREADS 1024
+#define TRACE_MAX_POOLS 8   // distinct pool names that get their own group of lanes
+
+typedef struct {
+    uint64_t start, end;
+    int arg0, arg1;
+    int kind;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t *events;
+    size_t capacity;          // power of two
+    atomic_size_t head;       // events ever written in this generation
+    unsigned generation;
+    pid_t tid;
+    int worker;               // pool worker id, -1 for a thread outside the pool
+    const char *pool;         // the pool's trace name (NULL outside a pool)
+} trace_ring_t;
+
+static const char *trace_names[TRACE_NUM_KINDS] = {"task", "dispatch", "barrier wait", "pack", "tile"};
+
+atomic_int gemm_trace_active = 0;
+static atomic_uint trace_generation = 0;
+static size_t trace_capacity = TRACE_DEFAULT_EVENTS;
+static uint64_t trace_origin = 0;
+static _Atomic(trace_ring_t *) trace_rings[TRACE_MAX_THREADS];
+static atomic_int trace_num_rings = 0;
+static const char *trace_env_path = NULL;
+
+static _Thread_local trace_ring_t *my_ring = NULL;
+static _Thread_local int my_worker = -1;
+static _Thread_local const char *my_pool = NULL;
+
+void trace_set_worker(const char *pool, int worker_id) {
+    my_worker = worker_id;
+    my_pool = pool;
+    if (my_ring != NULL) {
+        my_ring->worker = worker_id;
+        my_ring->pool = pool;
+    }
+}
+
+// The calling thread's ring, registered on its first event; NULL if there's no room or memory
+static trace_ring_t* trace_ring(void) {
+    unsigned gen = atomic_load_explicit(&trace_generation, memory_order_acquire);
+    trace_ring_t *ring = my_ring;
+    if (ring == NULL) {
+        int slot = atomic_fetch_add_explicit(&trace_num_rings, 1, memory_order_relaxed);
+        if (slot >= TRACE_MAX_THREADS) {
+            return NULL;
+        }
+        ring = (trace_ring_t *)calloc(1, sizeof(trace_ring_t));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->tid = (pid_t)syscall(SYS_gettid);
+        ring->worker = my_worker;
+        ring->pool = my_pool;
+        ring->generation = gen - 1;   // forces the setup below
+        atomic_store_explicit(&trace_rings[slot], ring, memory_order_release);
+        my_ring = ring;
+    }
+    // A new gemm_trace_start: forget the old events, and resize if the capacity changed
+    if (ring->generation != gen) {
+        if (ring->capacity != trace_capacity) {
+            free(ring->events);
+            ring->events = (trace_event_t *)malloc(trace_capacity * sizeof(trace_event_t));
+            ring->capacity = (ring->events != NULL) ? trace_capacity : 0;
+        }
+        atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+        ring->generation = gen;
+    }
+    return (ring->capacity > 0) ? ring : NULL;
+}
+
+void trace_record(trace_kind_t kind, uint64_t start, uint64_t end, int arg0, int arg1) {
+    trace_ring_t *ring = trace_ring();
+    if (ring == NULL) {
+        return;
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head & (ring->capacity - 1)] = (trace_event_t){start, end, arg0, arg1, (int)kind};
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Starts (or restarts) tracing with room for events_per_thread events per thread
+ * (0 = 65536, rounded up to a power of two). Earlier events are dropped.
+ */
+void gemm_trace_start(size_t events_per_thread) {
+    size_t cap = 1;
+    size_t want = (events_per_thread > 0) ? events_per_thread : TRACE_DEFAULT_EVENTS;
+    while (cap < want) cap <<= 1;
+    trace_capacity = cap;
+    trace_origin = trace_clock();
+    atomic_fetch_add_explicit(&trace_generation, 1, memory_order_release);
+    atomic_store_explicit(&gemm_trace_active, 1, memory_order_release);
+}
+
+void gemm_trace_stop(void) {
+    atomic_store_explicit(&gemm_trace_active, 0, memory_order_release);
+}
+
+static double trace_us(uint64_t t) {
+    return (t > trace_origin) ? (double)(t - trace_origin) * 1e-3 : 0.0;
+}
+
+/**
+ * Writes the current generation's events as Chrome trace JSON, one lane per thread named
+ * after its pool and worker id ("pool worker 2", "async worker 0"). Each pool's lanes sort
+ * together, pools in the order their first thread registered. Call it while no GEMM is running. Returns the number of events
+ * written, or -1 if the file can't be opened.
+ */
+long gemm_trace_dump(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot write trace to %s\n", path);
+        return -1;
+    }
+    unsigned gen = atomic_load_explicit(&trace_generation, memory_order_acquire);
+    int pid = (int)getpid();
+    long written = 0;
+    int num_rings = atomic_load_explicit(&trace_num_rings, memory_order_acquire);
+    if (num_rings > TRACE_MAX_THREADS) num_rings = TRACE_MAX_THREADS;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char *pools[TRACE_MAX_POOLS];
+    int num_pools = 0;
+    int first = 1;
+    for (int r = 0; r < num_rings; r++) {
+        trace_ring_t *ring = atomic_load_explicit(&trace_rings[r], memory_order_acquire);
+        if (ring == NULL || ring->generation != gen || ring->capacity == 0) {
+            continue;
+        }
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t count = (head < ring->capacity) ? head : ring->capacity;
+
+        char lane[48];
+        int sort_index = -1;
+        if (ring->worker >= 0 && ring->pool != NULL) {
+            int p = 0;
+            while (p < num_pools && strcmp(pools[p], ring->pool) != 0) {
+                p++;
+            }
+            if (p == num_pools && num_pools < TRACE_MAX_POOLS) {
+                pools[num_pools++] = ring->pool;
+            }
+            snprintf(lane, sizeof(lane), "%s worker %d", ring->pool, ring->worker);
+            sort_index = p * TRACE_MAX_THREADS + ring->worker;
+        } else {
+            snprintf(lane, sizeof(lane), "thread %d", (int)ring->tid);
+        }
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, (int)ring->tid, lane);
+        fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                pid, (int)ring->tid, sort_index);
+        first = 0;
+
+        for (size_t i = head - count; i < head; i++) {
+            const trace_event_t *e = &ring->events[i & (ring->capacity - 1)];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"gemm\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    trace_names[e->kind], pid, (int)ring->tid, trace_us(e->start), trace_us(e->end) - trace_us(e->start));
+            if (e->kind == TRACE_PACK) {
+                fprintf(f, ",\"args\":{\"row\":%d,\"k\":%d}", e->arg0, e->arg1);
+            } else if (e->kind == TRACE_TILE) {
+                fprintf(f, ",\"args\":{\"row\":%d,\"col\":%d}", e->arg0, e->arg1);
+            } else if (e->kind == TRACE_TASK || e->kind == TRACE_DISPATCH || e->kind == TRACE_WAIT) {
+                fprintf(f, ",\"args\":{\"workers\":%d}", e->arg0);
+            }
+            fputc('}', f);
+            written++;
+        }
+        if (head > ring->capacity) {
+            fprintf(stderr, "Trace: %s dropped its %zu oldest events (raise the buffer size)\n", lane,
+                    head - ring->capacity);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return written;
+}
+
+static void trace_dump_at_exit(void) {
+    gemm_trace_stop();
+    long n = gemm_trace_dump(trace_env_path);
+    if (n >= 0) {
+        fprintf(stderr, "Trace: %ld events written to %s\n", n, trace_env_path);
+    }
+}
+
+void trace_from_env(void) {
+    const char *path = getenv("GEMM_TRACE");
+    if (path == NULL || path[0] == '\0' || trace_env_path != NULL) {
+        return;
+    }
+    trace_env_path = path;
+    const char *events = getenv("GEMM_TRACE_EVENTS");
+    gemm_trace_start((events != NULL) ? (size_t)strtoul(events, NULL, 10) : 0);
+    atexit(trace_dump_at_exit);
+}
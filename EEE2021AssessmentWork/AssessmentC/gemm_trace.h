@@ -0,0 +1,52 @@
+/**
+ * Timeline tracing inside libgemm (gemm_trace.c), for the library's own files only; the
+ * public switches are gemm_trace_start/stop/dump in gemm.h.
+ *
+ * Every recording site is a trace_begin() / trace_end() pair. While tracing is off,
+ * trace_begin() is one relaxed load and returns 0, and trace_end() with a 0 start does
+ * nothing, so the hooks can stay in the hot loops of release builds.
+ */
+#ifndef GEMM_TRACE_H
+#define GEMM_TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+typedef enum {
+    TRACE_TASK,       // one worker's share of a pool job
+    TRACE_DISPATCH,   // from pool_run publishing a job to a worker starting it (wake-up latency)
+    TRACE_WAIT,       // the caller waiting in pool_run for the other workers (the barrier)
+    TRACE_PACK,       // packing A and B panels for the multithreaded packed path
+    TRACE_TILE,       // computing one tile of C (arguments: its first row and column)
+    TRACE_NUM_KINDS
+} trace_kind_t;
+
+extern atomic_int gemm_trace_active;
+
+static inline uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Start time of an event, or 0 while tracing is off
+static inline uint64_t trace_begin(void) {
+    return atomic_load_explicit(&gemm_trace_active, memory_order_relaxed) ? trace_clock() : 0;
+}
+
+void trace_record(trace_kind_t kind, uint64_t start, uint64_t end, int arg0, int arg1);
+
+static inline void trace_end(trace_kind_t kind, uint64_t start, int arg0, int arg1) {
+    if (start != 0) {
+        trace_record(kind, start, trace_clock(), arg0, arg1);
+    }
+}
+
+// Names the calling thread's lane in the trace after its pool ("pool", "async") and worker
+// id there (-1 = a thread outside any pool). pool must be a string literal.
+void trace_set_worker(const char *pool, int worker_id);
+// Starts tracing if GEMM_TRACE names an output file, and dumps to it at exit
+void trace_from_env(void);
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * Type-generic blocked and multithreaded MNK kernels.
+ * This file is a template: gemm.c includes it once per input type, so the float,
+ * bf16 and fp16 variants all come from the same code and can't drift apart.
+ *
+ * Before including, define:
+ *   GT_SUFFIX                      suffix for the generated names (f32, bf16, f16)
+ *   GT_IN                          storage type of A and B
+ *   GT_CONVERT_ROW(dst, src, len)  converts len GT_IN values to float
+ *
+ * C is always float and every product is accumulated in fp32. Tiles of A and B are
+ * converted to float once per block and then handed to sgemm_tile, which is vectorised
+ * for the widest ISA the CPU has.
+ */
+
+#define GT_CAT_(a, b) a##_##b
+#define GT_CAT(a, b) GT_CAT_(a, b)
+#define GT_FN(name) GT_CAT(name, GT_SUFFIX)
+
+typedef struct {
+    int m, n, k;
+    int block_size;
+    const GT_IN *A;
+    const GT_IN *B;
+    float *C;
+    tile_sched_t *sched;
+} GT_FN(typed_args_t);
+
+/**
+ * C[i0:i1, j0:j1] += A[i0:i1, :] * B[:, j0:j1], walked in block_size tiles.
+ * Each B tile is converted once and reused for every row block underneath it.
+ */
+static void GT_FN(typed_block_region)(int i0, int i1, int j0, int j1, int n, int k,
+                                      const GT_IN *A, const GT_IN *B, float *C, int block_size) {
+    int bs = block_size;
+    // Two bs x bs float tiles (counted in doubles, since that's what scratch_t hands out)
+    float *At = (float *)scratch_reserve(&typed_scratch, (size_t)bs * bs);
+    float *Bt = At + (size_t)bs * bs;
+
+    for (int jb = j0; jb < j1; jb += bs) {
+        int nb = (jb + bs < j1) ? bs : j1 - jb;
+
+        for (int pb = 0; pb < k; pb += bs) {
+            int kb = (pb + bs < k) ? bs : k - pb;
+            for (int p = 0; p < kb; p++) {
+                GT_CONVERT_ROW(&Bt[p*nb], &B[(size_t)(pb + p)*n + jb], nb);
+            }
+
+            for (int ib = i0; ib < i1; ib += bs) {
+                int mb = (ib + bs < i1) ? bs : i1 - ib;
+                for (int i = 0; i < mb; i++) {
+                    GT_CONVERT_ROW(&At[i*kb], &A[(size_t)(ib + i)*k + pb], kb);
+                }
+                sgemm_tile(mb, nb, kb, At, kb, Bt, nb, &C[(size_t)ib*n + jb], n);
+            }
+        }
+    }
+}
+
+/**
+ * Blocked MNK with GT_IN inputs and fp32 accumulation.
+ */
+void GT_FN(blocked_mnk_gemm)(int m, int n, int k, const GT_IN *A, const GT_IN *B, float *C, int block_size) {
+    GT_FN(typed_block_region)(0, m, 0, n, n, k, A, B, C, block_size);
+}
+
+/**
+ * Thread function: claims 2D tiles of C from the shared scheduler, like mt_blocked_mnk_thread.
+ */
+static void* GT_FN(mt_blocked_mnk_thread)(void *arg) {
+    GT_FN(typed_args_t) *args = (GT_FN(typed_args_t) *)arg;
+    tile_sched_t *ts = args->sched;
+    int i0, j0;
+
+    while (claim_tile(ts, &i0, &j0)) {
+        int i1 = (i0 + ts->tile_rows < args->m) ? i0 + ts->tile_rows : args->m;
+        int j1 = (j0 + ts->tile_cols < args->n) ? j0 + ts->tile_cols : args->n;
+        GT_FN(typed_block_region)(i0, i1, j0, j1, args->n, args->k, args->A, args->B, args->C, args->block_size);
+    }
+    return NULL;
+}
+
+/**
+ * Multithreaded blocked MNK with GT_IN inputs, run on the shared worker pool.
+ */
+void GT_FN(mt_blocked_mnk_gemm)(int m, int n, int k, const GT_IN *A, const GT_IN *B, float *C,
+                                int num_threads, int block_size) {
+    GT_FN(typed_args_t) args[num_threads];
+    tile_sched_t sched;
+    init_tile_sched(&sched, m, n, block_size, block_size, block_size, num_threads);
+
+    for (int t = 0; t < num_threads; t++) {
+        args[t] = (GT_FN(typed_args_t)){m, n, k, block_size, A, B, C, &sched};
+    }
+
+    pool_run(get_gemm_pool(num_threads), num_threads, GT_FN(mt_blocked_mnk_thread), args, sizeof(GT_FN(typed_args_t)));
+}
+
+#undef GT_FN
+#undef GT_CAT
+#undef GT_CAT_
+#undef GT_SUFFIX
+#undef GT_IN
+#undef GT_CONVERT_ROW
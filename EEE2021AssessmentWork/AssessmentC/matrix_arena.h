@@ -0,0 +1,170 @@
+/**
+ * Matrix arena behind init_matrices in gemm.c (GEMM and OptGEMM both allocate through it).
+ * init_matrices used to malloc A, B and C for every size and free them straight after,
+ * so every size step faulted in fresh pages (the churn in the massif output). The arena
+ * maps one region, hands out 64-byte aligned blocks from it and keeps the pages when the
+ * matrices are freed, so the next size (or GEMM call) reuses memory that's already mapped.
+ *
+ * The region is 2 MB aligned and backed by huge pages when possible, so a large B doesn't
+ * take a TLB miss on every row. MATRIX_ARENA_HUGEPAGES picks the backing:
+ *   thp       transparent huge pages via madvise (default)
+ *   explicit  MAP_HUGETLB from the reserved pool, falls back to thp if none are free
+ *   off       normal 4 KB pages
+ *
+ * The arena is a bump allocator: everything allocated stays live until the last block is
+ * released, then it resets. If a block doesn't fit while others are still live, it comes
+ * from posix_memalign instead, so callers never have to care which one they got.
+ */
+#ifndef MATRIX_ARENA_H
+#define MATRIX_ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+typedef enum { ARENA_PAGES_OFF, ARENA_PAGES_THP, ARENA_PAGES_EXPLICIT } arena_pages_t;
+
+typedef struct {
+    char *map;          // start of the mmap'd region (what munmap gets)
+    size_t map_len;
+    char *base;         // first 2 MB aligned byte inside the region
+    size_t cap;         // usable bytes from base
+    size_t used;
+    int live;           // blocks handed out and not yet released
+    int explicit_huge;  // region came from MAP_HUGETLB
+} matrix_arena_t;
+
+static matrix_arena_t matrix_arena;
+
+static inline arena_pages_t arena_page_mode(void) {
+    const char *mode = getenv("MATRIX_ARENA_HUGEPAGES");
+    if (mode == NULL || strcmp(mode, "thp") == 0) {
+        return ARENA_PAGES_THP;
+    }
+    if (strcmp(mode, "explicit") == 0) {
+        return ARENA_PAGES_EXPLICIT;
+    }
+    return ARENA_PAGES_OFF;
+}
+
+static inline size_t arena_round_up(size_t x, size_t multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+static inline void arena_unmap(matrix_arena_t *a) {
+    if (a->map != NULL) {
+        munmap(a->map, a->map_len);
+    }
+    a->map = a->base = NULL;
+    a->map_len = a->cap = a->used = 0;
+    a->explicit_huge = 0;
+}
+
+/**
+ * Makes sure the (empty) arena can hold at least bytes. Grows by at least 2x so a sweep
+ * over increasing sizes only remaps a handful of times. Returns 0 on success.
+ */
+static inline int arena_reserve(matrix_arena_t *a, size_t bytes) {
+    if (bytes <= a->cap) {
+        return 0;
+    }
+    if (a->live > 0) {
+        return -1;
+    }
+
+    size_t cap = arena_round_up(bytes > 2 * a->cap ? bytes : 2 * a->cap, ARENA_HUGE_PAGE_SIZE);
+    arena_unmap(a);
+    arena_pages_t mode = arena_page_mode();
+
+#ifdef MAP_HUGETLB
+    if (mode == ARENA_PAGES_EXPLICIT) {
+        void *p = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            a->map = a->base = (char *)p;
+            a->map_len = a->cap = cap;
+            a->explicit_huge = 1;
+            return 0;
+        }
+        mode = ARENA_PAGES_THP;
+    }
+#endif
+
+    // Over-map by one huge page so the usable part can start on a 2 MB boundary
+    size_t len = cap + ARENA_HUGE_PAGE_SIZE;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    a->map = (char *)p;
+    a->map_len = len;
+    a->base = (char *)arena_round_up((size_t)p, ARENA_HUGE_PAGE_SIZE);
+    a->cap = cap;
+#ifdef MADV_HUGEPAGE
+    if (mode == ARENA_PAGES_THP) {
+        madvise(a->base, cap, MADV_HUGEPAGE);
+    }
+#endif
+    (void)mode;
+    return 0;
+}
+
+/**
+ * Block of bytes aligned to alignment (a power of two, at least ARENA_ALIGNMENT), from the
+ * arena if it fits, posix_memalign otherwise. Returns NULL only if both fail.
+ */
+static inline void* arena_alloc_aligned(matrix_arena_t *a, size_t bytes, size_t alignment) {
+    size_t size = arena_round_up(bytes > 0 ? bytes : 1, ARENA_ALIGNMENT);
+    size_t offset = arena_round_up(a->used, alignment);
+    if (offset + size > a->cap) {
+        // An empty arena regrows (its base is 2 MB aligned, so the offset starts at 0 again)
+        if (a->live > 0 || arena_reserve(a, size) != 0) {
+            void *p = NULL;
+            return (posix_memalign(&p, alignment, size) == 0) ? p : NULL;
+        }
+        offset = 0;
+    }
+    void *p = a->base + offset;
+    a->used = offset + size;
+    a->live++;
+    return p;
+}
+
+/**
+ * 64-byte aligned block of bytes, see arena_alloc_aligned.
+ */
+static inline void* arena_alloc(matrix_arena_t *a, size_t bytes) {
+    return arena_alloc_aligned(a, bytes, ARENA_ALIGNMENT);
+}
+
+static inline int arena_owns(const matrix_arena_t *a, const void *p) {
+    return a->base != NULL && (const char *)p >= a->base && (const char *)p < a->base + a->cap;
+}
+
+/**
+ * Releases a block from arena_alloc. The arena resets once nothing is live, but keeps its pages.
+ */
+static inline void arena_release(matrix_arena_t *a, void *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (!arena_owns(a, p)) {
+        free(p);
+        return;
+    }
+    if (--a->live == 0) {
+        a->used = 0;
+    }
+}
+
+static inline const char* arena_backing_name(const matrix_arena_t *a) {
+    if (a->explicit_huge) {
+        return "explicit 2 MB huge pages";
+    }
+    return (arena_page_mode() == ARENA_PAGES_OFF) ? "4 KB pages" : "transparent huge pages";
+}
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * Hardware performance counters for the benchmark mains (Linux perf_event_open, no PAPI).
+ * Wall time alone can't say why one loop ordering beats another; cycles, instructions,
+ * cache and TLB misses and vector FP instructions per variant can. Off unless GEMM_PERF=1.
+ *
+ * Counters are opened per thread (the calling thread plus every pool worker, by tid), so
+ * the multithreaded variants are counted on all their workers and the totals are summed.
+ * Each event is opened on its own rather than as a group, so the kernel can multiplex when
+ * there are more events than counters; values are scaled by time_enabled / time_running.
+ * An event the CPU or kernel doesn't offer (VMs often expose none) reads back as -1 and
+ * its CSV column is left empty.
+ *
+ * FP vector ops is an Intel raw event (FP_ARITH_INST_RETIRED, all packed single and double
+ * widths), so it's only opened on GenuineIntel CPUs.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define PERF_NUM_EVENTS 6
+#define PERF_MAX_THREADS 256
+
+// FP_ARITH_INST_RETIRED.{128B,256B,512B}_PACKED_{SINGLE,DOUBLE}: event 0xC7, umask 0xFC
+#define PERF_INTEL_FP_PACKED_CONFIG 0xFCC7
+
+static const char *perf_event_names[PERF_NUM_EVENTS] = {
+    "Cycles", "Instructions", "L1D Misses", "LLC Misses", "DTLB Misses", "FP Vector Ops"
+};
+
+typedef struct {
+    int num_tids;
+    int fd[PERF_MAX_THREADS][PERF_NUM_EVENTS];   // -1 when an event couldn't be opened
+    int available[PERF_NUM_EVENTS];              // opened on at least one thread
+} perf_counters_t;
+
+static inline int perf_counters_requested(void) {
+    const char *s = getenv("GEMM_PERF");
+    return s != NULL && strcmp(s, "0") != 0;
+}
+
+static inline uint64_t perf_cache_config(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+static inline int perf_is_intel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        return ebx == 0x756E6547 && edx == 0x49656E69 && ecx == 0x6C65746E;   // "GenuineIntel"
+    }
+#endif
+    return 0;
+}
+
+// Fills attr for event e, returns 0 if this machine can't have it at all
+static inline int perf_event_attr_for(int e, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (e) {
+    case 0:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        return 1;
+    case 1:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        return 1;
+    case 2:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = perf_cache_config(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS);
+        return 1;
+    case 3:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = perf_cache_config(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS);
+        return 1;
+    case 4:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = perf_cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                                         PERF_COUNT_HW_CACHE_RESULT_MISS);
+        return 1;
+    case 5:
+        attr->type = PERF_TYPE_RAW;
+        attr->config = PERF_INTEL_FP_PACKED_CONFIG;
+        return perf_is_intel();
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Opens every event on each of the num_tids threads (tid 0 means the calling thread).
+ * Returns how many of the events are available on at least one thread.
+ */
+static inline int perf_counters_open(perf_counters_t *pc, const pid_t *tids, int num_tids) {
+    pc->num_tids = (num_tids < PERF_MAX_THREADS) ? num_tids : PERF_MAX_THREADS;
+    int count = 0;
+
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        struct perf_event_attr attr;
+        int possible = perf_event_attr_for(e, &attr);
+        pc->available[e] = 0;
+        for (int t = 0; t < pc->num_tids; t++) {
+            pc->fd[t][e] = possible ? (int)syscall(SYS_perf_event_open, &attr, tids[t], -1, -1, 0) : -1;
+            if (pc->fd[t][e] >= 0) {
+                pc->available[e] = 1;
+            }
+        }
+        count += pc->available[e];
+    }
+    return count;
+}
+
+static inline void perf_counters_close(perf_counters_t *pc) {
+    for (int t = 0; t < pc->num_tids; t++) {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (pc->fd[t][e] >= 0) {
+                close(pc->fd[t][e]);
+                pc->fd[t][e] = -1;
+            }
+        }
+    }
+    pc->num_tids = 0;
+}
+
+static inline void perf_counters_start(perf_counters_t *pc) {
+    for (int t = 0; t < pc->num_tids; t++) {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (pc->fd[t][e] >= 0) {
+                ioctl(pc->fd[t][e], PERF_EVENT_IOC_RESET, 0);
+                ioctl(pc->fd[t][e], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+}
+
+/**
+ * Stops counting and writes each event's total over all threads to values (-1 if unavailable).
+ */
+static inline void perf_counters_stop(perf_counters_t *pc, double values[PERF_NUM_EVENTS]) {
+    for (int t = 0; t < pc->num_tids; t++) {
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            if (pc->fd[t][e] >= 0) {
+                ioctl(pc->fd[t][e], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+    }
+
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        values[e] = pc->available[e] ? 0.0 : -1.0;
+        for (int t = 0; t < pc->num_tids; t++) {
+            uint64_t buf[3];   // value, time_enabled, time_running
+            if (pc->fd[t][e] < 0 || read(pc->fd[t][e], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+                continue;
+            }
+            if (buf[2] > 0) {
+                values[e] += (double)buf[0] * ((double)buf[1] / (double)buf[2]);
+            }
+        }
+    }
+}
+
+/**
+ * Counts reset(ctx) + calls x body(ctx) and returns per-call values. This is a separate
+ * pass after the timed samples, so the ioctls never end up inside a timing.
+ */
+static inline void perf_counters_measure(perf_counters_t *pc, void (*reset)(void *), void (*body)(void *),
+                                         void *ctx, int calls, double values[PERF_NUM_EVENTS]) {
+    if (calls < 1) {
+        calls = 1;
+    }
+    if (reset) reset(ctx);
+    perf_counters_start(pc);
+    for (int i = 0; i < calls; i++) {
+        body(ctx);
+    }
+    perf_counters_stop(pc, values);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (values[e] >= 0.0) {
+            values[e] /= calls;
+        }
+    }
+}
+
+// ",Cycles,Instructions,..." for the end of a CSV header
+static inline void perf_write_header_columns(FILE *f) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        fprintf(f, ",%s", perf_event_names[e]);
+    }
+}
+
+// Counter columns for one row; values == NULL (counters off) or -1 leave the column empty
+static inline void perf_write_columns(FILE *f, const double *values) {
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        if (values != NULL && values[e] >= 0.0) {
+            fprintf(f, ",%.0f", values[e]);
+        } else {
+            fprintf(f, ",");
+        }
+    }
+}
+
+#endif
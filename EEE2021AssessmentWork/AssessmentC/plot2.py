@@ -2,13 +2,15 @@ import pandas as pd
 import matplotlib.pyplot as plt
 import seaborn as sns
 import numpy as np
+import os
 
 # Set style
 sns.set_style('whitegrid')
 plt.rcParams.update({'font.size': 12})
 
 # Load the data
-df = pd.read_csv('gemm_times.csv')
+# (M, N, K are only there for rectangular sweeps; Matrix Size is then the square-equivalent size)
+df = pd.read_csv('gemm_times.csv').drop(columns=['M', 'N', 'K'], errors='ignore')
 
 # Create figure with multiple plots
 fig, axes = plt.subplots(2, 1, figsize=(12, 14), gridspec_kw={'height_ratios': [1, 0.8]})
@@ -115,4 +117,27 @@ plt.savefig('gemm_heatmap.png', dpi=300, bbox_inches='tight')
 
 print("\nVisualization complete! Check gemm_performance.png and gemm_heatmap.png")
 print("\nRaw timing data:")
-print(table_data)
\ No newline at end of file
+print(table_data)
+# Cache behaviour, if GEMM was run with GEMM_PERF=1 (counter columns in gemm_times_stats.csv)
+counter_columns = ['L1D Misses', 'LLC Misses', 'DTLB Misses']
+if os.path.exists('gemm_times_stats.csv'):
+    stats = pd.read_csv('gemm_times_stats.csv')
+    if 'Cycles' in stats.columns and stats[['Cycles'] + counter_columns].notna().any().any():
+        flops = 2.0 * stats['M'] * stats['N'] * stats['K']
+        fig, axes = plt.subplots(2, 2, figsize=(16, 12))
+        panels = [('Instructions', 'Cycles', 'Instructions per Cycle'),
+                  ('L1D Misses', None, 'L1D Misses per FLOP'),
+                  ('LLC Misses', None, 'LLC Misses per FLOP'),
+                  ('DTLB Misses', None, 'DTLB Misses per FLOP')]
+        for ax, (numerator, denominator, title) in zip(axes.flat, panels):
+            for impl in stats['Implementation'].unique():
+                rows = stats[stats['Implementation'] == impl]
+                divisor = rows[denominator] if denominator else flops[rows.index]
+                ax.plot(rows['Matrix Size'], rows[numerator] / divisor, marker='o', linewidth=2, label=impl)
+            ax.set_xlabel('Matrix Size', fontsize=12)
+            ax.set_title(title, fontsize=14)
+            ax.grid(True)
+            ax.legend(title='Loop Ordering', fontsize=10)
+        plt.tight_layout()
+        plt.savefig('gemm_counters.png', dpi=300, bbox_inches='tight')
+        print("\nCounter plots saved to gemm_counters.png")
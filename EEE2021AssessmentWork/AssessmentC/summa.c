@@ -0,0 +1,337 @@
+/**
+ * Distributed GEMM: SUMMA over MPI, with the local products done by libgemm's
+ * mt_blocked_mnk_gemm on each rank's worker pool.
+ *
+ * The P ranks form a pr x pc grid. A (M x K), B (K x N) and C (M x N) are split into
+ * contiguous blocks, rank (r, c) holding rows r and columns c of each. For each panel of
+ * k, the process column that owns those columns of A broadcasts them along its process
+ * row, the process row that owns those rows of B broadcasts them down its process
+ * column, and every rank adds the panel product to its block of C. Broadcasts are
+ * non-blocking and double-buffered: the next panel is on its way while this one is
+ * multiplied, and the compute is split into row chunks with an MPI_Testall between them
+ * so the library gets a chance to move the data along.
+ *
+ * Build with `make summa` (needs mpicc), run with e.g.
+ *   mpirun -np 4 build/SUMMA 4096 4096 4096 [threads] [panel]
+ * Every rank generates its own blocks from the same counter-based generator as
+ * init_matrices, so nothing is scattered up front and sampled entries of C can be
+ * checked against a dot product computed on the spot.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "gemm.h"
+
+#define SUMMA_DEFAULT_SIZE 2048
+#define SUMMA_DEFAULT_PANEL 256
+#define SUMMA_PROGRESS_CHUNKS 4
+#define SUMMA_CHECK_SAMPLES 16
+#define SUMMA_KEY_A 0x73756D6D615F4131ULL
+#define SUMMA_KEY_B 0x73756D6D615F4231ULL
+
+// Per-rank numbers gathered on rank 0 (kept as doubles so one MPI_Gather does it)
+enum { STAT_TIME, STAT_COMPUTE, STAT_COMM, STAT_FLOPS, NUM_STATS };
+
+typedef struct {
+    int rows, cols;      // grid dimensions
+    int row, col;        // this rank's coordinates
+    MPI_Comm row_comm;   // ranks in this process row, ranked by column
+    MPI_Comm col_comm;   // ranks in this process column, ranked by row
+} grid_t;
+
+// Part idx of n split as evenly as possible into parts pieces
+static void block_range(int n, int parts, int idx, int *start, int *len) {
+    int base = n / parts, rem = n % parts;
+    *start = idx * base + (idx < rem ? idx : rem);
+    *len = base + (idx < rem ? 1 : 0);
+}
+
+// Which part of block_range(n, parts, ...) holds index i
+static int block_owner(int n, int parts, int i) {
+    int base = n / parts, rem = n % parts;
+    int split = rem * (base + 1);   // the first rem parts are one longer
+    return (i < split) ? i / (base + 1) : rem + (i - split) / base;
+}
+
+// Width of the panel starting at k index p: at most panel, and inside one A and one B block
+static int panel_width(const grid_t *g, int K, int panel, int p) {
+    int a_start, a_len, b_start, b_len;
+    block_range(K, g->cols, block_owner(K, g->cols, p), &a_start, &a_len);
+    block_range(K, g->rows, block_owner(K, g->rows, p), &b_start, &b_len);
+    int w = panel;
+    if (a_start + a_len - p < w) w = a_start + a_len - p;
+    if (b_start + b_len - p < w) w = b_start + b_len - p;
+    return w;
+}
+
+static void grid_create(grid_t *g) {
+    int size, dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2];
+    MPI_Comm cart;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Dims_create(size, 2, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cart);
+    int rank;
+    MPI_Comm_rank(cart, &rank);
+    MPI_Cart_coords(cart, rank, 2, coords);
+    g->rows = dims[0];
+    g->cols = dims[1];
+    g->row = coords[0];
+    g->col = coords[1];
+    int keep_cols[2] = {0, 1}, keep_rows[2] = {1, 0};
+    MPI_Cart_sub(cart, keep_cols, &g->row_comm);
+    MPI_Cart_sub(cart, keep_rows, &g->col_comm);
+    MPI_Comm_free(&cart);
+}
+
+static double* alloc_doubles(size_t count) {
+    double *p = (double *)malloc((count > 0 ? count : 1) * sizeof(double));
+    if (p == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    return p;
+}
+
+// rows x cols block at (r0, c0) of the generated matrix with ld_global columns
+static void fill_block(double *dst, int rows, int cols, int r0, int c0, int ld_global, uint64_t key) {
+    for (int i = 0; i < rows; i++) {
+        fill_uniform(dst + (size_t)i * cols, (size_t)cols, key, (size_t)(r0 + i) * ld_global + c0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int provided;
+    // Only the calling thread talks to MPI, the pool workers just compute
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    int M = (argc > 1) ? atoi(argv[1]) : SUMMA_DEFAULT_SIZE;
+    int N = (argc > 2) ? atoi(argv[2]) : M;
+    int K = (argc > 3) ? atoi(argv[3]) : M;
+    int num_threads = (argc > 4) ? atoi(argv[4]) : DEFAULT_NUM_THREADS;
+    int panel = (argc > 5) ? atoi(argv[5]) : SUMMA_DEFAULT_PANEL;
+    int block_size = (argc > 6) ? atoi(argv[6]) : DEFAULT_BLOCK_SIZE;
+    if (M < 1 || N < 1 || K < 1) {
+        if (rank == 0) {
+            fprintf(stderr, "Usage: mpirun -np P %s [M] [N] [K] [threads] [panel] [block_size]\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (num_threads < 1) num_threads = 1;
+    if (panel < 1) panel = SUMMA_DEFAULT_PANEL;
+    if (block_size < 1) block_size = DEFAULT_BLOCK_SIZE;
+
+    grid_t g;
+    grid_create(&g);
+    if (rank == 0 && provided < MPI_THREAD_FUNNELED) {
+        fprintf(stderr, "Warning: MPI only provides thread level %d, the worker pool may not be safe\n", provided);
+    }
+
+    // A rows and C rows follow the process row, B columns and C columns the process column;
+    // K is split over the columns for A and over the rows for B
+    int m0, ml, n0, nl, ka0, kal, kb0, kbl;
+    block_range(M, g.rows, g.row, &m0, &ml);
+    block_range(N, g.cols, g.col, &n0, &nl);
+    block_range(K, g.cols, g.col, &ka0, &kal);
+    block_range(K, g.rows, g.row, &kb0, &kbl);
+
+    double *A = alloc_doubles((size_t)ml * kal);
+    double *B = alloc_doubles((size_t)kbl * nl);
+    double *C = alloc_doubles((size_t)ml * nl);
+    double *Apanel[2] = {alloc_doubles((size_t)ml * panel), alloc_doubles((size_t)ml * panel)};
+    double *Bpanel[2] = {alloc_doubles((size_t)panel * nl), alloc_doubles((size_t)panel * nl)};
+    fill_block(A, ml, kal, m0, ka0, K, SUMMA_KEY_A);
+    fill_block(B, kbl, nl, kb0, n0, N, SUMMA_KEY_B);
+    memset(C, 0, (size_t)ml * nl * sizeof(double));
+    get_gemm_pool(num_threads);
+
+    // Panels never straddle an A or B block boundary, so each has one owner in each direction
+    int num_panels = 0;
+    for (int p = 0; p < K; num_panels++) {
+        p += panel_width(&g, K, panel, p);
+    }
+    int *panel_start = (int *)malloc((size_t)(num_panels + 1) * sizeof(int));
+    if (panel_start == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (int p = 0, t = 0; p < K; t++) {
+        panel_start[t] = p;
+        p += panel_width(&g, K, panel, p);
+    }
+    panel_start[num_panels] = K;
+
+    MPI_Request reqs[2][2];
+    double *a_use[2], *b_use[2];   // where panel t's data ends up (the local block on its owner)
+    double stats[NUM_STATS] = {0};
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = get_time();
+
+    // Starts the broadcasts for panel t into buffer t & 1
+#define SUMMA_POST(t) do { \
+        int p_ = panel_start[t], w_ = panel_start[(t) + 1] - p_, b_ = (t) & 1; \
+        int a_root = block_owner(K, g.cols, p_), b_root = block_owner(K, g.rows, p_); \
+        if (g.col == a_root) { \
+            for (int i_ = 0; i_ < ml; i_++) \
+                memcpy(Apanel[b_] + (size_t)i_ * w_, A + (size_t)i_ * kal + (p_ - ka0), (size_t)w_ * sizeof(double)); \
+        } \
+        a_use[b_] = Apanel[b_]; \
+        b_use[b_] = (g.row == b_root) ? B + (size_t)(p_ - kb0) * nl : Bpanel[b_]; \
+        MPI_Ibcast(a_use[b_], ml * w_, MPI_DOUBLE, a_root, g.row_comm, &reqs[b_][0]); \
+        MPI_Ibcast(b_use[b_], w_ * nl, MPI_DOUBLE, b_root, g.col_comm, &reqs[b_][1]); \
+    } while (0)
+
+    if (num_panels > 0) {
+        SUMMA_POST(0);
+    }
+    for (int t = 0; t < num_panels; t++) {
+        int w = panel_start[t + 1] - panel_start[t], buf = t & 1;
+        double wait_start = get_time();
+        MPI_Waitall(2, reqs[buf], MPI_STATUSES_IGNORE);
+        if (t + 1 < num_panels) {
+            SUMMA_POST(t + 1);
+        }
+        double compute_start = get_time();
+        stats[STAT_COMM] += compute_start - wait_start;
+
+        int chunk = (ml + SUMMA_PROGRESS_CHUNKS - 1) / SUMMA_PROGRESS_CHUNKS;
+        for (int r = 0; r < ml; r += chunk) {
+            int rows = (r + chunk < ml) ? chunk : ml - r;
+            mt_blocked_mnk_gemm(rows, nl, w, a_use[buf] + (size_t)r * w, b_use[buf], C + (size_t)r * nl,
+                                num_threads, block_size);
+            if (t + 1 < num_panels) {
+                int done;
+                MPI_Testall(2, reqs[(t + 1) & 1], &done, MPI_STATUSES_IGNORE);
+            }
+        }
+        stats[STAT_COMPUTE] += get_time() - compute_start;
+    }
+#undef SUMMA_POST
+    stats[STAT_TIME] = get_time() - start;
+    stats[STAT_FLOPS] = 2.0 * ml * nl * K;
+
+    // Sampled entries of this rank's C against a fresh dot product
+    double *row = alloc_doubles((size_t)K);
+    double max_err = 0.0;
+    for (int s = 0; s < SUMMA_CHECK_SAMPLES && ml > 0 && nl > 0; s++) {
+        int i = (s == 0) ? 0 : (s == 1) ? ml - 1 : (int)(((uint64_t)s * 2654435761u) % (uint64_t)ml);
+        int j = (s == 0) ? 0 : (s == 1) ? nl - 1 : (int)(((uint64_t)s * 40503u + 17) % (uint64_t)nl);
+        double ref = 0.0, b;
+        fill_uniform(row, (size_t)K, SUMMA_KEY_A, (size_t)(m0 + i) * K);
+        for (int p = 0; p < K; p++) {
+            fill_uniform(&b, 1, SUMMA_KEY_B, (size_t)p * N + n0 + j);
+            ref += row[p] * b;
+        }
+        double err = fabs(C[(size_t)i * nl + j] - ref) / (fabs(ref) > 0.0 ? fabs(ref) : 1.0);
+        if (err > max_err) max_err = err;
+    }
+    free(row);
+
+    double global_err;
+    MPI_Reduce(&max_err, &global_err, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    char host[MPI_MAX_PROCESSOR_NAME] = {0};
+    int host_len;
+    MPI_Get_processor_name(host, &host_len);
+    double *all_stats = NULL;
+    char *all_hosts = NULL;
+    if (rank == 0) {
+        all_stats = alloc_doubles((size_t)size * NUM_STATS);
+        all_hosts = (char *)calloc((size_t)size, MPI_MAX_PROCESSOR_NAME);
+        if (all_hosts == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    MPI_Gather(stats, NUM_STATS, MPI_DOUBLE, all_stats, NUM_STATS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(host, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, all_hosts, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    int failed = 0;
+    if (rank == 0) {
+        double total = 0.0, max_comm = 0.0, sum_comm = 0.0;
+        printf("SUMMA %d x %d x %d on a %d x %d grid, %d threads per rank, panel %d, block %d\n",
+               M, N, K, g.rows, g.cols, num_threads, panel, block_size);
+        printf("%-5s %-20s %12s %10s %10s %10s %8s\n", "Rank", "Host", "Local C", "GFLOP/s", "Compute s", "Comm s",
+               "Comm %");
+        for (int r = 0; r < size; r++) {
+            double *st = all_stats + (size_t)r * NUM_STATS;
+            int rr = r / g.cols, rc = r % g.cols, rm0, rml, rn0, rnl;
+            block_range(M, g.rows, rr, &rm0, &rml);
+            block_range(N, g.cols, rc, &rn0, &rnl);
+            char local[32];
+            snprintf(local, sizeof(local), "%dx%d", rml, rnl);
+            printf("%-5d %-20.20s %12s %10.2f %10.4f %10.4f %7.1f%%\n", r, all_hosts + (size_t)r * MPI_MAX_PROCESSOR_NAME,
+                   local, st[STAT_FLOPS] / st[STAT_TIME] * 1e-9, st[STAT_COMPUTE], st[STAT_COMM],
+                   100.0 * st[STAT_COMM] / st[STAT_TIME]);
+            if (st[STAT_TIME] > total) total = st[STAT_TIME];
+            if (st[STAT_COMM] > max_comm) max_comm = st[STAT_COMM];
+            sum_comm += st[STAT_COMM];
+        }
+
+        // Per node: the ranks sharing a host name, their flops over the slowest of them
+        printf("%-20s %6s %10s\n", "Node", "Ranks", "GFLOP/s");
+        for (int r = 0; r < size; r++) {
+            const char *name = all_hosts + (size_t)r * MPI_MAX_PROCESSOR_NAME;
+            int first = 1;
+            for (int q = 0; q < r; q++) {
+                if (strcmp(name, all_hosts + (size_t)q * MPI_MAX_PROCESSOR_NAME) == 0) first = 0;
+            }
+            if (!first) continue;
+            double flops = 0.0, slowest = 0.0;
+            int ranks = 0;
+            for (int q = r; q < size; q++) {
+                double *st = all_stats + (size_t)q * NUM_STATS;
+                if (strcmp(name, all_hosts + (size_t)q * MPI_MAX_PROCESSOR_NAME) == 0) {
+                    flops += st[STAT_FLOPS];
+                    if (st[STAT_TIME] > slowest) slowest = st[STAT_TIME];
+                    ranks++;
+                }
+            }
+            printf("%-20.20s %6d %10.2f\n", name, ranks, flops / slowest * 1e-9);
+        }
+
+        double gflops = 2.0 * M * N * K / total * 1e-9;
+        failed = (global_err > 1e-12 * K);
+        printf("Total: %.6f s, %.2f GFLOP/s (%.2f per rank), comm wait max %.4f s, mean %.4f s\n", total, gflops,
+               gflops / size, max_comm, sum_comm / size);
+        printf("Max relative error over %d sampled entries per rank: %.3e%s\n", SUMMA_CHECK_SAMPLES, global_err,
+               failed ? "  FAILED" : "");
+
+        FILE *results_file = fopen("summa_results.csv", "a");
+        if (results_file == NULL) {
+            fprintf(stderr, "Error opening results file\n");
+            failed = 1;
+        } else {
+            if (ftell(results_file) == 0) {
+                fprintf(results_file, "Ranks,Grid Rows,Grid Cols,M,N,K,Threads,Panel,Block Size,Time,GFLOPS,"
+                                      "GFLOPS per Rank,Max Comm Time,Mean Comm Time,Max Rel Error\n");
+            }
+            fprintf(results_file, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%.6f,%.2f,%.2f,%.6f,%.6f,%.3e\n", size, g.rows, g.cols,
+                    M, N, K, num_threads, panel, block_size, total, gflops, gflops / size, max_comm, sum_comm / size,
+                    global_err);
+            fclose(results_file);
+            printf("\nSUMMA results appended to summa_results.csv\n");
+        }
+        free(all_stats);
+        free(all_hosts);
+    }
+    MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    free(panel_start);
+    free(A);
+    free(B);
+    free(C);
+    for (int b = 0; b < 2; b++) {
+        free(Apanel[b]);
+        free(Bpanel[b]);
+    }
+    MPI_Comm_free(&g.row_comm);
+    MPI_Comm_free(&g.col_comm);
+    MPI_Finalize();
+    return failed ? 1 : 0;
+}
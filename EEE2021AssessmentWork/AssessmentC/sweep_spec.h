@@ -0,0 +1,350 @@
+/**
+ * Benchmark sweep specification shared by GEMM.c and OptGEMM.c.
+ * The size list used to be hard-coded and always square. A sweep can now be given on the
+ * command line or in a small config file, so rectangular production shapes can be
+ * benchmarked without recompiling.
+ *
+ * Options (CLI form shown; a config file takes the same keys without the dashes, one
+ * "key value" or "key = value" per line, # starts a comment):
+ *   --sizes LIST        square sizes
+ *   --m LIST, --n LIST, --k LIST
+ *                       every combination of the lists; an axis that isn't given follows
+ *                       the first one that is, so "--m 64:4096:x2 --k 256" sweeps m = n
+ *   --shape MxNxK,...   explicit shapes (may be repeated)
+ *   --variants A,B,...  only run these variants (case, spaces, '_' and '-' are ignored)
+ *   --threads N, --block N, --blocking MC,KC,NC
+ *   --output PATH       times CSV; the stats CSV goes next to it as <name>_stats.csv
+ *   --json PATH         also append every result as a JSON line (see bench_json.h)
+ *   --config FILE       read more options from FILE
+ * LIST is comma separated values or ranges: "10,20,100:400:100" or "64:4096:x2" (doubling).
+ * Shapes from --shape, --sizes and --m/--n/--k are run in that order; with none of them
+ * the program's default size list is used. Anything else is returned as a positional argument.
+ */
+#ifndef SWEEP_SPEC_H
+#define SWEEP_SPEC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#define SWEEP_MAX_SHAPES 4096
+#define SWEEP_MAX_VALUES 1024
+#define SWEEP_MAX_VARIANTS 64
+#define SWEEP_MAX_NAME 64
+#define SWEEP_MAX_PATH 512
+#define SWEEP_MAX_POSITIONAL 8
+
+typedef struct {
+    int m, n, k;
+} sweep_shape_t;
+
+typedef struct {
+    sweep_shape_t shapes[SWEEP_MAX_SHAPES];
+    int num_shapes;
+    int sizes[SWEEP_MAX_VALUES], num_sizes;
+    int axis[3][SWEEP_MAX_VALUES], axis_count[3];   // m, n, k lists
+    char variants[SWEEP_MAX_VARIANTS][SWEEP_MAX_NAME];
+    int num_variants;                               // 0 = run everything
+    int threads, block_size;                        // 0 = not given
+    int mc, kc, nc;                                 // 0 = not given
+    char output[SWEEP_MAX_PATH];                    // empty = program default
+    char json[SWEEP_MAX_PATH];                      // empty = no JSON lines
+    const char *positional[SWEEP_MAX_POSITIONAL];
+    int num_positional;
+} sweep_spec_t;
+
+/**
+ * Parses a LIST into out. Returns the number of values, or -1 if it's malformed or too long.
+ */
+static inline int sweep_parse_list(const char *list, int *out, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long start = strtol(p, &end, 10);
+        if (end == p || start < 1) {
+            return -1;
+        }
+        long stop = start, step = 1;
+        int geometric = 0;
+        p = end;
+        if (*p == ':') {
+            stop = strtol(p + 1, &end, 10);
+            if (end == p + 1 || stop < start) {
+                return -1;
+            }
+            p = end;
+            if (*p == ':') {
+                geometric = (p[1] == 'x');
+                step = strtol(p + 1 + geometric, &end, 10);
+                if (end == p + 1 + geometric || step < (geometric ? 2 : 1)) {
+                    return -1;
+                }
+                p = end;
+            }
+        }
+        for (long v = start; v <= stop; v = geometric ? v * step : v + step) {
+            if (count >= max) {
+                return -1;
+            }
+            out[count++] = (int)v;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return count;
+}
+
+static inline int sweep_add_shape(sweep_spec_t *spec, int m, int n, int k) {
+    if (spec->num_shapes >= SWEEP_MAX_SHAPES || m < 1 || n < 1 || k < 1) {
+        return -1;
+    }
+    spec->shapes[spec->num_shapes++] = (sweep_shape_t){m, n, k};
+    return 0;
+}
+
+static inline int sweep_parse_config(sweep_spec_t *spec, const char *path);
+
+/**
+ * Applies one option (key without the leading dashes). Returns 0, or -1 with a message on stderr.
+ */
+static inline int sweep_set_option(sweep_spec_t *spec, const char *key, const char *value) {
+    int ok = 1;
+    if (strcmp(key, "sizes") == 0) {
+        ok = (spec->num_sizes = sweep_parse_list(value, spec->sizes, SWEEP_MAX_VALUES)) > 0;
+    } else if (strcmp(key, "m") == 0 || strcmp(key, "n") == 0 || strcmp(key, "k") == 0) {
+        int a = (key[0] == 'm') ? 0 : (key[0] == 'n') ? 1 : 2;
+        ok = (spec->axis_count[a] = sweep_parse_list(value, spec->axis[a], SWEEP_MAX_VALUES)) > 0;
+    } else if (strcmp(key, "shape") == 0) {
+        const char *p = value;
+        while (ok && *p != '\0') {
+            int m, n, k, used = 0;
+            ok = sscanf(p, "%dx%dx%d%n", &m, &n, &k, &used) == 3 && sweep_add_shape(spec, m, n, k) == 0;
+            p += used;
+            if (*p == ',') p++;
+        }
+    } else if (strcmp(key, "variants") == 0) {
+        const char *p = value;
+        while (ok && *p != '\0') {
+            size_t len = strcspn(p, ",");
+            ok = len > 0 && len < SWEEP_MAX_NAME && spec->num_variants < SWEEP_MAX_VARIANTS;
+            if (ok) {
+                memcpy(spec->variants[spec->num_variants], p, len);
+                spec->variants[spec->num_variants++][len] = '\0';
+            }
+            p += len;
+            if (*p == ',') p++;
+        }
+    } else if (strcmp(key, "threads") == 0) {
+        ok = (spec->threads = atoi(value)) > 0;
+    } else if (strcmp(key, "block") == 0) {
+        ok = (spec->block_size = atoi(value)) > 0;
+    } else if (strcmp(key, "blocking") == 0) {
+        ok = sscanf(value, "%d,%d,%d", &spec->mc, &spec->kc, &spec->nc) == 3 && spec->mc > 0 && spec->kc > 0 && spec->nc > 0;
+    } else if (strcmp(key, "output") == 0) {
+        ok = strlen(value) < SWEEP_MAX_PATH;
+        if (ok) strcpy(spec->output, value);
+    } else if (strcmp(key, "json") == 0) {
+        ok = strlen(value) < SWEEP_MAX_PATH;
+        if (ok) strcpy(spec->json, value);
+    } else if (strcmp(key, "config") == 0) {
+        return sweep_parse_config(spec, value);
+    } else {
+        fprintf(stderr, "Unknown sweep option '%s'\n", key);
+        return -1;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Invalid value for %s: '%s'\n", key, value);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int sweep_parse_config(sweep_spec_t *spec, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open sweep config %s\n", path);
+        return -1;
+    }
+
+    char line[1024];
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *key = line;
+        while (isspace((unsigned char)*key)) key++;
+        if (*key == '\0') {
+            continue;
+        }
+        char *value = key + strcspn(key, " \t=");
+        if (*value != '\0') {
+            *value++ = '\0';
+        }
+        while (isspace((unsigned char)*value) || *value == '=') value++;
+        char *end = value + strlen(value);
+        while (end > value && isspace((unsigned char)end[-1])) *--end = '\0';
+        status = sweep_set_option(spec, key, value);
+    }
+
+    fclose(f);
+    return status;
+}
+
+/**
+ * Parses argv into spec. Non-option arguments are kept in spec->positional in order.
+ * Returns 0, or -1 after printing what was wrong.
+ */
+static inline int sweep_parse_args(sweep_spec_t *spec, int argc, char *argv[]) {
+    memset(spec, 0, sizeof(*spec));
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                return -1;
+            }
+            if (sweep_set_option(spec, argv[i] + 2, argv[i + 1]) != 0) {
+                return -1;
+            }
+            i++;
+        } else if (spec->num_positional < SWEEP_MAX_POSITIONAL) {
+            spec->positional[spec->num_positional++] = argv[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Turns the size lists into shapes, falling back to the default square sizes.
+ * Returns -1 if the sweep has more than SWEEP_MAX_SHAPES shapes.
+ */
+static inline int sweep_finalize(sweep_spec_t *spec, const int *default_sizes, int num_default) {
+    for (int i = 0; i < spec->num_sizes; i++) {
+        if (sweep_add_shape(spec, spec->sizes[i], spec->sizes[i], spec->sizes[i]) != 0) return -1;
+    }
+
+    int first = -1;
+    for (int a = 0; a < 3 && first < 0; a++) {
+        if (spec->axis_count[a] > 0) first = a;
+    }
+    if (first >= 0) {
+        // Axes that weren't given follow the first given one (index -1)
+        int count[3];
+        for (int a = 0; a < 3; a++) count[a] = spec->axis_count[a] > 0 ? spec->axis_count[a] : 1;
+        for (int i = 0; i < count[0]; i++) {
+            for (int j = 0; j < count[1]; j++) {
+                for (int l = 0; l < count[2]; l++) {
+                    int idx[3] = {i, j, l};
+                    int v[3];
+                    for (int a = 0; a < 3; a++) {
+                        v[a] = spec->axis_count[a] > 0 ? spec->axis[a][idx[a]] : spec->axis[first][idx[first]];
+                    }
+                    if (sweep_add_shape(spec, v[0], v[1], v[2]) != 0) return -1;
+                }
+            }
+        }
+    }
+
+    if (spec->num_shapes == 0) {
+        for (int i = 0; i < num_default; i++) {
+            if (sweep_add_shape(spec, default_sizes[i], default_sizes[i], default_sizes[i]) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+// Lower-cased name without spaces, '_' and '-', so "MT+Blocked MNK f32" matches "mt+blocked_mnk_f32"
+static inline void sweep_normalize_name(const char *name, char *out, size_t size) {
+    size_t len = 0;
+    for (; *name != '\0' && len + 1 < size; name++) {
+        if (*name != ' ' && *name != '_' && *name != '-') {
+            out[len++] = (char)tolower((unsigned char)*name);
+        }
+    }
+    out[len] = '\0';
+}
+
+static inline int sweep_names_match(const char *a, const char *b) {
+    char na[SWEEP_MAX_NAME * 2], nb[SWEEP_MAX_NAME * 2];
+    sweep_normalize_name(a, na, sizeof(na));
+    sweep_normalize_name(b, nb, sizeof(nb));
+    return strcmp(na, nb) == 0;
+}
+
+/**
+ * True if the variant should run (no --variants means all of them).
+ */
+static inline int sweep_variant_selected(const sweep_spec_t *spec, const char *name) {
+    if (spec->num_variants == 0) {
+        return 1;
+    }
+    for (int i = 0; i < spec->num_variants; i++) {
+        if (sweep_names_match(spec->variants[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Checks every --variants entry against the available names. Prints the list and returns -1
+ * if one doesn't match anything.
+ */
+static inline int sweep_check_variants(const sweep_spec_t *spec, const char *const *names, int num_names) {
+    for (int i = 0; i < spec->num_variants; i++) {
+        int found = 0;
+        for (int j = 0; j < num_names && !found; j++) {
+            found = sweep_names_match(spec->variants[i], names[j]);
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown variant '%s', available:", spec->variants[i]);
+            for (int j = 0; j < num_names; j++) {
+                fprintf(stderr, "%s \"%s\"", j ? "," : "", names[j]);
+            }
+            fprintf(stderr, "\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The stats CSV path for a times CSV path: "dir/run.csv" -> "dir/run_stats.csv".
+ */
+static inline void sweep_stats_path(const char *times_path, char *out, size_t size) {
+    size_t len = strlen(times_path);
+    if (len >= 4 && strcmp(times_path + len - 4, ".csv") == 0) {
+        len -= 4;
+    }
+    snprintf(out, size, "%.*s_stats.csv", (int)len, times_path);
+}
+
+/**
+ * Size for the "Matrix Size" column: the side itself for a square shape, otherwise the side
+ * of the square problem with the same FLOP count, so the size axis still orders by work.
+ */
+static inline int sweep_shape_size(sweep_shape_t s) {
+    if (s.m == s.n && s.m == s.k) {
+        return s.m;
+    }
+    return (int)lround(cbrt((double)s.m * s.n * s.k));
+}
+
+/**
+ * True if any shape in the sweep isn't square.
+ */
+static inline int sweep_has_rectangular(const sweep_spec_t *spec) {
+    for (int i = 0; i < spec->num_shapes; i++) {
+        if (spec->shapes[i].m != spec->shapes[i].n || spec->shapes[i].m != spec->shapes[i].k) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
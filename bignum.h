@@ -0,0 +1,328 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+/**
+ * Arbitrary-precision unsigned integers for the factorial programs.
+ *
+ * A number is an array of 64-bit limbs, least significant first, with no leading zero
+ * limbs (zero has length 0). Limb products use the compiler's 128-bit type, so the
+ * basecase multiply is one hardware multiply per limb pair; above KARATSUBA_THRESHOLD
+ * limbs Karatsuba takes over, which is what keeps the big products of a product tree
+ * cheap. Everything is header-only so each program still builds as a single file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define KARATSUBA_THRESHOLD 32
+// Results up to this many decimal digits are printed in full, longer ones in scientific form
+#define BIGNUM_PRINT_DIGITS 120
+
+__extension__ typedef unsigned __int128 bignum_dlimb_t;
+
+typedef struct {
+    uint64_t *limbs;
+    size_t len, cap;
+} bignum_t;
+
+// n! for every n whose factorial fits in 64 bits
+static const uint64_t factorial_table[21] = {
+    1ULL, 1ULL, 2ULL, 6ULL, 24ULL, 120ULL, 720ULL, 5040ULL, 40320ULL, 362880ULL, 3628800ULL,
+    39916800ULL, 479001600ULL, 6227020800ULL, 87178291200ULL, 1307674368000ULL,
+    20922789888000ULL, 355687428096000ULL, 6402373705728000ULL, 121645100408832000ULL,
+    2432902008176640000ULL,
+};
+#define FACTORIAL_TABLE_MAX 20
+
+static inline void bignum_init(bignum_t *b) {
+    b->limbs = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+static inline void bignum_free(bignum_t *b) {
+    free(b->limbs);
+    bignum_init(b);
+}
+
+static inline void bignum_reserve(bignum_t *b, size_t cap) {
+    if (cap <= b->cap) {
+        return;
+    }
+    uint64_t *grown = (uint64_t *)realloc(b->limbs, cap * sizeof(uint64_t));
+    if (grown == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    b->limbs = grown;
+    b->cap = cap;
+}
+
+static inline void bignum_set_u64(bignum_t *b, uint64_t value) {
+    bignum_reserve(b, 1);
+    b->limbs[0] = value;
+    b->len = (value != 0);
+}
+
+// Drops leading zero limbs
+static inline size_t limbs_normalize(const uint64_t *a, size_t n) {
+    while (n > 0 && a[n - 1] == 0) {
+        n--;
+    }
+    return n;
+}
+
+// b *= w in place
+static inline void bignum_mul_u64(bignum_t *b, uint64_t w) {
+    if (w == 0 || b->len == 0) {
+        b->len = 0;
+        return;
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < b->len; i++) {
+        bignum_dlimb_t t = (bignum_dlimb_t)b->limbs[i] * w + carry;
+        b->limbs[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+    if (carry != 0) {
+        bignum_reserve(b, b->len < 4 ? 8 : 2 * b->len);
+        b->limbs[b->len++] = carry;
+    }
+}
+
+// r[0 .. rn) += a[0 .. an), an <= rn; the caller guarantees the sum fits in rn limbs
+static inline void limbs_add_into(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        bignum_dlimb_t t = (bignum_dlimb_t)r[i] + a[i] + carry;
+        r[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+    for (; carry != 0 && i < rn; i++) {
+        r[i] += 1;
+        carry = (r[i] == 0);
+    }
+}
+
+// r[0 .. rn) -= a[0 .. an), an <= rn; the caller guarantees r >= a
+static inline void limbs_sub_from(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+    uint64_t borrow = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        uint64_t d = r[i] - a[i];
+        uint64_t next = (r[i] < a[i]) | (d < borrow);
+        r[i] = d - borrow;
+        borrow = next;
+    }
+    for (; borrow != 0 && i < rn; i++) {
+        borrow = (r[i] == 0);
+        r[i] -= 1;
+    }
+}
+
+// r[0 .. an + bn) = a * b, one 64 x 64 -> 128-bit multiply per limb pair
+static inline void limbs_mul_basecase(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    memset(r, 0, (an + bn) * sizeof(uint64_t));
+    for (size_t j = 0; j < bn; j++) {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < an; i++) {
+            bignum_dlimb_t t = (bignum_dlimb_t)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        r[j + an] = carry;
+    }
+}
+
+static inline uint64_t* limbs_alloc(size_t n) {
+    uint64_t *p = (uint64_t *)malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+    if (p == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * r[0 .. an + bn) = a * b. Karatsuba splits the longer operand at h = ceil(an / 2):
+ * with a = a1 B^h + a0 and b = b1 B^h + b0, the product is z2 B^2h + z1 B^h + z0 where
+ * z1 = (a0 + a1)(b0 + b1) - z0 - z2, three half-size products instead of four. A much
+ * shorter b is instead multiplied against a in b-sized slices.
+ */
+static void limbs_mul(uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b, size_t bn) {
+    if (an < bn) {
+        const uint64_t *t = a; a = b; b = t;
+        size_t tn = an; an = bn; bn = tn;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        if (bn == 0) {
+            memset(r, 0, an * sizeof(uint64_t));
+        } else {
+            limbs_mul_basecase(r, a, an, b, bn);
+        }
+        return;
+    }
+
+    size_t h = (an + 1) / 2;
+    if (bn <= h) {
+        // Unbalanced: slices of a times b, each added in at its offset
+        uint64_t *part = limbs_alloc(2 * bn);
+        memset(r, 0, (an + bn) * sizeof(uint64_t));
+        for (size_t off = 0; off < an; off += bn) {
+            size_t len = (an - off < bn) ? an - off : bn;
+            limbs_mul(part, a + off, len, b, bn);
+            limbs_add_into(r + off, an + bn - off, part, len + bn);
+        }
+        free(part);
+        return;
+    }
+
+    size_t a1n = an - h, b1n = bn - h;
+    uint64_t *sa = limbs_alloc(h + 1);
+    uint64_t *sb = limbs_alloc(h + 1);
+    memcpy(sa, a, h * sizeof(uint64_t));
+    sa[h] = 0;
+    limbs_add_into(sa, h + 1, a + h, a1n);
+    memcpy(sb, b, h * sizeof(uint64_t));
+    sb[h] = 0;
+    limbs_add_into(sb, h + 1, b + h, b1n);
+    size_t san = limbs_normalize(sa, h + 1), sbn = limbs_normalize(sb, h + 1);
+
+    // z0 and z2 go straight into the low and high halves of r
+    limbs_mul(r, a, h, b, h);
+    limbs_mul(r + 2 * h, a + h, a1n, b + h, b1n);
+
+    uint64_t *z1 = limbs_alloc(san + sbn);
+    limbs_mul(z1, sa, san, sb, sbn);
+    size_t z1n = san + sbn;
+    limbs_sub_from(z1, z1n, r, limbs_normalize(r, 2 * h));
+    limbs_sub_from(z1, z1n, r + 2 * h, limbs_normalize(r + 2 * h, a1n + b1n));
+    z1n = limbs_normalize(z1, z1n);
+    limbs_add_into(r + h, an + bn - h, z1, z1n);
+
+    free(z1);
+    free(sa);
+    free(sb);
+}
+
+// r = a * b; r must not be a or b
+static inline void bignum_mul(bignum_t *r, const bignum_t *a, const bignum_t *b) {
+    if (a->len == 0 || b->len == 0) {
+        r->len = 0;
+        return;
+    }
+    bignum_reserve(r, a->len + b->len);
+    limbs_mul(r->limbs, a->limbs, a->len, b->limbs, b->len);
+    r->len = limbs_normalize(r->limbs, a->len + b->len);
+}
+
+static inline size_t bignum_bits(const bignum_t *b) {
+    if (b->len == 0) {
+        return 0;
+    }
+    return (b->len - 1) * 64 + (size_t)(64 - __builtin_clzll(b->limbs[b->len - 1]));
+}
+
+/**
+ * Decimal string of b (caller frees), by repeated division by 10^19. That's quadratic in
+ * the length, so it's only meant for numbers of a few thousand digits.
+ */
+static inline char* bignum_to_decimal(const bignum_t *b) {
+    const uint64_t chunk = 10000000000000000000ULL;   // 10^19
+    size_t n = b->len;
+    uint64_t *work = limbs_alloc(n);
+    memcpy(work, b->limbs, n * sizeof(uint64_t));
+    size_t max_chunks = n * 64 / 63 + 1;   // 10^19 > 2^63
+    uint64_t *chunks = limbs_alloc(max_chunks);
+    size_t num_chunks = 0;
+    while (n > 0) {
+        uint64_t rem = 0;
+        for (size_t i = n; i-- > 0;) {
+            bignum_dlimb_t t = ((bignum_dlimb_t)rem << 64) | work[i];
+            work[i] = (uint64_t)(t / chunk);
+            rem = (uint64_t)(t % chunk);
+        }
+        chunks[num_chunks++] = rem;
+        n = limbs_normalize(work, n);
+    }
+
+    char *s = (char *)malloc(num_chunks * 19 + 2);
+    if (s == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    if (num_chunks == 0) {
+        strcpy(s, "0");
+    } else {
+        int pos = sprintf(s, "%llu", (unsigned long long)chunks[num_chunks - 1]);
+        for (size_t c = num_chunks - 1; c-- > 0;) {
+            pos += sprintf(s + pos, "%019llu", (unsigned long long)chunks[c]);
+        }
+    }
+    free(work);
+    free(chunks);
+    return s;
+}
+
+/**
+ * b ~= mantissa * 10^exponent with 1 <= mantissa < 10, from its top 64 bits. The logs
+ * are short series rather than libm calls so the programs don't need -lm.
+ */
+static inline void bignum_scientific(const bignum_t *b, long double *mantissa, long *exponent) {
+    const long double ln2 = 0.693147180559945309417232121458176568L;
+    const long double ln10 = 2.302585092994045684017991454684364208L;
+    if (b->len == 0) {
+        *mantissa = 0.0L;
+        *exponent = 0;
+        return;
+    }
+    // b ~= m * 2^e with m in [1, 2), m from the top 64 bits (exact in a long double)
+    int lz = __builtin_clzll(b->limbs[b->len - 1]);
+    uint64_t hi = b->limbs[b->len - 1] << lz;
+    if (lz > 0 && b->len > 1) {
+        hi |= b->limbs[b->len - 2] >> (64 - lz);
+    }
+    long e = (long)bignum_bits(b) - 1;
+    long double m = (long double)hi / 9223372036854775808.0L;   // 2^63
+    // ln m = 2 atanh((m - 1) / (m + 1)), |z| <= 1/3
+    long double z = (m - 1.0L) / (m + 1.0L), z2 = z * z, term = z, ln_m = 0.0L;
+    for (int i = 1; i < 80; i += 2) {
+        ln_m += term / i;
+        term *= z2;
+    }
+    ln_m *= 2.0L;
+
+    long double log10_b = ((long double)e * ln2 + ln_m) / ln10;
+    long ex = (long)log10_b;
+    long double frac = (log10_b - (long double)ex) * ln10;
+    // 10^frac = exp(frac), frac < ln 10
+    long double sum = 1.0L, t = 1.0L;
+    for (int i = 1; i < 60; i++) {
+        t *= frac / i;
+        sum += t;
+    }
+    if (sum >= 10.0L) {
+        sum /= 10.0L;
+        ex++;
+    }
+    *mantissa = sum;
+    *exponent = ex;
+}
+
+// Prints b in full if it's short enough, otherwise mantissa, exponent and digit count
+static inline void bignum_print(const bignum_t *b) {
+    long double mantissa;
+    long exponent;
+    bignum_scientific(b, &mantissa, &exponent);
+    if (exponent < BIGNUM_PRINT_DIGITS) {
+        char *s = bignum_to_decimal(b);
+        printf("%s", s);
+        free(s);
+    } else {
+        printf("%.15Lfe+%ld (%ld digits)", mantissa, exponent, exponent + 1);
+    }
+}
+
+#endif
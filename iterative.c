@@ -1,77 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <sys/resource.h>
+#include "bignum.h"
+#define MEMPROF_ALLOCATOR
+#include "memprof.h"   // Stack depth, heap high-water mark and page faults
+
+// Factorials of these are computed when no arguments are given
+#define DEFAULT_VALUES {3, 6, 7, 8, 20, 21, 100, 1000, 100000}
 
 /**
- * Calculate factorial iteratively without using multiplication
+ * Calculate factorial iteratively, as a product tree built bottom up
+ *
+ * The factors 2..n are first packed into as few 64-bit words as they fit in, then
+ * neighbouring products are multiplied pairwise, level by level, until one is left.
+ * Each level roughly halves the count and doubles the operand size, so the work sits in
+ * a few large balanced multiplies that Karatsuba handles well, instead of n growing-times-
+ * small ones. n <= 20 comes straight from the table.
  * @param n The number for which factorial is to be calculated
- * @return The factorial of n
+ * @param result Receives n! (initialised by the caller)
  */
-int factorial_iterative(int n) {
-    int result = 1;
-    
-    for (int i = 2; i <= n; i++) {
-        // Use repeated addition to simulate multiplication
-        int temp = 0;
-        for (int j = 0; j < i; j++) {
-            temp += result;
+void factorial_iterative(int n, bignum_t *result) {
+    if (n <= FACTORIAL_TABLE_MAX) {
+        bignum_set_u64(result, factorial_table[n < 0 ? 0 : n]);
+        return;
+    }
+
+    // Leaves: runs of consecutive factors whose product still fits in a word
+    size_t max_leaves = (size_t)n;
+    bignum_t *level = (bignum_t *)malloc(max_leaves * sizeof(bignum_t));
+    if (level == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    size_t count = 0;
+    uint64_t next = 2;
+    while (next <= (uint64_t)n) {
+        uint64_t word = 1;
+        while (next <= (uint64_t)n && word <= UINT64_MAX / next) {
+            word *= next++;
+        }
+        bignum_init(&level[count]);
+        bignum_set_u64(&level[count], word);
+        count++;
+    }
+
+    while (count > 1) {
+        size_t half = 0;
+        for (size_t i = 0; i + 1 < count; i += 2) {
+            bignum_t product;
+            bignum_init(&product);
+            bignum_mul(&product, &level[i], &level[i + 1]);
+            bignum_free(&level[i]);
+            bignum_free(&level[i + 1]);
+            level[half++] = product;
+        }
+        if (count % 2 == 1) {
+            level[half++] = level[count - 1];
         }
-        result = temp;
+        count = half;
     }
-    
-    return result;
+
+    bignum_free(result);
+    *result = level[0];
+    free(level);
 }
 
 /**
  * Main function to test factorial calculation
+ * Usage: ./iterative [n ...]
  */
-int main() {
+int main(int argc, char *argv[]) {
     // Array of values to calculate factorial for
-    int values[] = {3, 6, 7, 8};
-    int num_values = sizeof(values) / sizeof(values[0]);
-    
-    // For measuring memory
-    struct rusage usage_before, usage_after;
-    
+    int defaults[] = DEFAULT_VALUES;
+    int num_values = (argc > 1) ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
     printf("Iterative Factorial Implementation\n");
     printf("==================================\n");
-    
+
+    // Binds clock() up front, so its first lazy lookup doesn't count as the first factorial's stack
+    clock();
+
     for (int i = 0; i < num_values; i++) {
-        int n = values[i];
-        
-        // Get memory usage before calculation
-        getrusage(RUSAGE_SELF, &usage_before);
-        
-        // Measure time
+        int n = (argc > 1) ? atoi(argv[i + 1]) : defaults[i];
+        if (n < 0) {
+            fprintf(stderr, "Factorial of %d is undefined\n", n);
+            return 1;
+        }
+        bignum_t result;
+        bignum_init(&result);
+
+        // Measure memory (stack painted, heap counted) around the timed call
+        memprof_t mp;
+        memprof_begin(&mp);
         clock_t start = clock();
-        int result = factorial_iterative(n);
+        factorial_iterative(n, &result);
         clock_t end = clock();
-        
-        // Get memory usage after calculation
-        getrusage(RUSAGE_SELF, &usage_after);
-        
+        memprof_result_t mem = memprof_end(&mp);
+
         double cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        
-        // Calculate peak memory usage (in bytes)
-        long memory_used = (usage_after.ru_maxrss - usage_before.ru_maxrss) * 1024;
-        
-        // If no change detected in RSS, provide a detailed estimate
-        if (memory_used <= 0) {
-            // Calculate static memory for main variables
-            size_t static_memory = sizeof(int) * 3; // result, i, temp variables
-            
-            // Add memory for each loop level
-            size_t loop_memory = sizeof(int) * 2; // i and j loop counters
-            
-            // Total theoretical memory (scales with n due to loop iterations)
-            memory_used = static_memory + loop_memory + (n * sizeof(int));
-        }
-        
-        printf("Factorial of %d = %d\n", n, result);
+
+        printf("Factorial of %d = ", n);
+        bignum_print(&result);
+        printf("\n");
         printf("Time taken: %f seconds\n", cpu_time_used);
-        printf("Memory used: %ld bytes\n\n", memory_used);
+        printf("Memory used: %ld bytes (stack %ld, heap peak %ld in %ld allocations)\n", mem.stack_bytes +
+               mem.heap_peak_bytes, mem.stack_bytes, mem.heap_peak_bytes, mem.allocations);
+        printf("Page faults: %ld minor, %ld major\n\n", mem.minor_faults, mem.major_faults);
+        bignum_free(&result);
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,353 @@
+/**
+ * Memory profile of one measured call, for the benchmark mains and the factorial programs:
+ * how deep the calling thread's stack went, the heap high-water mark and how many
+ * allocations it took, and the page faults, next to the timing columns. Memory regressions
+ * then turn up in the same run as time ones, without a separate massif pass.
+ *
+ * Stack: memprof_begin paints MEMPROF_STACK_PAINT bytes below the caller's frame with a
+ * pattern, and memprof_end finds the lowest byte the call overwrote. Only the calling
+ * thread's stack is seen (for the MT variants that's worker 0, which runs a share like any
+ * other worker); calls that go past the painted region report it as saturated. Returning
+ * through memprof_end costs a couple of hundred bytes, so that's the floor.
+ *
+ * Heap: the program that includes this with MEMPROF_ALLOCATOR defined (exactly one file of
+ * it) replaces malloc and friends with wrappers around glibc's own allocator. While a
+ * measurement is running they record each block allocated, with its malloc_usable_size, in
+ * a table of their own, and keep a live byte count of those blocks. A free only counts when
+ * its block is in the table, so releasing memory from before memprof_begin can't hide the
+ * call's own allocations. The peak is taken over every thread. Arena memory that came from
+ * mmap rather than malloc isn't heap here, but its first touches still show up as page faults.
+ *
+ * This header is shared by the GEMM mains and the factorial programs at the top of the repo.
+ * The GEMM mains measure when GEMM_MEMPROF=1, in an extra untimed pass like GEMM_PERF.
+ */
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define MEMPROF_STACK_PAINT (1 << 20)
+#define MEMPROF_PAINT_BYTE 0xA5
+#define MEMPROF_NUM_COLUMNS 5
+
+static const char *memprof_column_names[MEMPROF_NUM_COLUMNS] = {
+    "Stack Bytes", "Heap Peak Bytes", "Allocations", "Minor Faults", "Major Faults"
+};
+
+// Defined by the MEMPROF_ALLOCATOR part below
+extern atomic_int memprof_heap_counting;
+extern atomic_long memprof_heap_live, memprof_heap_peak, memprof_heap_allocs;
+void memprof_heap_reset(void);
+
+typedef struct {
+    long stack_bytes;       // deepest stack use below memprof_begin's caller
+    int stack_saturated;    // the call went past the painted region, so stack_bytes is a lower bound
+    long heap_peak_bytes;   // most heap held at once in blocks the call allocated
+    long heap_net_bytes;    // of those, still held at memprof_end (leaks, caches)
+    long allocations;
+    long minor_faults, major_faults;
+} memprof_result_t;
+
+typedef struct {
+    uintptr_t paint_low, paint_high;
+    struct rusage usage;
+} memprof_t;
+
+static inline int memprof_requested(void) {
+    const char *s = getenv("GEMM_MEMPROF");
+    return s != NULL && strcmp(s, "0") != 0;
+}
+
+// Paints the stack just below the caller's frame, returns the low end of the painted bytes
+static __attribute__((noinline)) uintptr_t memprof_paint_stack(void) {
+    char region[MEMPROF_STACK_PAINT];
+    memset(region, MEMPROF_PAINT_BYTE, sizeof(region));
+    __asm__ volatile("" : : "r"(region) : "memory");
+    return (uintptr_t)region;
+}
+
+// Lowest painted byte that no longer holds the pattern, or high if none was touched
+static __attribute__((noinline)) uintptr_t memprof_scan_stack(uintptr_t low, uintptr_t high) {
+    const volatile unsigned char *p = (const volatile unsigned char *)low;
+    size_t n = (size_t)(high - low), i = 0;
+    while (i < n && p[i] == MEMPROF_PAINT_BYTE) {
+        i++;
+    }
+    return low + i;
+}
+
+/**
+ * Painting goes last, so nothing of memprof's own (a first lazily bound call, say) lands in the
+ * paint. It's done twice: the first pass faults the pages in before the fault count is taken.
+ */
+static inline void memprof_begin(memprof_t *mp) {
+    memprof_paint_stack();
+    getrusage(RUSAGE_SELF, &mp->usage);
+    memprof_heap_reset();
+    atomic_store(&memprof_heap_counting, 1);
+    mp->paint_low = memprof_paint_stack();
+    mp->paint_high = mp->paint_low + MEMPROF_STACK_PAINT;
+}
+
+static inline memprof_result_t memprof_end(memprof_t *mp) {
+    // The scan goes first, before anything else gets to use the painted stack
+    uintptr_t touched = memprof_scan_stack(mp->paint_low, mp->paint_high);
+    atomic_store(&memprof_heap_counting, 0);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    memprof_result_t r;
+    r.stack_bytes = (long)(mp->paint_high - touched);
+    r.stack_saturated = (touched == mp->paint_low);
+    r.heap_peak_bytes = atomic_load(&memprof_heap_peak);
+    r.heap_net_bytes = atomic_load(&memprof_heap_live);
+    r.allocations = atomic_load(&memprof_heap_allocs);
+    r.minor_faults = usage.ru_minflt - mp->usage.ru_minflt;
+    r.major_faults = usage.ru_majflt - mp->usage.ru_majflt;
+    return r;
+}
+
+// "stack 1234 B, heap peak ..." on its own line after a result
+static inline void memprof_print(const memprof_result_t *r) {
+    printf("    stack %s%ld B, heap peak %ld B in %ld allocations, %ld minor / %ld major faults\n",
+           r->stack_saturated ? ">" : "", r->stack_bytes, r->heap_peak_bytes, r->allocations, r->minor_faults,
+           r->major_faults);
+}
+
+// One untimed call of body (after reset), profiled
+static inline void memprof_measure(void (*reset)(void *), void (*body)(void *), void *ctx, memprof_result_t *out) {
+    if (reset) reset(ctx);
+    memprof_t mp;
+    memprof_begin(&mp);
+    body(ctx);
+    *out = memprof_end(&mp);
+}
+
+// ",Stack Bytes,Heap Peak Bytes,..." for the end of a CSV header
+static inline void memprof_write_header_columns(FILE *f) {
+    for (int c = 0; c < MEMPROF_NUM_COLUMNS; c++) {
+        fprintf(f, ",%s", memprof_column_names[c]);
+    }
+}
+
+// Profile columns for one row; r == NULL (profiling off) leaves them empty. A saturated stack reads MEMPROF_STACK_PAINT
+static inline void memprof_write_columns(FILE *f, const memprof_result_t *r) {
+    if (r == NULL) {
+        fprintf(f, ",,,,,");
+        return;
+    }
+    fprintf(f, ",%ld,%ld,%ld,%ld,%ld", r->stack_bytes, r->heap_peak_bytes, r->allocations, r->minor_faults,
+            r->major_faults);
+}
+
+#ifdef MEMPROF_ALLOCATOR
+#include <errno.h>
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+#define MEMPROF_TABLE_MIN 1024
+
+atomic_int memprof_heap_counting = 0;
+atomic_long memprof_heap_live = 0, memprof_heap_peak = 0, memprof_heap_allocs = 0;
+
+/**
+ * The blocks allocated since memprof_begin: an open-addressed table of address and size,
+ * at most half full, behind a spinlock. It lives in __libc_calloc memory so the wrappers
+ * never see it.
+ */
+typedef struct {
+    void *ptr;
+    long size;
+} memprof_block_t;
+
+static memprof_block_t *memprof_blocks = NULL;
+static size_t memprof_blocks_cap = 0, memprof_blocks_used = 0;
+static atomic_flag memprof_blocks_lock = ATOMIC_FLAG_INIT;
+
+static inline void memprof_blocks_acquire(void) {
+    while (atomic_flag_test_and_set_explicit(&memprof_blocks_lock, memory_order_acquire)) {
+    }
+}
+
+static inline void memprof_blocks_release(void) {
+    atomic_flag_clear_explicit(&memprof_blocks_lock, memory_order_release);
+}
+
+static inline size_t memprof_slot(const void *p, size_t cap) {
+    return (size_t)((((uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+// Caller holds the lock. Returns -1 if the table couldn't grow
+static int memprof_blocks_insert(void *p, long size) {
+    if (2 * (memprof_blocks_used + 1) > memprof_blocks_cap) {
+        size_t cap = memprof_blocks_cap ? 2 * memprof_blocks_cap : MEMPROF_TABLE_MIN;
+        memprof_block_t *grown = (memprof_block_t *)__libc_calloc(cap, sizeof(memprof_block_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < memprof_blocks_cap; i++) {
+            if (memprof_blocks[i].ptr != NULL) {
+                size_t s = memprof_slot(memprof_blocks[i].ptr, cap);
+                while (grown[s].ptr != NULL) s = (s + 1) & (cap - 1);
+                grown[s] = memprof_blocks[i];
+            }
+        }
+        __libc_free(memprof_blocks);
+        memprof_blocks = grown;
+        memprof_blocks_cap = cap;
+    }
+    size_t s = memprof_slot(p, memprof_blocks_cap);
+    while (memprof_blocks[s].ptr != NULL) s = (s + 1) & (memprof_blocks_cap - 1);
+    memprof_blocks[s] = (memprof_block_t){p, size};
+    memprof_blocks_used++;
+    return 0;
+}
+
+// Caller holds the lock. Removes p and returns its size, or 0 if p wasn't allocated while counting
+static long memprof_blocks_take(const void *p) {
+    if (memprof_blocks_cap == 0) {
+        return 0;
+    }
+    size_t mask = memprof_blocks_cap - 1, s = memprof_slot(p, memprof_blocks_cap);
+    while (memprof_blocks[s].ptr != p) {
+        if (memprof_blocks[s].ptr == NULL) {
+            return 0;
+        }
+        s = (s + 1) & mask;
+    }
+    long size = memprof_blocks[s].size;
+    memprof_blocks_used--;
+    // Shift later entries of the probe run back into the hole, so lookups never stop early
+    for (size_t next = (s + 1) & mask; memprof_blocks[next].ptr != NULL; next = (next + 1) & mask) {
+        size_t home = memprof_slot(memprof_blocks[next].ptr, memprof_blocks_cap);
+        if (((next - home) & mask) >= ((next - s) & mask)) {
+            memprof_blocks[s] = memprof_blocks[next];
+            s = next;
+        }
+    }
+    memprof_blocks[s].ptr = NULL;
+    return size;
+}
+
+// Forgets every block and zeroes the counts; memprof_begin calls it before counting starts
+void memprof_heap_reset(void) {
+    memprof_blocks_acquire();
+    if (memprof_blocks != NULL) {
+        memset(memprof_blocks, 0, memprof_blocks_cap * sizeof(memprof_block_t));
+    }
+    memprof_blocks_used = 0;
+    memprof_blocks_release();
+    atomic_store(&memprof_heap_live, 0);
+    atomic_store(&memprof_heap_peak, 0);
+    atomic_store(&memprof_heap_allocs, 0);
+}
+
+// Binds the glibc entry points at startup, so their first lazy lookup isn't charged to a measured call's stack
+__attribute__((constructor)) static void memprof_bind_allocator(void) {
+    void *p = __libc_realloc(__libc_malloc(16), 32);
+    (void)malloc_usable_size(p);
+    __libc_free(p);
+    __libc_free(__libc_calloc(1, 16));
+    __libc_free(__libc_memalign(64, 16));
+}
+
+static inline void memprof_heap_add(void *p) {
+    if (p == NULL || !atomic_load_explicit(&memprof_heap_counting, memory_order_relaxed)) {
+        return;
+    }
+    long size = (long)malloc_usable_size(p);
+    memprof_blocks_acquire();
+    int recorded = memprof_blocks_insert(p, size) == 0;
+    memprof_blocks_release();
+    if (!recorded) {
+        return;   // out of memory for the table: leave the block out of the profile altogether
+    }
+    long now = atomic_fetch_add_explicit(&memprof_heap_live, size, memory_order_relaxed) + size;
+    long peak = atomic_load_explicit(&memprof_heap_peak, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&memprof_heap_peak, &peak, now,
+                                                                memory_order_relaxed, memory_order_relaxed)) {
+    }
+    atomic_fetch_add_explicit(&memprof_heap_allocs, 1, memory_order_relaxed);
+}
+
+// Takes p out of the table (before it's released, so nobody else can be handed its address yet)
+static inline long memprof_heap_remove(void *p) {
+    if (p == NULL || !atomic_load_explicit(&memprof_heap_counting, memory_order_relaxed)) {
+        return 0;
+    }
+    memprof_blocks_acquire();
+    long size = memprof_blocks_take(p);
+    memprof_blocks_release();
+    atomic_fetch_sub_explicit(&memprof_heap_live, size, memory_order_relaxed);
+    return size;
+}
+
+void *malloc(size_t size) {
+    void *p = __libc_malloc(size);
+    memprof_heap_add(p);
+    return p;
+}
+
+void *calloc(size_t count, size_t size) {
+    void *p = __libc_calloc(count, size);
+    memprof_heap_add(p);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    long old = memprof_heap_remove(ptr);
+    void *p = __libc_realloc(ptr, size);
+    if (p == NULL && size != 0) {
+        // ptr is untouched, so it goes back in as it was
+        if (old != 0) {
+            memprof_blocks_acquire();
+            if (memprof_blocks_insert(ptr, old) == 0) {
+                atomic_fetch_add_explicit(&memprof_heap_live, old, memory_order_relaxed);
+            }
+            memprof_blocks_release();
+        }
+        return NULL;
+    }
+    memprof_heap_add(p);
+    return p;
+}
+
+void free(void *ptr) {
+    memprof_heap_remove(ptr);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *p = __libc_memalign(alignment, size);
+    memprof_heap_add(p);
+    return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *p = memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+#endif
+
+#endif
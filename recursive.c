@@ -1,112 +1,127 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <sys/resource.h>
+#include "bignum.h"
+#define MEMPROF_ALLOCATOR
+#include "memprof.h"   // Stack depth, heap high-water mark and page faults
+
+// Factorials of these are computed when no arguments are given
+#define DEFAULT_VALUES {3, 6, 7, 8, 20, 21, 100, 1000, 100000}
+// Ranges this short are multiplied out directly rather than split again
+#define PRODUCT_LEAF 16
 
 // Global variable to track maximum recursion depth
 int max_recursion_depth = 0;
 int current_depth = 0;
 
 /**
- * Recursive factorial with stack depth tracking
- * @param n The number for which factorial is to be calculated
- * @return The factorial of n
+ * Product lo * (lo + 1) * ... * hi by binary splitting, with stack depth tracking
+ *
+ * Splitting the range in half and multiplying the two halves keeps the operands of each
+ * multiply about the same size, so the recursion is only log2(n) deep and the top
+ * multiplies are the large balanced ones Karatsuba is fast at.
+ * @param lo First factor
+ * @param hi Last factor (lo <= hi)
+ * @param out Receives the product (initialised by the caller)
  */
-int factorial_recursive(int n) {
+void product_range(uint64_t lo, uint64_t hi, bignum_t *out) {
     // Track recursion depth for memory calculation
     current_depth++;
     if (current_depth > max_recursion_depth) {
         max_recursion_depth = current_depth;
     }
-    
-    // Base case
-    if (n <= 1) {
+
+    // Base case - pack the factors into words, then multiply those in
+    if (hi - lo < PRODUCT_LEAF) {
+        bignum_set_u64(out, 1);
+        uint64_t next = lo;
+        while (next <= hi) {
+            uint64_t word = 1;
+            while (next <= hi && word <= UINT64_MAX / next) {
+                word *= next++;
+            }
+            bignum_mul_u64(out, word);
+        }
         current_depth--;
-        return 1;
+        return;
     }
-    
-    // Recursive case - use repeated addition instead of multiplication
-    int smaller_factorial = factorial_recursive(n - 1);
-    
-    // Multiply n with smaller_factorial using repeated addition
-    int result = 0;
-    for (int i = 0; i < n; i++) {
-        result += smaller_factorial;
-    }
-    
+
+    // Recursive case - the two halves, then one multiply
+    uint64_t mid = lo + (hi - lo) / 2;
+    bignum_t left, right;
+    bignum_init(&left);
+    bignum_init(&right);
+    product_range(lo, mid, &left);
+    product_range(mid + 1, hi, &right);
+    bignum_mul(out, &left, &right);
+    bignum_free(&left);
+    bignum_free(&right);
+
     current_depth--;
-    return result;
 }
 
 /**
- * Calculate stack frame size for a recursive call
- * @return Estimated size of a single stack frame in bytes
+ * Recursive factorial: n <= 20 from the table, larger n as the product tree of 2..n
+ * @param n The number for which factorial is to be calculated
+ * @param result Receives n! (initialised by the caller)
  */
-size_t calculate_stack_frame_size() {
-    // Parameters and return value
-    size_t param_size = sizeof(int);
-    
-    // Local variables
-    size_t local_vars = sizeof(int) * 2;  // smaller_factorial, result
-    
-    // Loop counter
-    size_t loop_counter = sizeof(int);    // i
-    
-    // Function call overhead (return address, frame pointer)
-    size_t call_overhead = sizeof(void*) * 2;
-    
-    return param_size + local_vars + loop_counter + call_overhead;
+void factorial_recursive(int n, bignum_t *result) {
+    if (n <= FACTORIAL_TABLE_MAX) {
+        current_depth = max_recursion_depth = 1;
+        bignum_set_u64(result, factorial_table[n < 0 ? 0 : n]);
+        return;
+    }
+    product_range(2, (uint64_t)n, result);
 }
 
 /**
  * Main function to test factorial
+ * Usage: ./recursive [n ...]
  */
-int main() {
-    int values[] = {3, 6, 7, 8};
-    int num_values = sizeof(values) / sizeof(values[0]);
-    
-    // For measuring memory
-    struct rusage usage_before, usage_after;
-    
+int main(int argc, char *argv[]) {
+    int defaults[] = DEFAULT_VALUES;
+    int num_values = (argc > 1) ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
     printf("Recursive Factorial Implementation\n");
     printf("==================================\n");
-    
+
+    // Binds clock() up front, so its first lazy lookup doesn't count as the first factorial's stack
+    clock();
+
     for (int i = 0; i < num_values; i++) {
-        int n = values[i];
-        
+        int n = (argc > 1) ? atoi(argv[i + 1]) : defaults[i];
+        if (n < 0) {
+            fprintf(stderr, "Factorial of %d is undefined\n", n);
+            return 1;
+        }
+        bignum_t result;
+        bignum_init(&result);
+
         // Reset depth trackers
         max_recursion_depth = 0;
         current_depth = 0;
-        
-        // Get memory usage before calculation
-        getrusage(RUSAGE_SELF, &usage_before);
-        
-        // Measure time
+
+        // Measure memory (stack painted, heap counted) around the timed call
+        memprof_t mp;
+        memprof_begin(&mp);
         clock_t start = clock();
-        int result = factorial_recursive(n);
+        factorial_recursive(n, &result);
         clock_t end = clock();
-        
-        // Get memory usage after calculation
-        getrusage(RUSAGE_SELF, &usage_after);
-        
+        memprof_result_t mem = memprof_end(&mp);
+
         double cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        
-        // Calculate memory from system measurement
-        long system_memory = (usage_after.ru_maxrss - usage_before.ru_maxrss) * 1024;
-        
-        // Calculate theoretical stack memory based on recursion depth
-        size_t stack_frame_size = calculate_stack_frame_size();
-        size_t theoretical_memory = stack_frame_size * max_recursion_depth;
-        
-        // Use the larger of the two for reporting
-        long memory_used = (system_memory > 0) ? system_memory : theoretical_memory;
-        
-        printf("Factorial of %d = %d\n", n, result);
+
+        printf("Factorial of %d = ", n);
+        bignum_print(&result);
+        printf("\n");
         printf("Time taken: %f seconds\n", cpu_time_used);
-        printf("Memory used: %ld bytes\n", memory_used);
-        printf("(Stack depth: %d, Frame size: %zu bytes)\n\n", 
-               max_recursion_depth, stack_frame_size);
+        printf("Memory used: %ld bytes (stack %ld, heap peak %ld in %ld allocations)\n", mem.stack_bytes +
+               mem.heap_peak_bytes, mem.stack_bytes, mem.heap_peak_bytes, mem.allocations);
+        printf("Page faults: %ld minor, %ld major\n", mem.minor_faults, mem.major_faults);
+        printf("(Stack depth: %d calls, %ld bytes per call)\n\n", max_recursion_depth,
+               mem.stack_bytes / max_recursion_depth);
+        bignum_free(&result);
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}